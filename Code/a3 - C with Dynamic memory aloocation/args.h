@@ -0,0 +1,47 @@
+/** @file args.h
+ *  @brief The command-line arguments of a query.
+ *
+ *  One args value describes a whole query: the options as given, plus the
+ *  sort, --where and GROUP BY plans parsed from them and the metrics the
+ *  query fills in while it runs.
+ */
+#ifndef _ARGS_H_
+#define _ARGS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "group.h"
+#include "sortkey.h"
+#include "stats.h"
+#include "where.h"
+
+typedef struct{
+    char* data;
+    char* filter;
+    char* value;
+    char* order_by;
+    char* order;
+    int limit;
+    int threads;
+    char* build_snapshot;
+    bool verify;
+    bool build_index;
+    bool use_index;
+    bool ignore_case;
+    char* serve;
+    size_t max_memory;
+    char* output;
+    sort_spec sort;
+    char* where;
+    where_plan* plan;
+    stats_format stats;
+    query_stats* metrics;
+    char* batch;
+    bool use_cache;
+    size_t cache_size;
+    char* group_by;
+    char* agg;
+    group_spec group;
+} args;
+
+#endif
@@ -0,0 +1,464 @@
+/** @file cache.c
+ *  @brief Implementation of the on-disk result cache.
+ *
+ * An entry is the output file of one query, named by the 16 hex digits of
+ * its key followed by ".csv". A query that is not in the cache is written
+ * to a temporary file in the cache directory, which is then renamed into
+ * place, so a reader never sees half an entry and concurrent runs of the
+ * same query simply replace each other's results with the same bytes.
+ * A process that exits before its results are committed removes its
+ * temporary file on the way out, and the sweep removes those of processes
+ * that died without doing so.
+ *
+ * The modification time of an entry is its last use: a hit touches it.
+ * After every new entry the directory is swept, and the entries used
+ * longest ago are removed until the rest fit in the size cap.
+ *
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "snapshot.h"
+#include "writer.h"
+#include "cache.h"
+
+#define COPY_CHUNK (256 * 1024)
+#define ENTRY_SUFFIX ".csv"
+#define ENTRY_NAME_LEN (16 + sizeof(ENTRY_SUFFIX) - 1)
+#define PENDING_SUFFIX ".tmp"
+
+typedef struct {
+    char name[ENTRY_NAME_LEN + 1];
+    struct timespec used;
+    off_t size;
+} cache_entry;
+
+// The temporary file of the query this process is writing, if any
+static char *pending_file = NULL;
+static bool cleanup_registered = false;
+
+// Removes the temporary file of a query that was never committed
+static void remove_pending(void)
+{
+    if (pending_file != NULL)
+    {
+        unlink(pending_file);
+    }
+}
+
+// Joins a directory and a name into a new path
+static char *join_path(const char *dir, const char *name)
+{
+    size_t n = strlen(dir) + strlen(name) + 2;
+    char *path = (char *)emalloc(n);
+
+    snprintf(path, n, "%s/%s", dir, name);
+    return path;
+}
+
+// Makes a directory unless it already exists
+static int make_dir(const char *path)
+{
+    return mkdir(path, 0700) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+// Path of the entry of a key
+static char *entry_path(const result_cache *cache, uint64_t key)
+{
+    char name[ENTRY_NAME_LEN + 1];
+
+    snprintf(name, sizeof(name), "%016llx" ENTRY_SUFFIX, (unsigned long long)key);
+    return join_path(cache->dir, name);
+}
+
+/**
+ * Function:  cache_open
+ * ---------------------
+ * @brief  Finds the cache directory, creating it if needed.
+ *
+ * @param cache The cache to be opened.
+ * @param max_size The number of bytes the entries may take up together.
+ *
+ * @return int 0 on success, -1 if there is no usable cache directory.
+ *
+ */
+int cache_open(result_cache *cache, size_t max_size)
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char *base;
+
+    cache->dir = NULL;
+    cache->max_size = max_size;
+    // The base directory specification asks for a relative XDG_CACHE_HOME to be ignored
+    if (xdg != NULL && xdg[0] == '/')
+    {
+        base = (char *)emalloc(strlen(xdg) + 1);
+        strcpy(base, xdg);
+    }
+    else if (home != NULL && home[0] != '\0')
+    {
+        base = join_path(home, ".cache");
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (make_dir(base) != 0)
+    {
+        free(base);
+        return -1;
+    }
+    cache->dir = join_path(base, CACHE_DIR);
+    free(base);
+    if (make_dir(cache->dir) != 0)
+    {
+        cache_close(cache);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function:  cache_fingerprint
+ * ----------------------------
+ * @brief  Fingerprints a data file by its size, its modification time and
+ *         CACHE_SAMPLE_BLOCKS blocks spread evenly across its contents.
+ *
+ * @param data_path The path of the data file.
+ * @param fingerprint Receives the fingerprint.
+ *
+ * @return int 0 on success, -1 if the file could not be read.
+ *
+ */
+int cache_fingerprint(const char *data_path, uint64_t *fingerprint)
+{
+    char block[CACHE_SAMPLE_SIZE];
+    struct stat st;
+    int64_t stamp[3];
+    uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+    int fd = open(data_path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    stamp[0] = (int64_t)st.st_size;
+    stamp[1] = (int64_t)st.st_mtim.tv_sec;
+    stamp[2] = (int64_t)st.st_mtim.tv_nsec;
+    hash = snapshot_checksum(hash, stamp, sizeof(stamp));
+    for (int i = 0; i < CACHE_SAMPLE_BLOCKS; i++)
+    {
+        // From the first block of the file to its last one
+        uint64_t span = st.st_size > CACHE_SAMPLE_SIZE ? (uint64_t)st.st_size - CACHE_SAMPLE_SIZE : 0;
+        off_t offset = (off_t)(span * (uint64_t)i / (CACHE_SAMPLE_BLOCKS - 1));
+        ssize_t n = pread(fd, block, sizeof(block), offset);
+
+        if (n < 0)
+        {
+            close(fd);
+            return -1;
+        }
+        hash = snapshot_checksum(hash, block, (size_t)n);
+    }
+    close(fd);
+    *fingerprint = hash;
+    return 0;
+}
+
+/**
+ * Function:  cache_key
+ * --------------------
+ * @brief  Combines a data file fingerprint and a normalized query into a key.
+ *
+ * @param fingerprint The fingerprint, from cache_fingerprint().
+ * @param query The query, described so that queries with the same output read the same.
+ *
+ * @return uint64_t The key of the entry.
+ *
+ */
+uint64_t cache_key(uint64_t fingerprint, const char *query)
+{
+    uint64_t hash = snapshot_checksum(SNAPSHOT_CHECKSUM_SEED, &fingerprint, sizeof(fingerprint));
+
+    hash = snapshot_checksum(hash, query, strlen(query));
+    // The checksum only carries its last bytes into the high bits; mix them into the rest of the key
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 33);
+}
+
+// Copies everything left in a descriptor to an output file, or to stdout for WRITER_STDOUT
+static int copy_fd(int fd, const char *output)
+{
+    out_writer out;
+    char *chunk;
+    ssize_t n;
+    int status;
+
+    if (writer_open(&out, output) != 0)
+    {
+        return -1;
+    }
+    chunk = (char *)emalloc(COPY_CHUNK);
+    while ((n = read(fd, chunk, COPY_CHUNK)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        writer_put(&out, chunk, (size_t)n);
+    }
+    free(chunk);
+    status = writer_close(&out);
+    return n == 0 ? status : -1;
+}
+
+/**
+ * Function:  cache_fetch
+ * ----------------------
+ * @brief  Copies the entry of a key to an output, and marks it as just used.
+ *
+ * @param cache The cache.
+ * @param key The key, from cache_key().
+ * @param output The path of the output file, or WRITER_STDOUT.
+ *
+ * @return int 1 on a hit, 0 if there is no such entry, -1 if the output
+ *         could not be written.
+ *
+ */
+int cache_fetch(const result_cache *cache, uint64_t key, const char *output)
+{
+    char *path = entry_path(cache, key);
+    int fd = open(path, O_RDONLY);
+    int status;
+
+    free(path);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    futimens(fd, NULL);
+    status = copy_fd(fd, output);
+    close(fd);
+    return status == 0 ? 1 : -1;
+}
+
+/**
+ * Function:  cache_begin
+ * ----------------------
+ * @brief  Creates the temporary file the results of a missed query are written to.
+ *
+ * @param cache The cache.
+ * @param key The key of the query.
+ *
+ * @return char* The path of the file, to be passed to cache_commit() and
+ *         released with free(), or NULL if the cache directory is not
+ *         writable. The file is removed at exit unless it was committed.
+ *
+ */
+char *cache_begin(const result_cache *cache, uint64_t key)
+{
+    char name[ENTRY_NAME_LEN + 32];
+    char *path;
+    int fd;
+
+    snprintf(name, sizeof(name), "%016llx.%ld" PENDING_SUFFIX, (unsigned long long)key, (long)getpid());
+    path = join_path(cache->dir, name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        free(path);
+        return NULL;
+    }
+    close(fd);
+
+    // Any exit() before cache_commit() takes the file with it
+    free(pending_file);
+    pending_file = join_path(cache->dir, name);
+    if (!cleanup_registered)
+    {
+        cleanup_registered = atexit(remove_pending) == 0;
+    }
+    return path;
+}
+
+// Orders entries from the one used longest ago
+static int compare_entries(const void *a, const void *b)
+{
+    const cache_entry *x = (const cache_entry *)a;
+    const cache_entry *y = (const cache_entry *)b;
+
+    if (x->used.tv_sec != y->used.tv_sec)
+    {
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    }
+    return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+// Tells whether a name is the temporary file of a process that no longer runs
+static bool is_stale(const char *name)
+{
+    size_t len = strlen(name);
+    size_t suffix = strlen(PENDING_SUFFIX);
+    char *end;
+    long pid;
+
+    if (len <= 17 + suffix || name[16] != '.' || strcmp(name + len - suffix, PENDING_SUFFIX) != 0)
+    {
+        return false;
+    }
+    pid = strtol(name + 17, &end, 10);
+    if (end != name + len - suffix || pid <= 0 || pid == (long)getpid())
+    {
+        return false;
+    }
+    return kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
+// Removes stale temporary files and the entries used longest ago, except the one named keep, until the rest fit in
+// the size cap
+static void evict(const result_cache *cache, const char *keep)
+{
+    DIR *dir = opendir(cache->dir);
+    struct dirent *item;
+    cache_entry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t total = 0;
+
+    if (dir == NULL)
+    {
+        return;
+    }
+    while ((item = readdir(dir)) != NULL)
+    {
+        size_t len = strlen(item->d_name);
+        struct stat st;
+
+        if (is_stale(item->d_name))
+        {
+            unlinkat(dirfd(dir), item->d_name, 0);
+            continue;
+        }
+        if (len != ENTRY_NAME_LEN || strcmp(item->d_name + 16, ENTRY_SUFFIX) != 0 ||
+            fstatat(dirfd(dir), item->d_name, &st, 0) != 0)
+        {
+            continue;
+        }
+        if (count == capacity)
+        {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            entries = (cache_entry *)erealloc(entries, capacity * sizeof(cache_entry));
+        }
+        memcpy(entries[count].name, item->d_name, len + 1);
+        entries[count].used = st.st_mtim;
+        entries[count].size = st.st_size;
+        total += (uint64_t)st.st_size;
+        count++;
+    }
+
+    if (total > cache->max_size)
+    {
+        qsort(entries, count, sizeof(cache_entry), compare_entries);
+        for (size_t i = 0; i < count && total > cache->max_size; i++)
+        {
+            if (strcmp(entries[i].name, keep) != 0 && unlinkat(dirfd(dir), entries[i].name, 0) == 0)
+            {
+                total -= (uint64_t)entries[i].size;
+            }
+        }
+    }
+    free(entries);
+    closedir(dir);
+}
+
+/**
+ * Function:  cache_commit
+ * -----------------------
+ * @brief  Turns the temporary file of a query into its entry, then evicts
+ *         the least recently used entries past the size cap.
+ *
+ * The sweep of another process may remove the entry as soon as it is in
+ * place, so the results must be copied out of the temporary file first.
+ *
+ * @param cache The cache.
+ * @param key The key of the query.
+ * @param pending The file from cache_begin(), now holding the results.
+ *
+ * @return int 0 on success, -1 if the file could not be renamed (it is left as it is, and removed at exit).
+ *
+ */
+int cache_commit(const result_cache *cache, uint64_t key, const char *pending)
+{
+    char *path = entry_path(cache, key);
+    int status = rename(pending, path);
+
+    if (status == 0)
+    {
+        free(pending_file);
+        pending_file = NULL;
+        evict(cache, strrchr(path, '/') + 1);
+    }
+    free(path);
+    return status == 0 ? 0 : -1;
+}
+
+/**
+ * Function:  cache_copy
+ * ---------------------
+ * @brief  Copies a file to an output.
+ *
+ * @param path The file to be copied.
+ * @param output The path of the output file, or WRITER_STDOUT.
+ *
+ * @return int 0 on success, -1 if either file failed.
+ *
+ */
+int cache_copy(const char *path, const char *output)
+{
+    int fd = open(path, O_RDONLY);
+    int status;
+
+    if (fd < 0)
+    {
+        return -1;
+    }
+    status = copy_fd(fd, output);
+    close(fd);
+    return status;
+}
+
+/**
+ * Function:  cache_close
+ * ----------------------
+ * @brief  Releases the cache.
+ *
+ * @param cache The cache.
+ *
+ */
+void cache_close(result_cache *cache)
+{
+    free(cache->dir);
+    cache->dir = NULL;
+}
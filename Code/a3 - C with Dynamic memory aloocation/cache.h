@@ -0,0 +1,40 @@
+/** @file cache.h
+ *  @brief Function prototypes for the on-disk result cache.
+ *
+ *  The cache keeps the complete CSV output of past queries in a directory
+ *  under $XDG_CACHE_HOME (or ~/.cache), one file per query, named after a
+ *  hash of the query and of a fingerprint of the data file: its size, its
+ *  modification time and a hash of blocks sampled across it. A changed
+ *  data file has a new fingerprint, so its old results are never found
+ *  again; they are the first to go when the directory grows past its size
+ *  cap, which evicts the least recently used results.
+ */
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_DIR "song_analyzer"
+#define CACHE_DEFAULT_SIZE (256 * 1024 * 1024)
+#define CACHE_SAMPLE_BLOCKS 16
+#define CACHE_SAMPLE_SIZE 4096
+
+typedef struct {
+    char *dir;
+    size_t max_size;
+} result_cache;
+
+/**
+ * Function protypes associated with the result cache.
+ */
+int cache_open(result_cache *, size_t max_size);
+int cache_fingerprint(const char *data_path, uint64_t *fingerprint);
+uint64_t cache_key(uint64_t fingerprint, const char *query);
+int cache_fetch(const result_cache *, uint64_t key, const char *output);
+char *cache_begin(const result_cache *, uint64_t key);
+int cache_commit(const result_cache *, uint64_t key, const char *pending);
+int cache_copy(const char *path, const char *output);
+void cache_close(result_cache *);
+
+#endif
@@ -0,0 +1,795 @@
+/** @file csv.c
+ *  @brief Implementation of the memory-mapped CSV reader.
+ *
+ * The input is mapped read-only with mmap(), so there is no line buffer,
+ * no copy and no limit on the length of a line.
+ *
+ * Rows follow RFC 4180: a field may be enclosed in double quotes, and a
+ * quoted field may hold commas, newlines and doubled quotes ("") standing
+ * for one quote. A row is scanned CSV_BLOCK bytes at a time. A vector
+ * kernel turns each block into three bit masks, of its quotes, commas
+ * and newlines. Every quote toggles whether the bytes after it are
+ * quoted, so the prefix XOR of the quote mask marks the quoted bytes of
+ * the block, and the commas and newlines outside them are the structure
+ * of the row. A block with no quote in it and none left open costs no
+ * more than the three compares.
+ *
+ * Numeric fields are converted 8 digits to a word: one test on the word
+ * tells whether all of its bytes are digits, and three multiplies give
+ * their value. A field with anything else in it is an error rather than
+ * the number its leading digits spell.
+ *
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "csv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CSV_X86 1
+#include <immintrin.h>
+#endif
+
+#define CSV_BLOCK 64
+#define SWAR_DIGITS 8
+// Every 64-bit number fits in 19 digits
+#define CSV_MAX_DIGITS 19
+
+// Bit i of each mask is set when byte i of a block is that character
+typedef struct {
+    uint64_t quotes;
+    uint64_t commas;
+    uint64_t newlines;
+} block_masks;
+
+typedef void (*scan_fn)(const char *block, block_masks *masks);
+
+// Scalar kernel: classifies the bytes of a block one at a time
+static void scan_scalar(const char *block, block_masks *masks)
+{
+    masks->quotes = masks->commas = masks->newlines = 0;
+    for (int i = 0; i < CSV_BLOCK; i++)
+    {
+        uint64_t bit = (uint64_t)1 << i;
+        masks->quotes |= block[i] == '"' ? bit : 0;
+        masks->commas |= block[i] == ',' ? bit : 0;
+        masks->newlines |= block[i] == '\n' ? bit : 0;
+    }
+}
+
+static scan_fn scan_block = scan_scalar;
+static const char *kernel_name = "scalar";
+
+#ifdef CSV_X86
+
+__attribute__((target("avx2")))
+static void scan_avx2(const char *block, block_masks *masks)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)block);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(block + 32));
+
+    masks->quotes = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote)) << 32;
+    masks->commas = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma)) << 32;
+    masks->newlines = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+}
+
+__attribute__((target("sse2")))
+static void scan_sse2(const char *block, block_masks *masks)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+
+    masks->quotes = masks->commas = masks->newlines = 0;
+    for (int i = 0; i < CSV_BLOCK; i += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(block + i));
+        masks->quotes |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, quote)) << i;
+        masks->commas |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, comma)) << i;
+        masks->newlines |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)) << i;
+    }
+}
+
+/**
+ * Function:  select_kernel
+ * ------------------------
+ * @brief  Picks the widest block scanner the CPU supports. Runs before main().
+ *
+ */
+__attribute__((constructor))
+static void select_kernel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan_block = scan_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan_block = scan_sse2;
+        kernel_name = "sse2";
+    }
+}
+
+#endif
+
+// Sets bit i when an odd number of the bits 0 to i are set: the quoted bytes of a block, with the opening quotes
+static inline uint64_t prefix_xor(uint64_t bits)
+{
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+}
+
+// Makes a field of the bytes between two delimiters, without the quotes that enclose it
+static inline void set_field(field_t *field, const char *ptr, size_t len)
+{
+    if (len >= 2 && ptr[0] == '"' && ptr[len - 1] == '"')
+    {
+        field->ptr = ptr + 1;
+        field->len = len - 2;
+        field->escaped = memchr(ptr + 1, '"', len - 2) != NULL;
+        return;
+    }
+    field->ptr = ptr;
+    field->len = len;
+    field->escaped = false;
+}
+
+/**
+ * Function:  csv_open
+ * -------------------
+ * @brief  Maps a CSV file into memory for reading.
+ *
+ * @param reader The reader to be initialized.
+ * @param filename The path of the file to be mapped.
+ *
+ * @return int 0 on success, -1 if the file could not be opened or mapped.
+ *
+ */
+int csv_open(csv_reader *reader, const char *filename)
+{
+    struct stat st;
+    int fd;
+
+    reader->data = NULL;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->pipeline = NULL;
+    reader->offset = 0;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // An empty file cannot be mapped, but it is a valid file with no rows
+    if (st.st_size > 0)
+    {
+        void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return -1;
+        }
+        madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+        reader->data = (const char *)data;
+        reader->size = (size_t)st.st_size;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    return 0;
+}
+
+/**
+ * Function:  csv_open_stream
+ * --------------------------
+ * @brief  Opens a CSV file to be read front to back through a pipeline.
+ *
+ * The file is read on a thread of its own while the rows already read are
+ * parsed, in recycled buffers rather than a mapping of the whole file. The
+ * slices of a row stay valid until the rows of the next block are read,
+ * and the reader cannot be split. If no pipeline can be started the file
+ * is mapped as by csv_open().
+ *
+ * @param reader The reader to be initialized.
+ * @param filename The path of the file to be read.
+ * @param memory The most the buffers of the pipeline may take, or 0 for
+ *        their default size.
+ *
+ * @return int 0 on success, -1 if the file could not be opened.
+ *
+ */
+int csv_open_stream(csv_reader *reader, const char *filename, size_t memory)
+{
+    csv_pipeline *pipeline = pipeline_open(filename, memory);
+
+    if (pipeline == NULL)
+    {
+        return csv_open(reader, filename);
+    }
+    reader->data = NULL;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->pipeline = pipeline;
+    reader->offset = 0;
+    return 0;
+}
+
+/**
+ * Function:  csv_error
+ * --------------------
+ * @brief  Tells whether csv_next_row() stopped because the file could not be read.
+ *
+ * @param reader The reader.
+ *
+ * @return int The errno of the failed read, or 0 if the whole file was read.
+ *
+ */
+int csv_error(const csv_reader *reader)
+{
+    return reader->pipeline != NULL ? pipeline_error(reader->pipeline) : 0;
+}
+
+// Moves a pipelined reader on to the rows of the next block
+static bool next_block(csv_reader *reader)
+{
+    const char *data;
+    size_t size;
+
+    if (reader->pipeline == NULL || !pipeline_next(reader->pipeline, &data, &size))
+    {
+        return false;
+    }
+    reader->offset += reader->size;
+    reader->data = data;
+    reader->size = size;
+    reader->pos = 0;
+    return true;
+}
+
+/**
+ * Function:  csv_next_row
+ * -----------------------
+ * @brief  Splits the next non-empty row into field slices.
+ *
+ * Fields beyond max_fields are left unsplit in the last slice, which then
+ * holds the rest of the row as it is. A trailing carriage return is not
+ * part of the last field. The slice of a quoted field leaves out the
+ * enclosing quotes; if it holds doubled quotes it is marked as escaped,
+ * and csv_unescape() gives its text. A quote that is never closed runs
+ * to the end of the input.
+ *
+ * @param reader The reader.
+ * @param fields The array that receives the slices.
+ * @param max_fields The number of slots in fields.
+ * @param count Receives the number of fields in the row.
+ *
+ * @return bool True if a row was read, false at the end of the file.
+ *
+ */
+bool csv_next_row(csv_reader *reader, field_t *fields, int max_fields, int *count)
+{
+    for (;;)
+    {
+        if (reader->pos >= reader->size && !next_block(reader))
+        {
+            return false;
+        }
+
+        const char *line = reader->data + reader->pos;
+        size_t avail = reader->size - reader->pos;
+        size_t start = 0;
+        size_t end = avail;
+        uint64_t open = 0;
+        bool rest = false;
+        int n = 0;
+
+        for (size_t offset = 0; offset < avail; offset += CSV_BLOCK)
+        {
+            const char *block = line + offset;
+            char tail[CSV_BLOCK];
+            block_masks masks;
+
+            if (avail - offset < CSV_BLOCK)
+            {
+                // The last block of the input is padded, so no load runs past the mapping
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, block, avail - offset);
+                block = tail;
+            }
+            scan_block(block, &masks);
+
+            uint64_t quoted = masks.quotes != 0 ? prefix_xor(masks.quotes) ^ open : open;
+            uint64_t newlines = masks.newlines & ~quoted;
+            uint64_t commas = masks.commas & ~quoted;
+            open = (uint64_t)0 - (quoted >> (CSV_BLOCK - 1));
+            if (newlines != 0)
+            {
+                // Only the commas before the end of the row
+                commas &= (newlines & (0 - newlines)) - 1;
+            }
+
+            while (commas != 0 && n < max_fields - 1)
+            {
+                size_t comma = offset + (size_t)__builtin_ctzll(commas);
+                set_field(&fields[n++], line + start, comma - start);
+                start = comma + 1;
+                commas &= commas - 1;
+            }
+            rest = rest || commas != 0;
+
+            if (newlines != 0)
+            {
+                end = offset + (size_t)__builtin_ctzll(newlines);
+                break;
+            }
+        }
+        reader->pos += end + 1;
+
+        if (end > 0 && line[end - 1] == '\r')
+        {
+            end--;
+        }
+        if (end == 0)
+        {
+            continue;
+        }
+
+        if (rest)
+        {
+            fields[n].ptr = line + start;
+            fields[n].len = end - start;
+            fields[n].escaped = false;
+        }
+        else
+        {
+            set_field(&fields[n], line + start, end - start);
+        }
+        *count = n + 1;
+        return true;
+    }
+}
+
+/**
+ * Function:  csv_close
+ * --------------------
+ * @brief  Unmaps the file held by the reader, or stops its pipeline.
+ *
+ * @param reader The reader.
+ *
+ */
+void csv_close(csv_reader *reader)
+{
+    if (reader->pipeline != NULL)
+    {
+        pipeline_close(reader->pipeline);
+    }
+    else if (reader->data != NULL)
+    {
+        munmap((void *)reader->data, reader->size);
+    }
+    reader->data = NULL;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->pipeline = NULL;
+    reader->offset = 0;
+}
+
+// Counts the quotes in n bytes
+static size_t count_quotes(const char *s, size_t n)
+{
+    const char *end = s + n;
+    size_t quotes = 0;
+
+    while (s < end && (s = memchr(s, '"', (size_t)(end - s))) != NULL)
+    {
+        quotes++;
+        s++;
+    }
+    return quotes;
+}
+
+/**
+ * Function:  next_row_start
+ * -------------------------
+ * @brief  Finds where the first row starting at or after a position begins.
+ *
+ * @param data The bytes of the file.
+ * @param size The size of the file.
+ * @param pos The position.
+ * @param quoted Whether the position is inside a quoted field.
+ *
+ * @return size_t The position just past the first newline outside quotes,
+ *         or size if there is none.
+ *
+ */
+static size_t next_row_start(const char *data, size_t size, size_t pos, bool quoted)
+{
+    while (pos < size)
+    {
+        const char *quote;
+
+        if (quoted)
+        {
+            quote = memchr(data + pos, '"', size - pos);
+            if (quote == NULL)
+            {
+                return size;
+            }
+            pos = (size_t)(quote - data) + 1;
+            quoted = false;
+            continue;
+        }
+
+        const char *newline = memchr(data + pos, '\n', size - pos);
+        size_t stop = newline != NULL ? (size_t)(newline - data) : size;
+        quote = memchr(data + pos, '"', stop - pos);
+        if (quote == NULL)
+        {
+            return newline != NULL ? stop + 1 : size;
+        }
+        pos = (size_t)(quote - data) + 1;
+        quoted = true;
+    }
+    return size;
+}
+
+/**
+ * Function:  csv_split
+ * --------------------
+ * @brief  Splits the mapped file into chunks that start and end on row boundaries.
+ *
+ * The reader must come from csv_open(). Each chunk is a reader over its
+ * own part of the mapping and yields the rows of that part only; reading
+ * the chunks in order yields the rows of the file in order. Chunks share the mapping and must not be passed to
+ * csv_close(). A chunk may be empty when rows are longer than a part.
+ * Counting the quotes before each cut tells whether it falls inside a
+ * quoted field, whose newlines do not end a row.
+ *
+ * @param reader The reader holding the whole file.
+ * @param parts The number of chunks to produce.
+ * @param chunks The array that receives the chunks.
+ *
+ */
+void csv_split(const csv_reader *reader, int parts, csv_reader *chunks)
+{
+    size_t begin = 0;
+
+    for (int i = 0; i < parts; i++)
+    {
+        size_t end = reader->size;
+
+        if (i < parts - 1)
+        {
+            end = reader->size / (size_t)parts * (size_t)(i + 1);
+            if (end < begin)
+            {
+                end = begin;
+            }
+            // Move the cut just past the next newline that ends a row
+            bool quoted = count_quotes(reader->data + begin, end - begin) % 2 == 1;
+            end = next_row_start(reader->data, reader->size, end, quoted);
+        }
+
+        chunks[i].data = reader->data + begin;
+        chunks[i].size = end - begin;
+        chunks[i].pos = 0;
+        chunks[i].pipeline = NULL;
+        chunks[i].offset = begin;
+        begin = end;
+    }
+}
+
+/**
+ * Function:  csv_release
+ * ----------------------
+ * @brief  Lets the kernel drop the pages of the rows already read.
+ *
+ * The pages are read back from the file if they are touched again. Only
+ * a reader from csv_open() may be released, since chunks do not start on
+ * a page boundary; a pipelined reader already recycles its buffers, so
+ * releasing it only moves the offset on.
+ *
+ * @param reader The reader.
+ * @param released The offset up to which the file was already released.
+ *
+ * @return size_t The offset up to which the file is now released.
+ *
+ */
+size_t csv_release(csv_reader *reader, size_t released)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = reader->pos < reader->size ? reader->pos / page * page : reader->size;
+
+    if (reader->pipeline != NULL)
+    {
+        return reader->offset + reader->pos;
+    }
+    if (end > released)
+    {
+        madvise((void *)(reader->data + released), end - released, MADV_DONTNEED);
+        released = end;
+    }
+    return released;
+}
+
+/**
+ * Function:  csv_field
+ * --------------------
+ * @brief  Returns a field of a row, or an empty slice if the row is too short.
+ *
+ * @param fields The slices of the row.
+ * @param count The number of fields in the row.
+ * @param index The position of the wanted field.
+ *
+ * @return field_t The field.
+ *
+ */
+field_t csv_field(const field_t *fields, int count, int index)
+{
+    field_t empty = {"", 0, false};
+
+    return index < count ? fields[index] : empty;
+}
+
+// Gives 8 ASCII digits as a word whose lowest byte holds the first of them
+static inline uint64_t load_digits(const char *p)
+{
+    uint64_t word;
+
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+// Same as load_digits() for 4 digits
+static inline uint32_t load_digits4(const char *p)
+{
+    uint32_t word;
+
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+    return word;
+}
+
+// Tells whether every byte of a word is an ASCII digit: its high nibble is 3 and adding 6 leaves it at 3
+static inline bool all_digits(uint64_t word)
+{
+    return ((word & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+static inline bool all_digits4(uint32_t word)
+{
+    return ((word & 0xF0F0F0F0u) | (((word + 0x06060606u) & 0xF0F0F0F0u) >> 4)) == 0x33333333u;
+}
+
+// Value of the 8 digits of a word, combining neighbouring digits, then pairs, then groups of four
+static inline uint64_t digits_value(uint64_t word)
+{
+    word -= 0x3030303030303030ULL;
+    word = (word * 10 + (word >> 8)) & 0x00FF00FF00FF00FFULL;
+    word = (word * 100 + (word >> 16)) & 0x0000FFFF0000FFFFULL;
+    return (word * 10000 + (word >> 32)) & 0x00000000FFFFFFFFULL;
+}
+
+static inline uint32_t digits_value4(uint32_t word)
+{
+    word -= 0x30303030u;
+    word = (word * 10 + (word >> 8)) & 0x00FF00FFu;
+    return (word * 100 + (word >> 16)) & 0x0000FFFFu;
+}
+
+/**
+ * Function:  parse_digits
+ * -----------------------
+ * @brief  Converts a run of at most CSV_MAX_DIGITS ASCII digits.
+ *
+ * The digits are taken 8 to a word while at least 8 are left, then 4
+ * to a word, and the last three at most one at a time. Every word costs
+ * one test and a few multiplies whatever its digits are, and a malformed
+ * byte only clears a flag, so there is no branch on the digits
+ * themselves.
+ *
+ * @param p The first digit.
+ * @param n The number of digits, from 1 to CSV_MAX_DIGITS.
+ * @param value Receives the value.
+ *
+ * @return bool False if one of the bytes is not a digit.
+ *
+ */
+static bool parse_digits(const char *p, size_t n, uint64_t *value)
+{
+    const char *end = p + n;
+    uint64_t result = 0;
+    bool digits = true;
+
+    for (; end - p >= SWAR_DIGITS; p += SWAR_DIGITS)
+    {
+        uint64_t word = load_digits(p);
+        digits &= all_digits(word);
+        result = result * 100000000 + digits_value(word);
+    }
+    if (end - p >= SWAR_DIGITS / 2)
+    {
+        uint32_t word = load_digits4(p);
+        digits &= all_digits4(word);
+        result = result * 10000 + digits_value4(word);
+        p += SWAR_DIGITS / 2;
+    }
+    for (; p < end; p++)
+    {
+        unsigned digit = (unsigned)(unsigned char)*p - '0';
+        digits &= digit <= 9;
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return digits;
+}
+
+// Converts a field holding an optional sign and digits, of at most limit (or limit + 1 if negative)
+static int parse_number(field_t field, uint64_t limit, int64_t *value)
+{
+    const char *p = field.ptr;
+    size_t n = field.len;
+    bool negative = n > 0 && p[0] == '-';
+    uint64_t magnitude;
+
+    // An empty field, or one past the end of a row that stops short, is missing rather than 0
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (negative || p[0] == '+')
+    {
+        p++;
+        n--;
+    }
+    if (n == 0 || n > CSV_MAX_DIGITS || !parse_digits(p, n, &magnitude) || magnitude > limit + negative)
+    {
+        return -1;
+    }
+    // Negated as unsigned, so that the most negative value does not overflow
+    *value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    return 0;
+}
+
+/**
+ * Function:  csv_field_int32
+ * --------------------------
+ * @brief  Converts a field holding a 32-bit decimal number.
+ *
+ * The field must be an optional sign followed by digits only, with no
+ * blanks and no other characters, and fit in 32 bits. An empty field,
+ * which is also what a row that stops short has past its end, is
+ * rejected like any other malformed value.
+ *
+ * @param field The field to be converted.
+ * @param value Receives the number.
+ *
+ * @return int 0 on success, -1 if the field is not such a number.
+ *
+ */
+int csv_field_int32(field_t field, int32_t *value)
+{
+    int64_t number;
+
+    if (parse_number(field, INT32_MAX, &number) != 0)
+    {
+        return -1;
+    }
+    *value = (int32_t)number;
+    return 0;
+}
+
+/**
+ * Function:  csv_field_int64
+ * --------------------------
+ * @brief  Converts a field holding a 64-bit decimal number, like csv_field_int32().
+ *
+ * @param field The field to be converted.
+ * @param value Receives the number.
+ *
+ * @return int 0 on success, -1 if the field is not such a number.
+ *
+ */
+int csv_field_int64(field_t field, int64_t *value)
+{
+    return parse_number(field, INT64_MAX, value);
+}
+
+/**
+ * Function:  csv_field_limit
+ * --------------------------
+ * @brief  Returns how many slices a row must be split into for a set of fields.
+ *
+ * Passed as max_fields to csv_next_row(), the limit gives every field of
+ * the set a slice of its own and leaves the rest of the line unsplit, so
+ * the columns a query never reads are not even searched for delimiters.
+ *
+ * @param columns The set of field positions, one bit for each position.
+ *
+ * @return int The number of slices, at most MAX_FIELDS.
+ *
+ */
+int csv_field_limit(unsigned columns)
+{
+    int last = 0;
+
+    for (int i = 0; i < MAX_FIELDS - 1; i++)
+    {
+        if (columns & (1u << i))
+        {
+            last = i;
+        }
+    }
+    return last + 2;
+}
+
+/**
+ * Function:  csv_unescape
+ * -----------------------
+ * @brief  Copies the text of a field, turning each doubled quote into one.
+ *
+ * @param field The field.
+ * @param out Receives the text; room for field.len bytes.
+ *
+ * @return size_t The length of the text.
+ *
+ */
+size_t csv_unescape(field_t field, char *out)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i < field.len; i++)
+    {
+        out[n++] = field.ptr[i];
+        if (field.ptr[i] == '"' && i + 1 < field.len && field.ptr[i + 1] == '"')
+        {
+            i++;
+        }
+    }
+    return n;
+}
+
+/**
+ * Function:  csv_kernel_name
+ * --------------------------
+ * @brief  Names the instruction set the block scanner runs on.
+ *
+ * @return const char* "avx2", "sse2" or "scalar".
+ *
+ */
+const char *csv_kernel_name(void)
+{
+    return kernel_name;
+}
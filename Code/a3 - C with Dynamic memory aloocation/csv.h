@@ -0,0 +1,62 @@
+/** @file csv.h
+ *  @brief Function prototypes for the memory-mapped CSV reader.
+ *
+ *  The reader maps the whole input file and hands out each row as an array
+ *  of (pointer, length) slices into the mapping. Nothing is copied; callers
+ *  decide which rows are worth materializing. Quoted fields follow RFC
+ *  4180, and rows are found a vector register of bytes at a time. A
+ *  reader from csv_open_stream() reads the file through a pipeline instead
+ *  of mapping it, and its slices only last until the rows of the next
+ *  block are read.
+ */
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define MAX_FIELDS 32
+
+typedef struct field_t {
+    const char *ptr;
+    size_t len;
+    bool escaped;
+} field_t;
+
+// Where the first numeric field that does not hold a number was found: its row (the header is row 0) and
+// position; or, if missing is set, the name of a column the header lacks
+typedef struct csv_bad_value {
+    size_t row;
+    int field;
+    const char *missing;
+} csv_bad_value;
+
+struct csv_pipeline;
+
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t pos;
+    struct csv_pipeline *pipeline;
+    size_t offset;
+} csv_reader;
+
+/**
+ * Function protypes associated with the CSV reader.
+ */
+int csv_open(csv_reader *, const char *filename);
+int csv_open_stream(csv_reader *, const char *filename, size_t memory);
+int csv_error(const csv_reader *);
+bool csv_next_row(csv_reader *, field_t *fields, int max_fields, int *count);
+void csv_close(csv_reader *);
+void csv_split(const csv_reader *, int parts, csv_reader *chunks);
+size_t csv_release(csv_reader *, size_t released);
+field_t csv_field(const field_t *fields, int count, int index);
+int csv_field_int32(field_t field, int32_t *value);
+int csv_field_int64(field_t field, int64_t *value);
+int csv_field_limit(unsigned columns);
+size_t csv_unescape(field_t field, char *out);
+const char *csv_kernel_name(void);
+
+#endif
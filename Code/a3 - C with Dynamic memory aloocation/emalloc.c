@@ -1,11 +1,32 @@
 /** @file emalloc.c
  *  @brief Implementation of emalloc.h
  *
+ * Every call is counted, with the number of bytes it asked for, so that
+ * a query can report how much it allocated. The counters are shared by
+ * every thread and updated without ordering, which costs no more than the
+ * addition itself. Each thread also keeps counts of its own, so that the
+ * share of a stage that one thread runs can be told apart from the work
+ * of the others.
+ *
  */
 #include <stdlib.h>
 #include <stdio.h>
 #include "emalloc.h"
 
+static uint64_t allocation_count;
+static uint64_t allocation_bytes;
+static __thread uint64_t thread_count;
+static __thread uint64_t thread_bytes;
+
+// Counts one allocation of n bytes
+static inline void count_allocation(size_t n)
+{
+    __atomic_fetch_add(&allocation_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&allocation_bytes, (uint64_t)n, __ATOMIC_RELAXED);
+    thread_count++;
+    thread_bytes += n;
+}
+
 /**
  * Function:  emalloc
  * --------------------
@@ -20,6 +41,7 @@ void *emalloc(size_t n)
 {
     void *p;
 
+    count_allocation(n);
     p = malloc(n);
     if (p == NULL)
     {
@@ -29,3 +51,59 @@ void *emalloc(size_t n)
 
     return p;
 }
+
+/**
+ * Function:  erealloc
+ * --------------------
+ * @brief Represents a wrapper to realloc to use it in a safer way.
+ *
+ * @param p The block to be resized (NULL to allocate a new one).
+ * @param size_t The new size of the block.
+ *
+ * @return: A pointer to the resized block.
+ *
+ */
+void *erealloc(void *p, size_t n)
+{
+    void *q;
+
+    count_allocation(n);
+    q = realloc(p, n);
+    if (q == NULL && n != 0)
+    {
+        fprintf(stderr, "realloc of %zu bytes failed", n);
+        exit(1);
+    }
+
+    return q;
+}
+
+/**
+ * Function:  emalloc_counts
+ * --------------------
+ * @brief Reads how many allocations emalloc() and erealloc() have made so far.
+ *
+ * @param allocations Receives the number of calls.
+ * @param bytes Receives the number of bytes they asked for.
+ *
+ */
+void emalloc_counts(uint64_t *allocations, uint64_t *bytes)
+{
+    *allocations = __atomic_load_n(&allocation_count, __ATOMIC_RELAXED);
+    *bytes = __atomic_load_n(&allocation_bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * Function:  emalloc_thread_counts
+ * --------------------------------
+ * @brief Reads how many allocations the calling thread has made so far.
+ *
+ * @param allocations Receives the number of calls.
+ * @param bytes Receives the number of bytes they asked for.
+ *
+ */
+void emalloc_thread_counts(uint64_t *allocations, uint64_t *bytes)
+{
+    *allocations = thread_count;
+    *bytes = thread_bytes;
+}
@@ -1,10 +1,16 @@
 /** @file emalloc.h
- *  @brief Function prototypes for the emalloc wrapper.
+ *  @brief Function prototypes for the emalloc and erealloc wrappers.
  *
  */
 #ifndef _EMALLOC_H_
 #define _EMALLOC_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 void *emalloc(size_t);
+void *erealloc(void *, size_t);
+void emalloc_counts(uint64_t *allocations, uint64_t *bytes);
+void emalloc_thread_counts(uint64_t *allocations, uint64_t *bytes);
 
 #endif
@@ -0,0 +1,272 @@
+/** @file filter.c
+ *  @brief Implementation of the vectorized column predicates.
+ *
+ * A predicate is evaluated a whole register at a time: both bounds are
+ * compared against every lane, the lane results become a bit mask, and
+ * the set bits are turned into row indices. The AVX2 32-bit kernel turns
+ * the mask into indices with a single permute from a 256-entry table; the
+ * other kernels walk the set bits.
+ *
+ * The kernels are picked with CPUID (through __builtin_cpu_supports) before
+ * main() runs, so every call is one indirect jump with no feature test.
+ *
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include "filter.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FILTER_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*range_i32_fn)(const int32_t *, size_t, size_t, int32_t, int32_t, uint32_t *);
+typedef size_t (*range_i64_fn)(const int64_t *, size_t, size_t, int64_t, int64_t, uint32_t *);
+
+/**
+ * Function:  scan_i32
+ * -------------------
+ * @brief  Scalar scan of rows [start, end) of a 32-bit column.
+ *
+ * The loop is branch-free: every row index is written, but the cursor only
+ * moves past it when the row matches.
+ *
+ * @param column The column to be scanned.
+ * @param start The first row to be scanned.
+ * @param end The row after the last one to be scanned.
+ * @param lo The smallest matching value.
+ * @param hi The largest matching value.
+ * @param out The selection vector that receives the matching rows.
+ *
+ * @return size_t The number of matching rows.
+ *
+ */
+static size_t scan_i32(const int32_t *column, size_t start, size_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+    size_t n = 0;
+
+    for (size_t i = start; i < end; i++)
+    {
+        out[n] = (uint32_t)i;
+        n += (column[i] >= lo) & (column[i] <= hi);
+    }
+    return n;
+}
+
+// Scalar scan of rows [start, end) of a 64-bit column, as scan_i32()
+static size_t scan_i64(const int64_t *column, size_t start, size_t end, int64_t lo, int64_t hi, uint32_t *out)
+{
+    size_t n = 0;
+
+    for (size_t i = start; i < end; i++)
+    {
+        out[n] = (uint32_t)i;
+        n += (column[i] >= lo) & (column[i] <= hi);
+    }
+    return n;
+}
+
+static range_i32_fn range_i32 = scan_i32;
+static range_i64_fn range_i64 = scan_i64;
+static const char *kernel_name = "scalar";
+
+#ifdef FILTER_X86
+
+// compress_lut[mask] lists the positions of the set bits of an 8-bit mask
+static uint8_t compress_lut[256][8];
+
+__attribute__((target("avx2")))
+static size_t range_i32_avx2(const int32_t *column, size_t start, size_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+    const __m256i low = _mm256_set1_epi32(lo);
+    const __m256i high = _mm256_set1_epi32(hi);
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i index = _mm256_add_epi32(_mm256_set1_epi32((int32_t)start), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    size_t n = 0;
+    size_t i = start;
+
+    // out has room for end - start entries and n <= i - start, so a full 8-lane store always fits
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(column + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(low, x), _mm256_cmpgt_epi32(x, high));
+        unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(outside)) & 0xffu;
+
+        if (mask != 0)
+        {
+            __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)compress_lut[mask]));
+            _mm256_storeu_si256((__m256i *)(out + n), _mm256_permutevar8x32_epi32(index, lanes));
+            n += (size_t)__builtin_popcount(mask);
+        }
+        index = _mm256_add_epi32(index, step);
+    }
+
+    return n + scan_i32(column, i, end, lo, hi, out + n);
+}
+
+__attribute__((target("avx2")))
+static size_t range_i64_avx2(const int64_t *column, size_t start, size_t end, int64_t lo, int64_t hi, uint32_t *out)
+{
+    const __m256i low = _mm256_set1_epi64x(lo);
+    const __m256i high = _mm256_set1_epi64x(hi);
+    size_t n = 0;
+    size_t i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(column + i));
+        __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(low, x), _mm256_cmpgt_epi64(x, high));
+        unsigned mask = ~(unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xfu;
+
+        while (mask != 0)
+        {
+            out[n++] = (uint32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return n + scan_i64(column, i, end, lo, hi, out + n);
+}
+
+__attribute__((target("sse4.2")))
+static size_t range_i32_sse42(const int32_t *column, size_t start, size_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+    const __m128i low = _mm_set1_epi32(lo);
+    const __m128i high = _mm_set1_epi32(hi);
+    size_t n = 0;
+    size_t i = start;
+
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(column + i));
+        __m128i outside = _mm_or_si128(_mm_cmpgt_epi32(low, x), _mm_cmpgt_epi32(x, high));
+        unsigned mask = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(outside)) & 0xfu;
+
+        while (mask != 0)
+        {
+            out[n++] = (uint32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return n + scan_i32(column, i, end, lo, hi, out + n);
+}
+
+__attribute__((target("sse4.2")))
+static size_t range_i64_sse42(const int64_t *column, size_t start, size_t end, int64_t lo, int64_t hi, uint32_t *out)
+{
+    const __m128i low = _mm_set1_epi64x(lo);
+    const __m128i high = _mm_set1_epi64x(hi);
+    size_t n = 0;
+    size_t i = start;
+
+    for (; i + 2 <= end; i += 2)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)(column + i));
+        __m128i outside = _mm_or_si128(_mm_cmpgt_epi64(low, x), _mm_cmpgt_epi64(x, high));
+        unsigned mask = ~(unsigned)_mm_movemask_pd(_mm_castsi128_pd(outside)) & 0x3u;
+
+        while (mask != 0)
+        {
+            out[n++] = (uint32_t)(i + (size_t)__builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+
+    return n + scan_i64(column, i, end, lo, hi, out + n);
+}
+
+/**
+ * Function:  select_kernels
+ * -------------------------
+ * @brief  Picks the widest kernels the CPU supports. Runs before main().
+ *
+ */
+__attribute__((constructor))
+static void select_kernels(void)
+{
+    for (unsigned mask = 0; mask < 256; mask++)
+    {
+        unsigned k = 0;
+        for (unsigned bit = 0; bit < 8; bit++)
+        {
+            if (mask & (1u << bit))
+            {
+                compress_lut[mask][k++] = (uint8_t)bit;
+            }
+        }
+        while (k < 8)
+        {
+            compress_lut[mask][k++] = 0;
+        }
+    }
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        range_i32 = range_i32_avx2;
+        range_i64 = range_i64_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse4.2"))
+    {
+        range_i32 = range_i32_sse42;
+        range_i64 = range_i64_sse42;
+        kernel_name = "sse4.2";
+    }
+}
+
+#endif
+
+/**
+ * Function:  filter_range_i32
+ * ---------------------------
+ * @brief  Selects the rows in [start, end) of a 32-bit column whose value is in [lo, hi].
+ *
+ * @param column The column to be scanned.
+ * @param start The first row to be scanned.
+ * @param end The row after the last one to be scanned.
+ * @param lo The smallest matching value.
+ * @param hi The largest matching value.
+ * @param out The selection vector; it must have room for end - start entries.
+ *
+ * @return size_t The number of matching rows, stored in increasing order.
+ *
+ */
+size_t filter_range_i32(const int32_t *column, size_t start, size_t end, int32_t lo, int32_t hi, uint32_t *out)
+{
+    return range_i32(column, start, end, lo, hi, out);
+}
+
+/**
+ * Function:  filter_range_i64
+ * ---------------------------
+ * @brief  Selects the rows in [start, end) of a 64-bit column whose value is in [lo, hi].
+ *
+ * @param column The column to be scanned.
+ * @param start The first row to be scanned.
+ * @param end The row after the last one to be scanned.
+ * @param lo The smallest matching value.
+ * @param hi The largest matching value.
+ * @param out The selection vector; it must have room for end - start entries.
+ *
+ * @return size_t The number of matching rows, stored in increasing order.
+ *
+ */
+size_t filter_range_i64(const int64_t *column, size_t start, size_t end, int64_t lo, int64_t hi, uint32_t *out)
+{
+    return range_i64(column, start, end, lo, hi, out);
+}
+
+/**
+ * Function:  filter_kernel_name
+ * -----------------------------
+ * @brief  Names the instruction set the predicates run on.
+ *
+ * @return const char* "avx2", "sse4.2" or "scalar".
+ *
+ */
+const char *filter_kernel_name(void)
+{
+    return kernel_name;
+}
@@ -0,0 +1,23 @@
+/** @file filter.h
+ *  @brief Function prototypes for the vectorized column predicates.
+ *
+ *  Each predicate scans a range of rows of one numeric column of the song
+ *  table and writes the indices of the rows whose value lies in [lo, hi]
+ *  to a selection vector. The kernels use AVX2 or SSE4.2 when the CPU has
+ *  them and fall back to a branch-free scalar loop otherwise; the choice is
+ *  made once at run time.
+ */
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Function protypes associated with the column predicates.
+ */
+size_t filter_range_i32(const int32_t *column, size_t start, size_t end, int32_t lo, int32_t hi, uint32_t *out);
+size_t filter_range_i64(const int64_t *column, size_t start, size_t end, int64_t lo, int64_t hi, uint32_t *out);
+const char *filter_kernel_name(void);
+
+#endif
@@ -0,0 +1,539 @@
+/** @file group.c
+ *  @brief Implementation of the GROUP BY aggregation engine.
+ *
+ * The hash tables use linear probing over a power-of-two number of slots
+ * and are never more than half full, so a lookup rarely probes more than
+ * a slot or two. A slot whose count is 0 is empty: every group holds at
+ * least the row that created it. Grouping by year needs a handful of
+ * slots, and grouping by artist at most one per name of the dictionary.
+ *
+ * Each part selects the rows of its range a block at a time and folds the
+ * block into its table while it is still in cache; the filter stage of the
+ * metrics covers both. The tables of the other parts are then merged into
+ * that of the first, which is compacted and sorted in place.
+ *
+ * Groups that tie on the aggregate are ordered by artist name or by year,
+ * so the output does not depend on the number of threads. Row 0 holds the
+ * header line of the file and never joins a group.
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "group.h"
+
+// Rows selected at once before they are folded
+#define GROUP_BLOCK 16384
+
+typedef struct {
+    group_entry *slots;
+    size_t size;
+    size_t count;
+} group_table;
+
+typedef struct {
+    const song_table *table;
+    scan_select_fn select;
+    const void *arg;
+    const group_spec *spec;
+    size_t start;
+    size_t end;
+    group_table groups;
+    size_t matches;
+    stage_stats filter;
+    pthread_t worker;
+    bool started;
+} group_part;
+
+typedef struct {
+    const song_table *table;
+    const group_spec *spec;
+} group_order_ctx;
+
+static const struct {
+    const char *name;
+    agg_fn fn;
+} agg_names[] = {
+    {"SUM", AGG_SUM},
+    {"COUNT", AGG_COUNT},
+    {"AVG", AGG_AVG},
+    {"MAX", AGG_MAX},
+};
+
+// Headers of the aggregate, by function and then by the count it reads
+static const char *agg_headers[] = {"sum_", "count", "avg_", "max_"};
+static const char *value_headers[] = {"streams", "in_spotify_playlists", "in_apple_playlists"};
+
+// Parses an aggregate such as "SUM(STREAMS)"; COUNT may also be written alone or as COUNT(*)
+static int parse_agg(const char *text, agg_fn *fn, sort_key *value)
+{
+    const char *open = strchr(text, '(');
+    const char *close;
+    size_t name_len = open != NULL ? (size_t)(open - text) : strlen(text);
+    size_t i;
+
+    for (i = 0; i < sizeof(agg_names) / sizeof(agg_names[0]); i++)
+    {
+        if (strlen(agg_names[i].name) == name_len && memcmp(text, agg_names[i].name, name_len) == 0)
+        {
+            break;
+        }
+    }
+    if (i == sizeof(agg_names) / sizeof(agg_names[0]))
+    {
+        return -1;
+    }
+    *fn = agg_names[i].fn;
+    *value = KEY_STREAMS;
+    if (open == NULL)
+    {
+        return *fn == AGG_COUNT ? 0 : -1;
+    }
+
+    close = strchr(open, ')');
+    if (close == NULL || close[1] != '\0')
+    {
+        return -1;
+    }
+    if (*fn == AGG_COUNT && close == open + 2 && open[1] == '*')
+    {
+        return 0;
+    }
+    // Only the counts can be added up
+    if (!sort_column(open + 1, (size_t)(close - open - 1), value) || *value > KEY_APPLE)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function:  group_parse
+ * ----------------------
+ * @brief  Parses --group_by and --agg into a descriptor, ordered by the aggregate.
+ *
+ * @param spec The descriptor to be filled in.
+ * @param group_by ARTIST or YEAR.
+ * @param agg SUM, COUNT, AVG or MAX of STREAMS, NO_SPOTIFY_PLAYLISTS or
+ *        NO_APPLE_PLAYLISTS, such as "SUM(STREAMS)", or NULL to count the songs.
+ *
+ * @return int 0 on success, -1 if either is malformed.
+ *
+ */
+int group_parse(group_spec *spec, const char *group_by, const char *agg)
+{
+    if (strcmp(group_by, "ARTIST") == 0)
+    {
+        spec->column = GROUP_ARTIST;
+    }
+    else if (strcmp(group_by, "YEAR") == 0)
+    {
+        spec->column = GROUP_YEAR;
+    }
+    else
+    {
+        return -1;
+    }
+    spec->by_group = false;
+    spec->descending = false;
+    spec->unordered = false;
+    if (agg == NULL)
+    {
+        spec->fn = AGG_COUNT;
+        spec->value = KEY_STREAMS;
+        return 0;
+    }
+    return parse_agg(agg, &spec->fn, &spec->value);
+}
+
+/**
+ * Function:  group_order
+ * ----------------------
+ * @brief  Parses the ordering of a grouped query into its descriptor.
+ *
+ * @param spec The descriptor, from group_parse().
+ * @param order_by The group_by field (ARTIST or YEAR), or the aggregate as
+ *        --agg gives it.
+ * @param order ASC or DES, or NONE to keep the groups in the order their
+ *        first songs appear in the file.
+ *
+ * @return int 0 on success, -1 if order_by names neither.
+ *
+ */
+int group_order(group_spec *spec, const char *order_by, const char *order)
+{
+    agg_fn fn;
+    sort_key value;
+
+    spec->unordered = strcmp(order, "NONE") == 0;
+    spec->descending = strcmp(order, "DES") == 0;
+    spec->by_group = strcmp(order_by, spec->column == GROUP_ARTIST ? "ARTIST" : "YEAR") == 0;
+    if (spec->by_group)
+    {
+        return 0;
+    }
+    if (parse_agg(order_by, &fn, &value) != 0 || fn != spec->fn || (fn != AGG_COUNT && value != spec->value))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function:  group_columns
+ * ------------------------
+ * @brief  Returns the set of input columns a grouped query folds.
+ *
+ * @param spec The descriptor.
+ *
+ * @return unsigned The columns, as FIELD_BIT() of their positions.
+ *
+ */
+unsigned group_columns(const group_spec *spec)
+{
+    unsigned columns = FIELD_BIT(spec->column == GROUP_ARTIST ? FIELD_ARTIST : FIELD_YEAR);
+
+    return spec->fn == AGG_COUNT ? columns : columns | sort_key_columns(spec->value);
+}
+
+/**
+ * Function:  group_header
+ * -----------------------
+ * @brief  Formats the CSV header of a grouped query, such as "artist(s)_name,sum_streams".
+ *
+ * @param spec The descriptor.
+ * @param buf Receives the header, without a newline.
+ * @param size The size of buf.
+ *
+ * @return int The length of the header, as snprintf() returns it.
+ *
+ */
+int group_header(const group_spec *spec, char *buf, size_t size)
+{
+    return snprintf(buf, size, "%s,%s%s", spec->column == GROUP_ARTIST ? "artist(s)_name" : "released_year",
+                    agg_headers[spec->fn], spec->fn == AGG_COUNT ? "" : value_headers[spec->value]);
+}
+
+// Scatters a 32-bit key over the slots
+static size_t hash_key(uint32_t key)
+{
+    return (size_t)(((uint64_t)key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+// Prepares an empty table with a power-of-two number of slots
+static void groups_init(group_table *groups, size_t size)
+{
+    groups->slots = (group_entry *)emalloc(size * sizeof(group_entry));
+    memset(groups->slots, 0, size * sizeof(group_entry));
+    groups->size = size;
+    groups->count = 0;
+}
+
+// Finds the slot of a key in a table that has room for it
+static group_entry *probe(group_table *groups, uint32_t key)
+{
+    size_t mask = groups->size - 1;
+    size_t i = hash_key(key) & mask;
+
+    while (groups->slots[i].count != 0 && groups->slots[i].key != key)
+    {
+        i = (i + 1) & mask;
+    }
+    return &groups->slots[i];
+}
+
+// Doubles the slots of a table and moves its groups over
+static void grow_groups(group_table *groups)
+{
+    group_table larger;
+
+    groups_init(&larger, groups->size * 2);
+    for (size_t i = 0; i < groups->size; i++)
+    {
+        if (groups->slots[i].count != 0)
+        {
+            *probe(&larger, groups->slots[i].key) = groups->slots[i];
+        }
+    }
+    larger.count = groups->count;
+    free(groups->slots);
+    *groups = larger;
+}
+
+// Returns the group of a key, adding an empty one (count 0) if there is none yet
+static group_entry *find_group(group_table *groups, uint32_t key)
+{
+    group_entry *group;
+
+    if ((groups->count + 1) * 2 > groups->size)
+    {
+        grow_groups(groups);
+    }
+    group = probe(groups, key);
+    if (group->count == 0)
+    {
+        group->key = key;
+        group->first = UINT32_MAX;
+        group->sum = 0;
+        group->max = INT64_MIN;
+        groups->count++;
+    }
+    return group;
+}
+
+// Count of a row that an aggregate reads
+static int64_t row_value(const song_table *table, sort_key value, uint32_t row)
+{
+    switch (value)
+    {
+    case KEY_STREAMS:
+        return table->streams[row];
+    case KEY_SPOTIFY:
+        return table->spotify[row];
+    default:
+        return table->apple[row];
+    }
+}
+
+// Folds selected rows, in increasing order, into the groups of a part
+static void fold_rows(group_part *part, const uint32_t *rows, size_t n)
+{
+    const song_table *table = part->table;
+    const group_spec *spec = part->spec;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t row = rows[i];
+        uint32_t key = spec->column == GROUP_ARTIST ? table->artist[row] : (uint32_t)table->year[row];
+        int64_t value = spec->fn == AGG_COUNT ? 0 : row_value(table, spec->value, row);
+        group_entry *group = find_group(&part->groups, key);
+
+        if (group->count++ == 0)
+        {
+            group->first = row;
+        }
+        group->sum += value;
+        group->max = value > group->max ? value : group->max;
+    }
+}
+
+// Selects and folds the rows of one part, a block at a time
+static void *group_part_run(void *arg)
+{
+    group_part *part = (group_part *)arg;
+    uint32_t *selection = (uint32_t *)emalloc(GROUP_BLOCK * sizeof(uint32_t));
+    stats_clock clock;
+
+    stats_start_thread(&clock);
+    for (size_t block = part->start; block < part->end; block += GROUP_BLOCK)
+    {
+        size_t block_end = part->end - block > GROUP_BLOCK ? block + GROUP_BLOCK : part->end;
+        size_t matches = part->select(part->table, block, block_end, selection, part->arg);
+
+        part->matches += matches;
+        fold_rows(part, selection, matches);
+    }
+    stats_stop(&clock, &part->filter);
+    free(selection);
+    return NULL;
+}
+
+// Adds the groups of one table to another
+static void merge_groups(group_table *into, const group_table *from)
+{
+    for (size_t i = 0; i < from->size; i++)
+    {
+        const group_entry *part = &from->slots[i];
+        group_entry *group;
+
+        if (part->count == 0)
+        {
+            continue;
+        }
+        group = find_group(into, part->key);
+        group->count += part->count;
+        group->sum += part->sum;
+        group->max = part->max > group->max ? part->max : group->max;
+        group->first = part->first < group->first ? part->first : group->first;
+    }
+}
+
+/**
+ * Function:  group_total
+ * ----------------------
+ * @brief  Returns the aggregate of a group: its SUM, COUNT or MAX, or the
+ *         sum an AVG divides by its count.
+ *
+ * @param spec The descriptor.
+ * @param group The group.
+ *
+ * @return int64_t The aggregate.
+ *
+ */
+int64_t group_total(const group_spec *spec, const group_entry *group)
+{
+    switch (spec->fn)
+    {
+    case AGG_COUNT:
+        return (int64_t)group->count;
+    case AGG_MAX:
+        return group->max;
+    default:
+        return group->sum;
+    }
+}
+
+// Compares two groups themselves: artists by name, years by number
+static int compare_keys(const group_order_ctx *ctx, const group_entry *a, const group_entry *b)
+{
+    if (ctx->spec->column == GROUP_ARTIST)
+    {
+        int c = strcmp(ctx->table->strings + ctx->table->artists[a->key],
+                       ctx->table->strings + ctx->table->artists[b->key]);
+        return (c > 0) - (c < 0);
+    }
+    return ((int32_t)a->key > (int32_t)b->key) - ((int32_t)a->key < (int32_t)b->key);
+}
+
+// Compares the aggregates of two groups
+static int compare_values(const group_spec *spec, const group_entry *a, const group_entry *b)
+{
+    if (spec->fn == AGG_AVG)
+    {
+        double x = (double)a->sum / (double)a->count;
+        double y = (double)b->sum / (double)b->count;
+        return (x > y) - (x < y);
+    }
+    int64_t x = group_total(spec, a);
+    int64_t y = group_total(spec, b);
+    return (x > y) - (x < y);
+}
+
+// Orders two groups for output, breaking ties on the groups themselves
+static int compare_groups(const void *x, const void *y, void *arg)
+{
+    const group_order_ctx *ctx = (const group_order_ctx *)arg;
+    const group_entry *a = (const group_entry *)x;
+    const group_entry *b = (const group_entry *)y;
+    int c;
+
+    if (ctx->spec->unordered)
+    {
+        return (a->first > b->first) - (a->first < b->first);
+    }
+    c = ctx->spec->by_group ? compare_keys(ctx, a, b) : compare_values(ctx->spec, a, b);
+    if (c != 0)
+    {
+        return ctx->spec->descending ? -c : c;
+    }
+    return compare_keys(ctx, a, b);
+}
+
+/**
+ * Function:  group_scan
+ * ---------------------
+ * @brief  Folds the matching rows of a table into groups and returns them in output order.
+ *
+ * @param table The table to be scanned.
+ * @param select The function that selects the matching rows of a range.
+ * @param arg The argument passed to select.
+ * @param threads The number of threads to scan with.
+ * @param spec The grouping and its ordering, from group_parse() and group_order().
+ * @param count Receives the number of groups returned.
+ * @param stats The metrics of the query, to which the filter and sort stages are added.
+ *
+ * @return group_entry* The groups, first printed first, to be released with free().
+ *
+ */
+group_entry *group_scan(const song_table *table, scan_select_fn select, const void *arg, int threads,
+                        const group_spec *spec, size_t *count, query_stats *stats)
+{
+    group_part *parts;
+    group_entry *result;
+    group_order_ctx ctx = {table, spec};
+    size_t rows = table->rows > 0 ? table->rows - 1 : 0;
+    size_t matches = 0;
+    size_t n = 0;
+    stats_clock clock;
+    stage_stats scan = {0, 0, 0, 0, 0, 0, 0};
+    stage_stats *filter = &stats->stages[STAGE_FILTER];
+    stage_stats *sort = &stats->stages[STAGE_SORT];
+    double filter_wall_ms = 0;
+    double filter_cpu_ms = 0;
+    uint64_t filter_allocations = 0;
+    uint64_t filter_allocated = 0;
+
+    stats_start(&clock);
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    parts = (group_part *)emalloc((size_t)threads * sizeof(group_part));
+    for (int i = 0; i < threads; i++)
+    {
+        parts[i].table = table;
+        parts[i].select = select;
+        parts[i].arg = arg;
+        parts[i].spec = spec;
+        parts[i].start = 1 + rows * (size_t)i / (size_t)threads;
+        parts[i].end = 1 + rows * (size_t)(i + 1) / (size_t)threads;
+        parts[i].matches = 0;
+        memset(&parts[i].filter, 0, sizeof(parts[i].filter));
+        groups_init(&parts[i].groups, GROUP_MIN_SLOTS);
+        // The first part runs on this thread once the others are started
+        parts[i].started = i > 0 && pthread_create(&parts[i].worker, NULL, group_part_run, &parts[i]) == 0;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (parts[i].started)
+        {
+            pthread_join(parts[i].worker, NULL);
+        }
+        else
+        {
+            group_part_run(&parts[i]);
+        }
+        matches += parts[i].matches;
+        filter_wall_ms = parts[i].filter.wall_ms > filter_wall_ms ? parts[i].filter.wall_ms : filter_wall_ms;
+        filter_cpu_ms += parts[i].filter.cpu_ms;
+        filter_allocations += parts[i].filter.allocations;
+        filter_allocated += parts[i].filter.allocated_bytes;
+    }
+
+    for (int i = 1; i < threads; i++)
+    {
+        merge_groups(&parts[0].groups, &parts[i].groups);
+        free(parts[i].groups.slots);
+    }
+    // Pack the groups at the front of the slots of the first part and sort them there
+    result = parts[0].groups.slots;
+    for (size_t i = 0; i < parts[0].groups.size; i++)
+    {
+        if (result[i].count != 0)
+        {
+            result[n++] = result[i];
+        }
+    }
+    qsort_r(result, n, sizeof(group_entry), compare_groups, &ctx);
+    free(parts);
+    *count = n;
+
+    stats_stop(&clock, &scan);
+    filter->wall_ms += filter_wall_ms;
+    filter->cpu_ms += filter_cpu_ms;
+    filter->allocations += filter_allocations;
+    filter->allocated_bytes += filter_allocated;
+    filter->rows_in += rows;
+    filter->rows_out += matches;
+    sort->wall_ms += scan.wall_ms - filter_wall_ms;
+    sort->cpu_ms += scan.cpu_ms - filter_cpu_ms;
+    // The parts count their own allocations, so the rest of the scan's are those of the sort
+    sort->allocations += scan.allocations - filter_allocations;
+    sort->allocated_bytes += scan.allocated_bytes - filter_allocated;
+    sort->rows_in += matches;
+    sort->rows_out += n;
+    return result;
+}
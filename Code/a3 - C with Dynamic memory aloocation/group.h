@@ -0,0 +1,65 @@
+/** @file group.h
+ *  @brief Function prototypes for the GROUP BY aggregation engine.
+ *
+ *  A grouped query folds its matching songs into one line per artist or
+ *  per release year, holding the SUM, COUNT, AVG or MAX of one of the
+ *  counts. Every thread folds the rows of its range into its own
+ *  open-addressing hash table, keyed on the artist ID or the year, and the
+ *  partial tables are merged once the threads are joined. The groups are
+ *  then ordered on the aggregate or on the group itself, like songs are.
+ */
+#ifndef _GROUP_H_
+#define _GROUP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "scan.h"
+#include "sortkey.h"
+#include "stats.h"
+#include "table.h"
+
+#define GROUP_MIN_SLOTS 64
+
+typedef enum {
+    GROUP_ARTIST,
+    GROUP_YEAR
+} group_column;
+
+typedef enum {
+    AGG_SUM,
+    AGG_COUNT,
+    AGG_AVG,
+    AGG_MAX
+} agg_fn;
+
+typedef struct {
+    group_column column;
+    agg_fn fn;
+    sort_key value;
+    bool by_group;
+    bool descending;
+    bool unordered;
+} group_spec;
+
+// One group: its key (artist ID or year), its first row and the running aggregates of its rows
+typedef struct {
+    uint32_t key;
+    uint32_t first;
+    uint64_t count;
+    int64_t sum;
+    int64_t max;
+} group_entry;
+
+/**
+ * Function protypes associated with the aggregation engine.
+ */
+int group_parse(group_spec *, const char *group_by, const char *agg);
+int group_order(group_spec *, const char *order_by, const char *order);
+unsigned group_columns(const group_spec *);
+int group_header(const group_spec *, char *buf, size_t size);
+int64_t group_total(const group_spec *, const group_entry *);
+group_entry *group_scan(const song_table *, scan_select_fn, const void *arg, int threads,
+                        const group_spec *spec, size_t *count, query_stats *stats);
+
+#endif
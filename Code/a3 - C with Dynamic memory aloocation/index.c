@@ -0,0 +1,829 @@
+/** @file index.c
+ *  @brief Implementation of the secondary indexes on year and artist.
+ *
+ * Layout (native byte order, sections aligned as in a snapshot):
+ *
+ *     header        index_header, padded to 64 bytes
+ *     year_values   int32[years]        distinct years, ascending
+ *     year_start    uint32[years + 1]   where each year starts in year_rows
+ *     year_rows     uint32[rows]        rows grouped by year, ascending
+ *     token_offset  uint64[tokens + 1]  where each word starts in token_bytes
+ *     token_start   uint64[tokens + 1]  where each word starts in postings
+ *     postings      uint32[postings]    rows containing each word, ascending
+ *     token_bytes   char[token_bytes]   the words, sorted, not terminated
+ *
+ * The words of an artist name are its runs of non-space bytes. A searched
+ * name matches an artist when it is a substring of it, so each piece of
+ * the name between spaces constrains the words it can land on: a piece
+ * between two spaces is a whole word, the first piece is the end of a
+ * word, the last one the start of a word, and a name without spaces can
+ * lie anywhere inside one. The rows of the most selective piece are the
+ * candidates, and the caller checks each candidate against the full name.
+ *
+ * The header records the size and modification time of the data file the
+ * index was built from, so an index left behind by an older file is never
+ * used.
+ *
+ */
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "snapshot.h"
+#include "index.h"
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+enum {
+    SECTION_YEAR_VALUES,
+    SECTION_YEAR_START,
+    SECTION_YEAR_ROWS,
+    SECTION_TOKEN_OFFSET,
+    SECTION_TOKEN_START,
+    SECTION_POSTINGS,
+    SECTION_TOKEN_BYTES,
+    SECTION_COUNT
+};
+
+typedef enum {
+    MATCH_INSIDE,
+    MATCH_SUFFIX,
+    MATCH_PREFIX,
+    MATCH_EXACT
+} match_kind;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t rows;
+    uint64_t data_size;
+    int64_t data_mtime_sec;
+    int64_t data_mtime_nsec;
+    uint64_t years;
+    uint64_t tokens;
+    uint64_t postings;
+    uint64_t token_bytes;
+    uint64_t file_size;
+    uint64_t offsets[SECTION_COUNT];
+    uint64_t payload_checksum;
+    uint64_t header_checksum;
+} index_header;
+
+// Distinct words seen while building, found through an open-addressing hash table
+typedef struct {
+    char *text;
+    size_t text_len;
+    size_t text_cap;
+    uint64_t *offset;
+    uint32_t *length;
+    uint32_t *last_row;
+    size_t count;
+    size_t capacity;
+    uint32_t *slots;
+    size_t slot_count;
+} token_dict;
+
+typedef struct {
+    int32_t year;
+    uint32_t row;
+} year_pair;
+
+/**
+ * Function:  next_token
+ * ---------------------
+ * @brief  Finds the next run of non-space bytes in a name.
+ *
+ * @param cursor The position to search from; moved past the word found.
+ * @param length Receives the length of the word.
+ *
+ * @return const char* The start of the word, or NULL at the end of the name.
+ *
+ */
+static const char *next_token(const char **cursor, size_t *length)
+{
+    const char *s = *cursor;
+
+    while (*s == ' ')
+    {
+        s++;
+    }
+    if (*s == '\0')
+    {
+        return NULL;
+    }
+
+    const char *start = s;
+    while (*s != ' ' && *s != '\0')
+    {
+        s++;
+    }
+    *length = (size_t)(s - start);
+    *cursor = s;
+    return start;
+}
+
+static uint64_t hash_bytes(const char *s, size_t n)
+{
+    uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Doubles the hash table and puts every word back in it
+static void dict_rehash(token_dict *dict)
+{
+    size_t slot_count = dict->slot_count == 0 ? 1024 : dict->slot_count * 2;
+
+    free(dict->slots);
+    dict->slots = (uint32_t *)emalloc(slot_count * sizeof(uint32_t));
+    memset(dict->slots, 0, slot_count * sizeof(uint32_t));
+    dict->slot_count = slot_count;
+
+    for (size_t id = 0; id < dict->count; id++)
+    {
+        size_t slot = hash_bytes(dict->text + dict->offset[id], dict->length[id]) & (slot_count - 1);
+        while (dict->slots[slot] != 0)
+        {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        dict->slots[slot] = (uint32_t)id + 1;
+    }
+}
+
+/**
+ * Function:  dict_intern
+ * ----------------------
+ * @brief  Returns the id of a word, adding it to the dictionary if it is new.
+ *
+ * @param dict The dictionary.
+ * @param s The bytes of the word.
+ * @param n The length of the word.
+ *
+ * @return uint32_t The id of the word.
+ *
+ */
+static uint32_t dict_intern(token_dict *dict, const char *s, size_t n)
+{
+    if ((dict->count + 1) * 2 > dict->slot_count)
+    {
+        dict_rehash(dict);
+    }
+
+    size_t slot = hash_bytes(s, n) & (dict->slot_count - 1);
+    while (dict->slots[slot] != 0)
+    {
+        uint32_t id = dict->slots[slot] - 1;
+        if (dict->length[id] == n && memcmp(dict->text + dict->offset[id], s, n) == 0)
+        {
+            return id;
+        }
+        slot = (slot + 1) & (dict->slot_count - 1);
+    }
+
+    if (dict->count == dict->capacity)
+    {
+        dict->capacity = dict->capacity == 0 ? 1024 : dict->capacity * 2;
+        dict->offset = erealloc(dict->offset, dict->capacity * sizeof(uint64_t));
+        dict->length = erealloc(dict->length, dict->capacity * sizeof(uint32_t));
+        dict->last_row = erealloc(dict->last_row, dict->capacity * sizeof(uint32_t));
+    }
+    if (dict->text_len + n > dict->text_cap)
+    {
+        dict->text_cap = dict->text_cap == 0 ? 64 * 1024 : dict->text_cap * 2;
+        while (dict->text_cap < dict->text_len + n)
+        {
+            dict->text_cap *= 2;
+        }
+        dict->text = erealloc(dict->text, dict->text_cap);
+    }
+
+    uint32_t id = (uint32_t)dict->count++;
+    memcpy(dict->text + dict->text_len, s, n);
+    dict->offset[id] = dict->text_len;
+    dict->length[id] = (uint32_t)n;
+    dict->last_row[id] = 0;
+    dict->text_len += n;
+    dict->slots[slot] = id + 1;
+    return id;
+}
+
+static void dict_free(token_dict *dict)
+{
+    free(dict->text);
+    free(dict->offset);
+    free(dict->length);
+    free(dict->last_row);
+    free(dict->slots);
+}
+
+/**
+ * Function:  compare_bytes
+ * ------------------------
+ * @brief  Orders two byte strings, a proper prefix first.
+ *
+ * @return int Negative, zero or positive as with memcmp().
+ *
+ */
+static int compare_bytes(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static int compare_token_ids(const void *a, const void *b, void *arg)
+{
+    const token_dict *dict = (const token_dict *)arg;
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return compare_bytes(dict->text + dict->offset[x], dict->length[x], dict->text + dict->offset[y], dict->length[y]);
+}
+
+static int compare_year_pairs(const void *a, const void *b)
+{
+    const year_pair *x = (const year_pair *)a;
+    const year_pair *y = (const year_pair *)b;
+
+    if (x->year != y->year)
+    {
+        return x->year < y->year ? -1 : 1;
+    }
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t header_checksum(const index_header *header)
+{
+    return snapshot_checksum(SNAPSHOT_CHECKSUM_SEED, header, offsetof(index_header, header_checksum));
+}
+
+// Size in bytes of a section of the index described by a header
+static uint64_t section_size(const index_header *header, int section)
+{
+    switch (section)
+    {
+    case SECTION_YEAR_VALUES:
+        return header->years * sizeof(int32_t);
+    case SECTION_YEAR_START:
+        return (header->years + 1) * sizeof(uint32_t);
+    case SECTION_YEAR_ROWS:
+        return header->rows * sizeof(uint32_t);
+    case SECTION_TOKEN_OFFSET:
+    case SECTION_TOKEN_START:
+        return (header->tokens + 1) * sizeof(uint64_t);
+    case SECTION_POSTINGS:
+        return header->postings * sizeof(uint32_t);
+    default:
+        return header->token_bytes;
+    }
+}
+
+/**
+ * Function:  index_path
+ * ---------------------
+ * @brief  Names the index file that belongs to a data file.
+ *
+ * @param data_path The path of the data file (CSV or snapshot).
+ *
+ * @return char* The path with INDEX_SUFFIX appended; the caller frees it.
+ *
+ */
+char *index_path(const char *data_path)
+{
+    size_t n = strlen(data_path);
+    char *path = (char *)emalloc(n + sizeof(INDEX_SUFFIX));
+
+    memcpy(path, data_path, n);
+    memcpy(path + n, INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+    return path;
+}
+
+/**
+ * Function:  index_build
+ * ----------------------
+ * @brief  Builds the year and artist indexes of a table and writes them to a file.
+ *
+ * @param table The table loaded from the data file.
+ * @param data_path The path of the data file, whose size and time are recorded.
+ * @param path The path of the index; an existing file is replaced.
+ *
+ * @return int 0 on success, -1 if the data file is gone or the index could not be written.
+ *
+ */
+int index_build(const song_table *table, const char *data_path, const char *path)
+{
+    index_header header;
+    struct stat st;
+    size_t rows = table->rows;
+
+    if (stat(data_path, &st) != 0)
+    {
+        return -1;
+    }
+
+    // Year index: sort the rows on (year, row) and note where each year starts
+    year_pair *pairs = (year_pair *)emalloc((rows + 1) * sizeof(year_pair));
+    int32_t *year_values = (int32_t *)emalloc((rows + 1) * sizeof(int32_t));
+    uint32_t *year_start = (uint32_t *)emalloc((rows + 1) * sizeof(uint32_t));
+    uint32_t *year_rows = (uint32_t *)emalloc((rows + 1) * sizeof(uint32_t));
+    size_t years = 0;
+
+    for (size_t row = 0; row < rows; row++)
+    {
+        pairs[row].year = table->year[row];
+        pairs[row].row = (uint32_t)row;
+    }
+    qsort(pairs, rows, sizeof(year_pair), compare_year_pairs);
+    for (size_t i = 0; i < rows; i++)
+    {
+        if (i == 0 || pairs[i].year != pairs[i - 1].year)
+        {
+            year_values[years] = pairs[i].year;
+            year_start[years++] = (uint32_t)i;
+        }
+        year_rows[i] = pairs[i].row;
+    }
+    year_start[years] = (uint32_t)rows;
+    free(pairs);
+
+    // Artist index: one (word, row) pair per distinct word of each name, in row order
+    token_dict dict;
+    uint32_t *pair_token = NULL;
+    uint32_t *pair_row = NULL;
+    size_t pair_count = 0;
+    size_t pair_cap = 0;
+
+    memset(&dict, 0, sizeof(dict));
+    for (size_t row = 0; row < rows; row++)
+    {
+        const char *cursor = table_artist(table, row);
+        const char *word;
+        size_t length;
+
+        while ((word = next_token(&cursor, &length)) != NULL)
+        {
+            uint32_t id = dict_intern(&dict, word, length);
+            if (dict.last_row[id] == (uint32_t)row + 1)
+            {
+                continue;
+            }
+            dict.last_row[id] = (uint32_t)row + 1;
+            if (pair_count == pair_cap)
+            {
+                pair_cap = pair_cap == 0 ? 4096 : pair_cap * 2;
+                pair_token = erealloc(pair_token, pair_cap * sizeof(uint32_t));
+                pair_row = erealloc(pair_row, pair_cap * sizeof(uint32_t));
+            }
+            pair_token[pair_count] = id;
+            pair_row[pair_count++] = (uint32_t)row;
+        }
+    }
+
+    // Group the pairs by word with a counting sort, which keeps each list in row order
+    uint64_t *by_id = (uint64_t *)emalloc((dict.count + 1) * sizeof(uint64_t));
+    uint32_t *grouped = (uint32_t *)emalloc((pair_count + 1) * sizeof(uint32_t));
+
+    memset(by_id, 0, (dict.count + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < pair_count; i++)
+    {
+        by_id[pair_token[i] + 1]++;
+    }
+    for (size_t id = 0; id < dict.count; id++)
+    {
+        by_id[id + 1] += by_id[id];
+    }
+    for (size_t i = 0; i < pair_count; i++)
+    {
+        grouped[by_id[pair_token[i]]++] = pair_row[i];
+    }
+    // by_id[id] now holds the end of the list of id; shift back to the starts
+    memmove(by_id + 1, by_id, dict.count * sizeof(uint64_t));
+    by_id[0] = 0;
+    free(pair_token);
+    free(pair_row);
+
+    // Lay the words out in sorted order so lookups can binary search them
+    uint32_t *order = (uint32_t *)emalloc((dict.count + 1) * sizeof(uint32_t));
+    uint64_t *token_offset = (uint64_t *)emalloc((dict.count + 1) * sizeof(uint64_t));
+    uint64_t *token_start = (uint64_t *)emalloc((dict.count + 1) * sizeof(uint64_t));
+    uint32_t *postings = (uint32_t *)emalloc((pair_count + 1) * sizeof(uint32_t));
+    char *token_bytes = (char *)emalloc(dict.text_len + 1);
+    uint64_t bytes = 0;
+    uint64_t posted = 0;
+
+    for (size_t id = 0; id < dict.count; id++)
+    {
+        order[id] = (uint32_t)id;
+    }
+    qsort_r(order, dict.count, sizeof(uint32_t), compare_token_ids, &dict);
+    for (size_t k = 0; k < dict.count; k++)
+    {
+        uint32_t id = order[k];
+        uint64_t n = by_id[id + 1] - by_id[id];
+
+        token_offset[k] = bytes;
+        token_start[k] = posted;
+        memcpy(token_bytes + bytes, dict.text + dict.offset[id], dict.length[id]);
+        memcpy(postings + posted, grouped + by_id[id], n * sizeof(uint32_t));
+        bytes += dict.length[id];
+        posted += n;
+    }
+    token_offset[dict.count] = bytes;
+    token_start[dict.count] = posted;
+    free(order);
+    free(grouped);
+    free(by_id);
+
+    const void *sections[SECTION_COUNT] = {
+        year_values, year_start, year_rows, token_offset, token_start, postings, token_bytes
+    };
+    char block[SNAPSHOT_ALIGN * ((sizeof(index_header) + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN)];
+    uint64_t offset = sizeof(block);
+    uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+    int status = -1;
+    char *pending;
+    FILE *file;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, 8);
+    header.version = INDEX_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.rows = rows;
+    header.data_size = (uint64_t)st.st_size;
+    header.data_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    header.data_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    header.years = years;
+    header.tokens = dict.count;
+    header.postings = posted;
+    header.token_bytes = bytes;
+
+    file = snapshot_create(path, &pending);
+    if (file != NULL)
+    {
+        // The header goes in last, once the offsets and the checksum are known
+        memset(block, 0, sizeof(block));
+        status = fwrite(block, 1, sizeof(block), file) == sizeof(block) ? 0 : -1;
+        for (int i = 0; status == 0 && i < SECTION_COUNT; i++)
+        {
+            header.offsets[i] = offset;
+            status = snapshot_write_section(file, sections[i], section_size(&header, i), &hash, &offset);
+        }
+        if (status == 0)
+        {
+            header.file_size = offset;
+            header.payload_checksum = hash;
+            header.header_checksum = header_checksum(&header);
+            memcpy(block, &header, sizeof(header));
+            if (fseek(file, 0, SEEK_SET) != 0 || fwrite(block, 1, sizeof(block), file) != sizeof(block))
+            {
+                status = -1;
+            }
+        }
+        status = snapshot_commit(file, pending, path, status);
+    }
+
+    dict_free(&dict);
+    free(year_values);
+    free(year_start);
+    free(year_rows);
+    free(token_offset);
+    free(token_start);
+    free(postings);
+    free(token_bytes);
+    return status;
+}
+
+/**
+ * Function:  index_open
+ * ---------------------
+ * @brief  Maps the index of a data file, if it is there and up to date.
+ *
+ * @param index The index to be filled in.
+ * @param table The table loaded from the data file.
+ * @param data_path The path of the data file.
+ * @param path The path of the index.
+ * @param verify Whether to also check the checksum of the whole index.
+ *
+ * @return int 0 on success, -1 if there is no index, 1 if the index is
+ *         stale, of another version or corrupt.
+ *
+ */
+int index_open(song_index *index, const song_table *table, const char *data_path, const char *path, bool verify)
+{
+    index_header header;
+    struct stat data_st;
+    struct stat st;
+    void *data;
+    int fd;
+
+    memset(index, 0, sizeof(*index));
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header) || stat(data_path, &data_st) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, INDEX_MAGIC, 8) == 0 && header.version == INDEX_VERSION &&
+                 header.byte_order == BYTE_ORDER_MARK && header.header_checksum == header_checksum(&header) &&
+                 header.file_size == (uint64_t)st.st_size;
+    // The index must describe this very data file
+    valid = valid && header.rows == table->rows && header.data_size == (uint64_t)data_st.st_size &&
+            header.data_mtime_sec == (int64_t)data_st.st_mtim.tv_sec &&
+            header.data_mtime_nsec == (int64_t)data_st.st_mtim.tv_nsec;
+    // Every section must lie inside the file (the counts are bounded first so the sizes cannot overflow)
+    valid = valid && header.rows <= header.file_size && header.years <= header.rows &&
+            header.tokens <= header.file_size && header.postings <= header.file_size &&
+            header.token_bytes <= header.file_size;
+    for (int i = 0; valid && i < SECTION_COUNT; i++)
+    {
+        valid = header.offsets[i] % SNAPSHOT_ALIGN == 0 && header.offsets[i] <= header.file_size &&
+                section_size(&header, i) <= header.file_size - header.offsets[i];
+    }
+    if (valid && verify)
+    {
+        // Fold the sections in exactly as index_build() did: data, then padding
+        uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+        for (int i = 0; i < SECTION_COUNT; i++)
+        {
+            const char *section = (const char *)data + header.offsets[i];
+            uint64_t size = section_size(&header, i);
+            hash = snapshot_checksum(hash, section, size);
+            hash = snapshot_checksum(hash, section + size, snapshot_align(size) - size);
+        }
+        valid = hash == header.payload_checksum;
+    }
+
+    char *base = (char *)data;
+    index->rows = header.rows;
+    index->years = header.years;
+    index->tokens = header.tokens;
+    index->year_values = (const int32_t *)(base + header.offsets[SECTION_YEAR_VALUES]);
+    index->year_start = (const uint32_t *)(base + header.offsets[SECTION_YEAR_START]);
+    index->year_rows = (const uint32_t *)(base + header.offsets[SECTION_YEAR_ROWS]);
+    index->token_offset = (const uint64_t *)(base + header.offsets[SECTION_TOKEN_OFFSET]);
+    index->token_start = (const uint64_t *)(base + header.offsets[SECTION_TOKEN_START]);
+    index->postings = (const uint32_t *)(base + header.offsets[SECTION_POSTINGS]);
+    index->token_bytes = base + header.offsets[SECTION_TOKEN_BYTES];
+    // The lists end where the sections end; lookups rely on that instead of checking
+    valid = valid && index->year_start[header.years] == header.rows &&
+            index->token_start[header.tokens] == header.postings &&
+            index->token_offset[header.tokens] == header.token_bytes;
+    if (!valid)
+    {
+        munmap(data, (size_t)st.st_size);
+        memset(index, 0, sizeof(*index));
+        return 1;
+    }
+
+    index->mapping = data;
+    index->mapping_size = (size_t)st.st_size;
+    return 0;
+}
+
+/**
+ * Function:  index_year
+ * ---------------------
+ * @brief  Finds the rows released in a year.
+ *
+ * @param index The index.
+ * @param year The year.
+ * @param count Receives the number of rows.
+ *
+ * @return const uint32_t* The rows, in increasing order, inside the mapping.
+ *
+ */
+const uint32_t *index_year(const song_index *index, int32_t year, size_t *count)
+{
+    size_t lo = 0;
+    size_t hi = index->years;
+
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->year_values[mid] < year)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *count = 0;
+    if (lo == index->years || index->year_values[lo] != year)
+    {
+        return index->year_rows;
+    }
+    uint32_t start = index->year_start[lo];
+    uint32_t end = index->year_start[lo + 1];
+    if (start <= end && end <= index->rows)
+    {
+        *count = end - start;
+    }
+    return index->year_rows + start;
+}
+
+/**
+ * Function:  piece_postings
+ * -------------------------
+ * @brief  Counts, and optionally copies, the rows of the words a piece of a name can land on.
+ *
+ * @param index The index.
+ * @param piece The bytes of the piece.
+ * @param n The length of the piece.
+ * @param kind Where the piece must lie inside a word.
+ * @param out Receives the rows (with repeats across words), or NULL to only count them.
+ *
+ * @return size_t The number of rows.
+ *
+ */
+static size_t piece_postings(const song_index *index, const char *piece, size_t n, match_kind kind, uint32_t *out)
+{
+    size_t first = 0;
+    size_t total = 0;
+
+    if (kind == MATCH_PREFIX || kind == MATCH_EXACT)
+    {
+        // Words starting with the piece are contiguous from the first one not below it
+        size_t hi = index->tokens;
+        while (first < hi)
+        {
+            size_t mid = first + (hi - first) / 2;
+            const char *word = index->token_bytes + index->token_offset[mid];
+            size_t length = index->token_offset[mid + 1] - index->token_offset[mid];
+            if (compare_bytes(word, length, piece, n) < 0)
+            {
+                first = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+    }
+
+    for (size_t k = first; k < index->tokens; k++)
+    {
+        const char *word = index->token_bytes + index->token_offset[k];
+        size_t length = index->token_offset[k + 1] - index->token_offset[k];
+        bool match;
+
+        switch (kind)
+        {
+        case MATCH_EXACT:
+            match = length == n && memcmp(word, piece, n) == 0;
+            break;
+        case MATCH_PREFIX:
+            match = length >= n && memcmp(word, piece, n) == 0;
+            break;
+        case MATCH_SUFFIX:
+            match = length >= n && memcmp(word + length - n, piece, n) == 0;
+            break;
+        default:
+            match = length >= n && memmem(word, length, piece, n) != NULL;
+            break;
+        }
+        if (!match)
+        {
+            if (kind == MATCH_PREFIX || kind == MATCH_EXACT)
+            {
+                break;
+            }
+            continue;
+        }
+
+        size_t rows = index->token_start[k + 1] - index->token_start[k];
+        if (out != NULL)
+        {
+            memcpy(out + total, index->postings + index->token_start[k], rows * sizeof(uint32_t));
+        }
+        total += rows;
+    }
+    return total;
+}
+
+/**
+ * Function:  index_artist
+ * -----------------------
+ * @brief  Finds the rows whose artist may contain a name.
+ *
+ * Every row containing the name is among the candidates, but not every
+ * candidate contains it: the caller must check them.
+ *
+ * @param index The index.
+ * @param name The searched name.
+ * @param count Receives the number of candidates.
+ *
+ * @return uint32_t* The candidate rows in increasing order, which the
+ *         caller frees, or NULL if the index cannot narrow the search
+ *         (the name is blank or too common) and every row must be scanned.
+ *
+ */
+uint32_t *index_artist(const song_index *index, const char *name, size_t *count)
+{
+    const char *best = NULL;
+    size_t best_len = 0;
+    match_kind best_kind = MATCH_INSIDE;
+    size_t best_total = 0;
+    const char *piece = name;
+    bool first = true;
+
+    // Pick the piece of the name between spaces that leads to the fewest rows
+    while (true)
+    {
+        const char *space = strchr(piece, ' ');
+        size_t n = space != NULL ? (size_t)(space - piece) : strlen(piece);
+        match_kind kind = first ? (space == NULL ? MATCH_INSIDE : MATCH_SUFFIX) : (space == NULL ? MATCH_PREFIX : MATCH_EXACT);
+
+        if (n > 0)
+        {
+            size_t total = piece_postings(index, piece, n, kind, NULL);
+            if (best == NULL || total < best_total)
+            {
+                best = piece;
+                best_len = n;
+                best_kind = kind;
+                best_total = total;
+            }
+        }
+        if (space == NULL)
+        {
+            break;
+        }
+        piece = space + 1;
+        first = false;
+    }
+
+    // A blank name matches every row, and a piece in most rows is cheaper to scan for
+    if (best == NULL || best_total > index->rows / 2)
+    {
+        return NULL;
+    }
+
+    uint32_t *rows = (uint32_t *)emalloc((best_total + 1) * sizeof(uint32_t));
+    size_t total = piece_postings(index, best, best_len, best_kind, rows);
+    size_t unique = 0;
+
+    qsort(rows, total, sizeof(uint32_t), compare_rows);
+    for (size_t i = 0; i < total; i++)
+    {
+        if (unique == 0 || rows[i] != rows[unique - 1])
+        {
+            rows[unique++] = rows[i];
+        }
+    }
+    *count = unique;
+    return rows;
+}
+
+/**
+ * Function:  index_close
+ * ----------------------
+ * @brief  Unmaps an index.
+ *
+ * @param index The index.
+ *
+ */
+void index_close(song_index *index)
+{
+    if (index->mapping != NULL)
+    {
+        munmap(index->mapping, index->mapping_size);
+    }
+    memset(index, 0, sizeof(*index));
+}
@@ -0,0 +1,48 @@
+/** @file index.h
+ *  @brief Function prototypes for the secondary indexes on year and artist.
+ *
+ *  An index file sits next to the data file it was built from and holds
+ *  two indexes over the rows of its table: the rows of every release year,
+ *  and an inverted index from each word of the artist names to the rows
+ *  that contain it. A query that can use an index visits only the rows in
+ *  its posting lists instead of the whole table. The index is mapped like
+ *  a snapshot and is ignored when the data file has changed since.
+ */
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "table.h"
+
+#define INDEX_MAGIC "SONGIDX1"
+#define INDEX_VERSION 1
+#define INDEX_SUFFIX ".idx"
+
+typedef struct {
+    size_t rows;
+    size_t years;
+    size_t tokens;
+    const int32_t *year_values;
+    const uint32_t *year_start;
+    const uint32_t *year_rows;
+    const uint64_t *token_offset;
+    const uint64_t *token_start;
+    const uint32_t *postings;
+    const char *token_bytes;
+    void *mapping;
+    size_t mapping_size;
+} song_index;
+
+/**
+ * Function protypes associated with the secondary indexes.
+ */
+char *index_path(const char *data_path);
+int index_build(const song_table *, const char *data_path, const char *path);
+int index_open(song_index *, const song_table *, const char *data_path, const char *path, bool verify);
+const uint32_t *index_year(const song_index *, int32_t year, size_t *count);
+uint32_t *index_artist(const song_index *, const char *name, size_t *count);
+void index_close(song_index *);
+
+#endif
@@ -0,0 +1,289 @@
+/** @file match.c
+ *  @brief Implementation of the precompiled substring matcher.
+ *
+ * The vector kernel loads the 32 bytes where the name could start and the
+ * 32 bytes where it would then end, and keeps the positions where both the
+ * first and the last byte of the name are found. Those two bytes rarely
+ * line up by chance, so the full compare runs a handful of times per
+ * artist instead of once per byte as in strstr().
+ *
+ * Ignoring case folds ASCII letters only: a letter byte is compared with
+ * its 0x20 bit set, which the full compare then confirms.
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "match.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATCH_X86 1
+#include <immintrin.h>
+#endif
+
+typedef const char *(*find_fn)(const matcher_t *, const char *, size_t);
+
+// Lower-cases an ASCII letter and leaves every other byte alone
+static inline unsigned char fold(unsigned char c)
+{
+    return (unsigned char)(c + ((unsigned)(c - 'A') < 26u) * 32u);
+}
+
+/**
+ * Function:  verify
+ * -----------------
+ * @brief  Checks whether the name starts at a position.
+ *
+ * @param m The matcher.
+ * @param s The position; at least m->len bytes must follow it.
+ *
+ * @return bool Whether the name is found there.
+ *
+ */
+static inline bool verify(const matcher_t *m, const char *s)
+{
+    if (!m->ignore_case)
+    {
+        return memcmp(s, m->needle, m->len) == 0;
+    }
+    for (size_t i = 0; i < m->len; i++)
+    {
+        if (fold((unsigned char)s[i]) != (unsigned char)m->needle[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Function:  find_scalar_from
+ * ---------------------------
+ * @brief  Looks for the name in positions [start, n - len] of a string.
+ *
+ * Without case folding, memchr() skips to each occurrence of the first byte.
+ *
+ * @param m The matcher.
+ * @param s The string.
+ * @param n The length of the string.
+ * @param start The first position to try.
+ *
+ * @return const char* The first match, or NULL if there is none.
+ *
+ */
+static const char *find_scalar_from(const matcher_t *m, const char *s, size_t n, size_t start)
+{
+    if (n < m->len)
+    {
+        return NULL;
+    }
+    const char *end = s + (n - m->len) + 1;
+    const char *p = s + start;
+
+    if (!m->ignore_case)
+    {
+        while (p < end && (p = memchr(p, m->first, (size_t)(end - p))) != NULL)
+        {
+            if ((unsigned char)p[m->len - 1] == m->last && verify(m, p))
+            {
+                return p;
+            }
+            p++;
+        }
+        return NULL;
+    }
+    for (; p < end; p++)
+    {
+        if (fold((unsigned char)*p) == m->first && fold((unsigned char)p[m->len - 1]) == m->last && verify(m, p))
+        {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static const char *find_scalar(const matcher_t *m, const char *s, size_t n)
+{
+    return find_scalar_from(m, s, n, 0);
+}
+
+static find_fn find = find_scalar;
+static const char *kernel_name = "scalar";
+
+#ifdef MATCH_X86
+
+__attribute__((target("avx2")))
+static const char *find_avx2(const matcher_t *m, const char *s, size_t n)
+{
+    const __m256i first = _mm256_set1_epi8((char)m->first);
+    const __m256i last = _mm256_set1_epi8((char)m->last);
+    const __m256i first_fold = _mm256_set1_epi8((char)m->first_fold);
+    const __m256i last_fold = _mm256_set1_epi8((char)m->last_fold);
+    size_t i = 0;
+
+    // Both loads must stay inside the string, so stop 32 bytes before the last place the name fits
+    for (; m->len <= n && i + m->len - 1 + 32 <= n; i += 32)
+    {
+        __m256i head = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(s + i)), first_fold);
+        __m256i tail = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(s + i + m->len - 1)), last_fold);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+
+        while (mask != 0)
+        {
+            const char *p = s + i + (size_t)__builtin_ctz(mask);
+            if (verify(m, p))
+            {
+                return p;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar_from(m, s, n, i);
+}
+
+__attribute__((target("sse2")))
+static const char *find_sse2(const matcher_t *m, const char *s, size_t n)
+{
+    const __m128i first = _mm_set1_epi8((char)m->first);
+    const __m128i last = _mm_set1_epi8((char)m->last);
+    const __m128i first_fold = _mm_set1_epi8((char)m->first_fold);
+    const __m128i last_fold = _mm_set1_epi8((char)m->last_fold);
+    size_t i = 0;
+
+    for (; m->len <= n && i + m->len - 1 + 16 <= n; i += 16)
+    {
+        __m128i head = _mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i)), first_fold);
+        __m128i tail = _mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i + m->len - 1)), last_fold);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+
+        while (mask != 0)
+        {
+            const char *p = s + i + (size_t)__builtin_ctz(mask);
+            if (verify(m, p))
+            {
+                return p;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return find_scalar_from(m, s, n, i);
+}
+
+/**
+ * Function:  select_kernel
+ * ------------------------
+ * @brief  Picks the widest kernel the CPU supports. Runs before main().
+ *
+ */
+__attribute__((constructor))
+static void select_kernel(void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        find = find_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        find = find_sse2;
+        kernel_name = "sse2";
+    }
+}
+
+#endif
+
+/**
+ * Function:  matcher_init
+ * -----------------------
+ * @brief  Compiles a name into a matcher.
+ *
+ * @param m The matcher to be initialized.
+ * @param needle The searched name.
+ * @param ignore_case Whether ASCII letters match regardless of case.
+ *
+ */
+void matcher_init(matcher_t *m, const char *needle, bool ignore_case)
+{
+    m->len = strlen(needle);
+    m->needle = (char *)emalloc(m->len + 1);
+    m->ignore_case = ignore_case;
+    for (size_t i = 0; i <= m->len; i++)
+    {
+        m->needle[i] = ignore_case ? (char)fold((unsigned char)needle[i]) : needle[i];
+    }
+
+    m->first = m->len > 0 ? (unsigned char)m->needle[0] : 0;
+    m->last = m->len > 0 ? (unsigned char)m->needle[m->len - 1] : 0;
+    // With case ignored, a letter is compared with its 0x20 bit forced on
+    m->first_fold = ignore_case && (unsigned)(m->first - 'a') < 26u ? 0x20 : 0;
+    m->last_fold = ignore_case && (unsigned)(m->last - 'a') < 26u ? 0x20 : 0;
+}
+
+/**
+ * Function:  matcher_find
+ * -----------------------
+ * @brief  Tells whether the name occurs in a string.
+ *
+ * @param m The matcher.
+ * @param haystack The NUL-terminated string to be searched.
+ *
+ * @return bool Whether the name occurs, as strstr(haystack, name) != NULL.
+ *
+ */
+bool matcher_find(const matcher_t *m, const char *haystack)
+{
+    if (m->len == 0)
+    {
+        return true;
+    }
+    return find(m, haystack, strlen(haystack)) != NULL;
+}
+
+/**
+ * Function:  matcher_find_n
+ * -------------------------
+ * @brief  Tells whether the name occurs in the first n bytes of a string.
+ *
+ * @param m The matcher.
+ * @param haystack The string to be searched; it need not be terminated.
+ * @param n The length of the string.
+ *
+ * @return bool Whether the name occurs.
+ *
+ */
+bool matcher_find_n(const matcher_t *m, const char *haystack, size_t n)
+{
+    return m->len == 0 || find(m, haystack, n) != NULL;
+}
+
+/**
+ * Function:  matcher_free
+ * -----------------------
+ * @brief  Releases the copy of the name held by a matcher.
+ *
+ * @param m The matcher.
+ *
+ */
+void matcher_free(matcher_t *m)
+{
+    free(m->needle);
+    m->needle = NULL;
+}
+
+/**
+ * Function:  matcher_kernel_name
+ * ------------------------------
+ * @brief  Names the instruction set the matcher runs on.
+ *
+ * @return const char* "avx2", "sse2" or "scalar".
+ *
+ */
+const char *matcher_kernel_name(void)
+{
+    return kernel_name;
+}
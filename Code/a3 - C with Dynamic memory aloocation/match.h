@@ -0,0 +1,35 @@
+/** @file match.h
+ *  @brief Function prototypes for the precompiled substring matcher.
+ *
+ *  A matcher is built once per query from the searched name and then
+ *  tested against every artist. It looks for places where both the first
+ *  and the last byte of the name line up, a whole register of positions at
+ *  a time, and only compares the full name at those places. Matching can
+ *  ignore the case of ASCII letters.
+ */
+#ifndef _MATCH_H_
+#define _MATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct {
+    char *needle;
+    size_t len;
+    bool ignore_case;
+    unsigned char first;
+    unsigned char last;
+    unsigned char first_fold;
+    unsigned char last_fold;
+} matcher_t;
+
+/**
+ * Function protypes associated with the substring matcher.
+ */
+void matcher_init(matcher_t *, const char *needle, bool ignore_case);
+bool matcher_find(const matcher_t *, const char *haystack);
+bool matcher_find_n(const matcher_t *, const char *haystack, size_t n);
+void matcher_free(matcher_t *);
+const char *matcher_kernel_name(void);
+
+#endif
@@ -0,0 +1,798 @@
+/** @file pipeline.c
+ *  @brief Implementation of the pipelined file reader.
+ *
+ * There are exactly PIPELINE_BUFFERS buffers, each either waiting in one
+ * of the two rings, being read into, or held by the caller, so a ring of
+ * as many slots is never full and only taking from an empty one has to
+ * wait. The rings themselves are lock-free: the producer only moves the
+ * tail and the consumer only the head. A thread that finds its ring empty
+ * counts itself as a sleeper and waits on a condition variable, and the
+ * other side only takes the lock to wake it when it sees a sleeper.
+ *
+ * Each buffer is PIPELINE_HEADROOM bytes of room followed by the block
+ * the file is read into, both aligned to PIPELINE_ALIGN; under a memory
+ * budget both shrink in proportion, the headroom being a quarter of the
+ * buffer at most. The partial row
+ * at the end of one block is copied into the headroom of the next, so
+ * the rows that cross a block boundary cost a short copy and nothing
+ * else; a row longer than the headroom is put together in a scratch
+ * buffer instead. A newline ends a row only outside quotes, and since
+ * every block handed over starts a row, the quotes before a newline in
+ * the block tell whether it is one.
+ *
+ * With io_uring, a read is queued for every free buffer at once, and the
+ * blocks are handed over in file order as they complete; without it (or
+ * if the kernel refuses the first read) the thread reads one block at a
+ * time with pread(), and the kernel's readahead keeps the disk busy. The
+ * first read, which tells whether io_uring works, is not wasted: its block
+ * is the first one handed over.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "pipeline.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define PIPELINE_URING 1
+#endif
+#endif
+#endif
+
+typedef struct {
+    char *data;
+    size_t len;
+    uint64_t offset;
+    uint64_t seq;
+    bool last;
+    int error;
+} pipeline_buffer;
+
+typedef struct {
+    pipeline_buffer *slots[PIPELINE_BUFFERS];
+    size_t head;
+    size_t tail;
+    int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} spsc_ring;
+
+#ifdef PIPELINE_URING
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+#endif
+
+struct csv_pipeline {
+    int fd;
+    uint64_t size;
+    size_t block;
+    size_t headroom;
+    char *memory;
+    pipeline_buffer buffers[PIPELINE_BUFFERS];
+    spsc_ring full;
+    spsc_ring free;
+    bool stop;
+    pipeline_buffer *held;
+    const char *carry;
+    size_t carry_len;
+    char *scratch;
+    size_t scratch_cap;
+    bool done;
+    int error;
+    bool uring;
+#ifdef PIPELINE_URING
+    uring ring;
+#endif
+    pthread_t worker;
+};
+
+static void ring_init(spsc_ring *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->sleepers = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->wake, NULL);
+}
+
+static void ring_destroy(spsc_ring *ring)
+{
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->wake);
+}
+
+// Wakes whoever sleeps on a ring
+static void ring_wake(spsc_ring *ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->wake);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+// Adds a buffer to a ring, which always has room for it; called by the producer only
+static void ring_put(spsc_ring *ring, pipeline_buffer *buffer)
+{
+    size_t tail = ring->tail;
+
+    ring->slots[tail % PIPELINE_BUFFERS] = buffer;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    // Pairs with the fence in ring_take(): either the sleeper sees the buffer or this sees the sleeper
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->sleepers, __ATOMIC_RELAXED) > 0)
+    {
+        ring_wake(ring);
+    }
+}
+
+// Takes the oldest buffer of a ring, or NULL if it is empty; called by the consumer only
+static pipeline_buffer *ring_poll(spsc_ring *ring)
+{
+    size_t head = ring->head;
+    pipeline_buffer *buffer;
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+    {
+        return NULL;
+    }
+    buffer = ring->slots[head % PIPELINE_BUFFERS];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return buffer;
+}
+
+// Takes the oldest buffer of a ring, waiting for one; NULL once *stop is set, if stop is given
+static pipeline_buffer *ring_take(spsc_ring *ring, const bool *stop)
+{
+    pipeline_buffer *buffer;
+
+    while ((buffer = ring_poll(ring)) == NULL)
+    {
+        pthread_mutex_lock(&ring->lock);
+        __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+               (stop == NULL || !__atomic_load_n(stop, __ATOMIC_ACQUIRE)))
+        {
+            pthread_cond_wait(&ring->wake, &ring->lock);
+        }
+        __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&ring->lock);
+        if (stop != NULL && __atomic_load_n(stop, __ATOMIC_ACQUIRE))
+        {
+            return NULL;
+        }
+    }
+    return buffer;
+}
+
+// Reads up to len bytes at an offset, stopping early only at the end of the file
+static ssize_t read_fully(int fd, char *data, size_t len, uint64_t offset)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = pread(fd, data + done, len - done, (off_t)(offset + done));
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0)
+        {
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+// Prepares a free buffer to be read into from the next offset of the file
+static void start_block(csv_pipeline *pipeline, pipeline_buffer *buffer, uint64_t offset, uint64_t seq)
+{
+    uint64_t left = pipeline->size - offset;
+
+    buffer->offset = offset;
+    buffer->seq = seq;
+    buffer->len = left < pipeline->block ? (size_t)left : pipeline->block;
+    buffer->last = offset + buffer->len >= pipeline->size;
+    buffer->error = 0;
+}
+
+// Completes a block of which done bytes were read (or that failed, if done is negative) with pread()
+static void finish_block(csv_pipeline *pipeline, pipeline_buffer *buffer, ssize_t done)
+{
+    ssize_t n;
+
+    if (done < 0)
+    {
+        done = 0;
+    }
+    if ((size_t)done == buffer->len)
+    {
+        return;
+    }
+    n = read_fully(pipeline->fd, buffer->data + done, buffer->len - (size_t)done, buffer->offset + (uint64_t)done);
+    if (n < 0)
+    {
+        buffer->error = errno;
+        buffer->len = 0;
+        buffer->last = true;
+    }
+    else if ((size_t)(done + n) < buffer->len)
+    {
+        // The file got shorter since it was opened
+        buffer->len = (size_t)(done + n);
+        buffer->last = true;
+    }
+}
+
+// Reads the file a block at a time with pread()
+static void read_blocks(csv_pipeline *pipeline)
+{
+    uint64_t offset = 0;
+    uint64_t seq = 0;
+    pipeline_buffer *buffer;
+
+    do
+    {
+        buffer = ring_take(&pipeline->free, &pipeline->stop);
+        if (buffer == NULL)
+        {
+            return;
+        }
+        start_block(pipeline, buffer, offset, seq++);
+        finish_block(pipeline, buffer, 0);
+        offset += buffer->len;
+        ring_put(&pipeline->full, buffer);
+    } while (!buffer->last);
+}
+
+#ifdef PIPELINE_URING
+
+/**
+ * Function:  uring_init
+ * ---------------------
+ * @brief  Sets up an io_uring instance and maps its rings.
+ *
+ * @param ring The ring to be set up.
+ * @param entries The number of reads that may be queued at once.
+ *
+ * @return int 0 on success, -1 if the kernel does not offer io_uring.
+ *
+ */
+static int uring_init(uring *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+    {
+        return -1;
+    }
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        // Both rings share one mapping
+        if (ring->cq_ring_size > ring->sq_ring_size)
+        {
+            ring->sq_ring_size = ring->cq_ring_size;
+        }
+        ring->cq_ring_size = 0;
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    ring->cq_ring = ring->cq_ring_size == 0 ? ring->sq_ring
+                    : mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                           IORING_OFF_CQ_RING);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                             ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || (void *)ring->sqes == MAP_FAILED)
+    {
+        if (ring->sq_ring != MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+        }
+        if (ring->cq_ring_size > 0 && ring->cq_ring != MAP_FAILED)
+        {
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        }
+        if ((void *)ring->sqes != MAP_FAILED)
+        {
+            munmap(ring->sqes, ring->sqes_size);
+        }
+        close(ring->fd);
+        return -1;
+    }
+
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_free(uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size > 0)
+    {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Queues a read of a buffer's block, to be submitted by uring_enter()
+static void uring_read(uring *ring, int fd, const pipeline_buffer *buffer, uint64_t id)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buffer->data;
+    sqe->len = (unsigned)buffer->len;
+    sqe->off = buffer->offset;
+    sqe->user_data = id;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Submits the queued reads and waits until at least wait of them complete
+static int uring_enter(uring *ring, unsigned submit, unsigned wait)
+{
+    for (;;)
+    {
+        long n = syscall(__NR_io_uring_enter, ring->fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+        if (n >= 0)
+        {
+            return 0;
+        }
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+        // Whatever was submitted before the signal stays submitted
+        submit = 0;
+    }
+}
+
+// Takes a completed read, if there is one
+static bool uring_reap(uring *ring, uint64_t *id, int *result)
+{
+    unsigned head = *ring->cq_head;
+    const struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    cqe = &ring->cqes[head & *ring->cq_mask];
+    *id = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Tells whether the kernel reads a file through io_uring, by reading its first block into the first buffer that way
+static bool uring_works(csv_pipeline *pipeline)
+{
+    pipeline_buffer *buffer = &pipeline->buffers[0];
+    uint64_t id;
+    int result;
+
+    start_block(pipeline, buffer, 0, 0);
+    uring_read(&pipeline->ring, pipeline->fd, buffer, 0);
+    if (uring_enter(&pipeline->ring, 1, 1) != 0 || !uring_reap(&pipeline->ring, &id, &result) || result < 0)
+    {
+        return false;
+    }
+    finish_block(pipeline, buffer, result);
+    return true;
+}
+
+// Reads the file with a read queued for every free buffer, handing the blocks over in file order after the first one
+static void read_blocks_uring(csv_pipeline *pipeline)
+{
+    pipeline_buffer *done[PIPELINE_BUFFERS] = {NULL};
+    pipeline_buffer *newest = NULL;
+    // uring_works() read the first block, and it is already with the caller
+    uint64_t offset = pipeline->buffers[0].len;
+    uint64_t queued = 1;
+    uint64_t handed = 1;
+    unsigned in_flight = 0;
+    bool finished = pipeline->buffers[0].last;
+
+    while (!finished)
+    {
+        unsigned batch = 0;
+        pipeline_buffer *buffer;
+        uint64_t id;
+        int result;
+
+        // Wait for a free buffer only when no read is left to wait for instead
+        while (offset < pipeline->size &&
+               (buffer = in_flight + batch == 0 ? ring_take(&pipeline->free, &pipeline->stop)
+                                                : ring_poll(&pipeline->free)) != NULL)
+        {
+            start_block(pipeline, buffer, offset, queued++);
+            uring_read(&pipeline->ring, pipeline->fd, buffer, (uint64_t)(buffer - pipeline->buffers));
+            offset += buffer->len;
+            newest = buffer;
+            batch++;
+        }
+        if (in_flight + batch == 0)
+        {
+            return;
+        }
+        if (uring_enter(&pipeline->ring, batch, 1) != 0)
+        {
+            // Hand the failure over on a block that is not with the caller; the newest one never is
+            int error = errno;
+
+            buffer = newest;
+            for (int i = 0; i < PIPELINE_BUFFERS; i++)
+            {
+                if (done[i] != NULL)
+                {
+                    buffer = done[i];
+                }
+            }
+            buffer->error = error;
+            buffer->len = 0;
+            buffer->last = true;
+            ring_put(&pipeline->full, buffer);
+            return;
+        }
+        in_flight += batch;
+
+        while (uring_reap(&pipeline->ring, &id, &result))
+        {
+            buffer = &pipeline->buffers[id];
+            in_flight--;
+            finish_block(pipeline, buffer, result);
+            done[buffer->seq % PIPELINE_BUFFERS] = buffer;
+        }
+        while ((buffer = done[handed % PIPELINE_BUFFERS]) != NULL && buffer->seq == handed && !finished)
+        {
+            done[handed % PIPELINE_BUFFERS] = NULL;
+            handed++;
+            finished = buffer->last;
+            ring_put(&pipeline->full, buffer);
+        }
+    }
+    // A failed or shortened block may end the file before the reads queued after it complete
+    while (in_flight > 0 && uring_enter(&pipeline->ring, 0, 1) == 0)
+    {
+        uint64_t id;
+        int result;
+
+        while (uring_reap(&pipeline->ring, &id, &result))
+        {
+            in_flight--;
+        }
+    }
+}
+
+#endif
+
+// Body of the reader thread
+static void *read_file(void *arg)
+{
+    csv_pipeline *pipeline = (csv_pipeline *)arg;
+
+#ifdef PIPELINE_URING
+    if (pipeline->uring)
+    {
+        read_blocks_uring(pipeline);
+        return NULL;
+    }
+#endif
+    read_blocks(pipeline);
+    return NULL;
+}
+
+/**
+ * Function:  pipeline_open
+ * ------------------------
+ * @brief  Opens a file and starts reading it on a thread of its own.
+ *
+ * @param filename The path of the file.
+ * @param memory The most the buffers may take, or 0 for PIPELINE_BUFFERS
+ *        buffers of PIPELINE_HEADROOM and PIPELINE_BLOCK bytes.
+ *
+ * @return csv_pipeline* The pipeline, or NULL with errno set if the file
+ *         could not be opened or the thread could not be started.
+ *
+ */
+csv_pipeline *pipeline_open(const char *filename, size_t memory)
+{
+    csv_pipeline *pipeline;
+    struct stat st;
+    size_t stride = PIPELINE_HEADROOM + PIPELINE_BLOCK;
+    size_t headroom = PIPELINE_HEADROOM;
+    int fd = open(filename, O_RDONLY);
+    int error;
+
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        error = errno;
+        close(fd);
+        errno = error;
+        return NULL;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (memory > 0 && memory < PIPELINE_BUFFERS * stride + PIPELINE_ALIGN)
+    {
+        // The alignment slack counts against the budget too
+        stride = memory > PIPELINE_ALIGN ? (memory - PIPELINE_ALIGN) / PIPELINE_BUFFERS : 0;
+        stride &= ~(size_t)(PIPELINE_ALIGN - 1);
+        stride = stride < 2 * PIPELINE_ALIGN ? 2 * PIPELINE_ALIGN : stride;
+        headroom = (stride / 4) & ~(size_t)(PIPELINE_ALIGN - 1);
+        headroom = headroom < PIPELINE_ALIGN ? PIPELINE_ALIGN : headroom;
+    }
+
+    pipeline = (csv_pipeline *)emalloc(sizeof(csv_pipeline));
+    memset(pipeline, 0, sizeof(*pipeline));
+    pipeline->fd = fd;
+    pipeline->size = (uint64_t)st.st_size;
+    pipeline->block = stride - headroom;
+    pipeline->headroom = headroom;
+    // One allocation for every buffer, so that each block starts on an aligned address
+    pipeline->memory = (char *)emalloc(PIPELINE_BUFFERS * stride + PIPELINE_ALIGN);
+    char *base = (char *)(((uintptr_t)pipeline->memory + PIPELINE_ALIGN - 1) & ~(uintptr_t)(PIPELINE_ALIGN - 1));
+    ring_init(&pipeline->full);
+    ring_init(&pipeline->free);
+    for (int i = 0; i < PIPELINE_BUFFERS; i++)
+    {
+        pipeline->buffers[i].data = base + (size_t)i * stride + headroom;
+    }
+
+#ifdef PIPELINE_URING
+    if (pipeline->size > 0 && uring_init(&pipeline->ring, PIPELINE_BUFFERS) == 0)
+    {
+        pipeline->uring = uring_works(pipeline);
+        if (!pipeline->uring)
+        {
+            uring_free(&pipeline->ring);
+        }
+    }
+    if (pipeline->uring)
+    {
+        ring_put(&pipeline->full, &pipeline->buffers[0]);
+    }
+#endif
+    for (int i = pipeline->uring ? 1 : 0; i < PIPELINE_BUFFERS; i++)
+    {
+        ring_put(&pipeline->free, &pipeline->buffers[i]);
+    }
+
+    error = pthread_create(&pipeline->worker, NULL, read_file, pipeline);
+    if (error != 0)
+    {
+        pipeline->worker = pthread_self();
+        pipeline_close(pipeline);
+        errno = error;
+        return NULL;
+    }
+    return pipeline;
+}
+
+// Length of the whole rows at the start of bytes that begin a row: up to the last newline outside quotes
+static size_t whole_rows(const char *data, size_t n)
+{
+    const char *end = data + n;
+    const char *newline;
+    size_t quotes = 0;
+
+    for (const char *p = data; (p = memchr(p, '"', (size_t)(end - p))) != NULL; p++)
+    {
+        quotes++;
+    }
+    while ((newline = memrchr(data, '\n', (size_t)(end - data))) != NULL)
+    {
+        for (const char *p = newline + 1; (p = memchr(p, '"', (size_t)(end - p))) != NULL; p++)
+        {
+            quotes--;
+        }
+        if (quotes % 2 == 0)
+        {
+            return (size_t)(newline - data) + 1;
+        }
+        end = newline;
+    }
+    return 0;
+}
+
+// Puts the carried partial row in front of a block, returning where the joined bytes start
+static const char *join_carry(csv_pipeline *pipeline, pipeline_buffer *buffer, size_t *n)
+{
+    size_t carry = pipeline->carry_len;
+
+    *n = buffer->len + carry;
+    if (carry == 0)
+    {
+        return buffer->data;
+    }
+    if (carry <= pipeline->headroom)
+    {
+        memcpy(buffer->data - carry, pipeline->carry, carry);
+        return buffer->data - carry;
+    }
+
+    // A row longer than the headroom: the block is copied after it in the scratch buffer
+    size_t skip = pipeline->carry >= pipeline->scratch && pipeline->carry < pipeline->scratch + pipeline->scratch_cap
+                  ? (size_t)(pipeline->carry - pipeline->scratch) : SIZE_MAX;
+    if (*n > pipeline->scratch_cap)
+    {
+        if (skip == SIZE_MAX)
+        {
+            free(pipeline->scratch);
+            pipeline->scratch = NULL;
+        }
+        pipeline->scratch_cap = *n * 2;
+        pipeline->scratch = (char *)erealloc(pipeline->scratch, pipeline->scratch_cap);
+    }
+    if (skip == SIZE_MAX)
+    {
+        memcpy(pipeline->scratch, pipeline->carry, carry);
+    }
+    else
+    {
+        memmove(pipeline->scratch, pipeline->scratch + skip, carry);
+    }
+    memcpy(pipeline->scratch + carry, buffer->data, buffer->len);
+    return pipeline->scratch;
+}
+
+/**
+ * Function:  pipeline_next
+ * ------------------------
+ * @brief  Returns the next run of whole rows of the file.
+ *
+ * The rows stay valid until the next call, which gives their buffer back
+ * to the reader thread.
+ *
+ * @param pipeline The pipeline.
+ * @param data Receives the first byte of the rows.
+ * @param size Receives the length of the rows.
+ *
+ * @return bool False at the end of the file, or if it could not be read
+ *         (see pipeline_error()).
+ *
+ */
+bool pipeline_next(csv_pipeline *pipeline, const char **data, size_t *size)
+{
+    while (!pipeline->done)
+    {
+        pipeline_buffer *buffer = ring_take(&pipeline->full, NULL);
+        const char *start;
+        size_t n;
+        size_t rows;
+
+        if (buffer->error != 0)
+        {
+            pipeline->error = buffer->error;
+            pipeline->done = true;
+            ring_put(&pipeline->free, buffer);
+            return false;
+        }
+        // Before the buffer can go back to the reader thread
+        pipeline->done = buffer->last;
+        start = join_carry(pipeline, buffer, &n);
+        // The carried row has been copied out of the buffer that held it
+        if (pipeline->held != NULL)
+        {
+            ring_put(&pipeline->free, pipeline->held);
+            pipeline->held = NULL;
+        }
+        if (start == pipeline->scratch)
+        {
+            ring_put(&pipeline->free, buffer);
+        }
+        else
+        {
+            pipeline->held = buffer;
+        }
+
+        // The last row of the file needs no newline
+        rows = pipeline->done ? n : whole_rows(start, n);
+        pipeline->carry = start + rows;
+        pipeline->carry_len = n - rows;
+        if (rows > 0)
+        {
+            *data = start;
+            *size = rows;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Function:  pipeline_error
+ * -------------------------
+ * @brief  Tells why pipeline_next() stopped early.
+ *
+ * @param pipeline The pipeline.
+ *
+ * @return int The errno of the read that failed, or 0 if none did.
+ *
+ */
+int pipeline_error(const csv_pipeline *pipeline)
+{
+    return pipeline->error;
+}
+
+/**
+ * Function:  pipeline_close
+ * -------------------------
+ * @brief  Stops the reader thread and releases the pipeline.
+ *
+ * @param pipeline The pipeline.
+ *
+ */
+void pipeline_close(csv_pipeline *pipeline)
+{
+    __atomic_store_n(&pipeline->stop, true, __ATOMIC_RELEASE);
+    ring_wake(&pipeline->free);
+    if (!pthread_equal(pipeline->worker, pthread_self()))
+    {
+        pthread_join(pipeline->worker, NULL);
+    }
+#ifdef PIPELINE_URING
+    if (pipeline->uring)
+    {
+        uring_free(&pipeline->ring);
+    }
+#endif
+    ring_destroy(&pipeline->full);
+    ring_destroy(&pipeline->free);
+    close(pipeline->fd);
+    free(pipeline->scratch);
+    free(pipeline->memory);
+    free(pipeline);
+}
@@ -0,0 +1,37 @@
+/** @file pipeline.h
+ *  @brief Function prototypes for the pipelined file reader.
+ *
+ *  A pipeline reads a file front to back on a thread of its own while the
+ *  caller parses what was already read, so the disk and the parser are
+ *  busy at the same time. The reader thread fills a pool of recycled
+ *  buffers with aligned reads of PIPELINE_BLOCK bytes, through io_uring
+ *  when the kernel offers it and with pread() otherwise, and hands them
+ *  over in file order through a lock-free single-producer,
+ *  single-consumer ring; the caller gives each one back through a second
+ *  ring once it has parsed it. The caller only ever sees whole rows: the
+ *  partial row at the end of a block is carried over to the front of the
+ *  next one. A caller with a memory budget can have the buffers shrunk to
+ *  fit it, down to PIPELINE_ALIGN bytes of headroom and of block each.
+ */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PIPELINE_BLOCK (1024 * 1024)
+#define PIPELINE_BUFFERS 8
+#define PIPELINE_HEADROOM (64 * 1024)
+#define PIPELINE_ALIGN 4096
+
+typedef struct csv_pipeline csv_pipeline;
+
+/**
+ * Function protypes associated with the pipelined reader.
+ */
+csv_pipeline *pipeline_open(const char *filename, size_t memory);
+bool pipeline_next(csv_pipeline *, const char **data, size_t *size);
+int pipeline_error(const csv_pipeline *);
+void pipeline_close(csv_pipeline *);
+
+#endif
@@ -0,0 +1,171 @@
+/** @file radix.c
+ *  @brief Implementation of the radix sort of ranked entries.
+ *
+ * Each pass sorts on one byte of the key: every part counts how many of
+ * its entries fall in each of the 256 buckets, the counts are turned into
+ * the first free position of every part in every bucket (buckets in
+ * order, and within a bucket the parts in order, which keeps the sort
+ * stable), and every part then moves its entries to their positions in a
+ * second array. The two arrays swap roles after each pass. A pass in
+ * which every key has the same byte would move nothing and is skipped,
+ * so small keys stored in a wide field cost no more than narrow ones.
+ *
+ * Keys are compared as signed numbers by flipping their top bit. Callers
+ * that want a descending order store complemented keys, as topk_offer()
+ * does, and sort them ascending.
+ *
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "radix.h"
+
+#define RADIX_BUCKETS 256
+// Inputs smaller than this are sorted on the calling thread alone
+#define RADIX_PARALLEL_MIN (64 * 1024)
+
+typedef struct {
+    const topk_entry *src;
+    topk_entry *dst;
+    size_t start;
+    size_t end;
+    uint64_t sign;
+    unsigned shift;
+    size_t counts[RADIX_BUCKETS];
+    pthread_t worker;
+    bool started;
+} radix_part;
+
+// Returns the byte of the key a pass sorts on, with the sign bit flipped
+static inline unsigned key_digit(const topk_entry *entry, uint64_t sign, unsigned shift)
+{
+    return (unsigned)((((uint64_t)entry->key ^ sign) >> shift) & (RADIX_BUCKETS - 1));
+}
+
+// Counts the entries of a part that fall in each bucket
+static void *count_part(void *arg)
+{
+    radix_part *part = (radix_part *)arg;
+
+    memset(part->counts, 0, sizeof(part->counts));
+    for (size_t i = part->start; i < part->end; i++)
+    {
+        part->counts[key_digit(&part->src[i], part->sign, part->shift)]++;
+    }
+    return NULL;
+}
+
+// Moves the entries of a part to the positions its counts now hold
+static void *scatter_part(void *arg)
+{
+    radix_part *part = (radix_part *)arg;
+
+    for (size_t i = part->start; i < part->end; i++)
+    {
+        part->dst[part->counts[key_digit(&part->src[i], part->sign, part->shift)]++] = part->src[i];
+    }
+    return NULL;
+}
+
+// Runs fn on every part, the first on this thread and the others on threads of their own where possible
+static void run_parts(radix_part *parts, int n, void *(*fn)(void *))
+{
+    for (int i = 1; i < n; i++)
+    {
+        parts[i].started = pthread_create(&parts[i].worker, NULL, fn, &parts[i]) == 0;
+    }
+    fn(&parts[0]);
+    for (int i = 1; i < n; i++)
+    {
+        if (parts[i].started)
+        {
+            pthread_join(parts[i].worker, NULL);
+        }
+        else
+        {
+            fn(&parts[i]);
+        }
+    }
+}
+
+/**
+ * Function:  radix_sort
+ * ---------------------
+ * @brief  Sorts entries on their key, smallest first, keeping equal keys in order.
+ *
+ * @param entries The entries to be sorted in place.
+ * @param n The number of entries.
+ * @param key_bytes The number of low bytes of the key that vary: RADIX_KEY32
+ *        when every key fits in an int32_t, RADIX_KEY64 otherwise.
+ * @param threads The number of threads to sort with.
+ *
+ */
+void radix_sort(topk_entry *entries, size_t n, size_t key_bytes, int threads)
+{
+    topk_entry *scratch;
+    topk_entry *src = entries;
+    topk_entry *dst;
+    radix_part *parts;
+
+    if (n < 2 || key_bytes == 0)
+    {
+        return;
+    }
+    if (threads < 1 || n < RADIX_PARALLEL_MIN)
+    {
+        threads = 1;
+    }
+
+    scratch = (topk_entry *)emalloc(n * sizeof(topk_entry));
+    parts = (radix_part *)emalloc((size_t)threads * sizeof(radix_part));
+    dst = scratch;
+
+    for (unsigned shift = 0; shift < 8 * key_bytes; shift += 8)
+    {
+        bool trivial = false;
+        size_t next = 0;
+
+        for (int i = 0; i < threads; i++)
+        {
+            parts[i].src = src;
+            parts[i].dst = dst;
+            parts[i].start = n * (size_t)i / (size_t)threads;
+            parts[i].end = n * (size_t)(i + 1) / (size_t)threads;
+            parts[i].sign = (uint64_t)1 << (8 * key_bytes - 1);
+            parts[i].shift = shift;
+        }
+        run_parts(parts, threads, count_part);
+
+        for (unsigned d = 0; d < RADIX_BUCKETS; d++)
+        {
+            size_t total = 0;
+            for (int i = 0; i < threads; i++)
+            {
+                size_t count = parts[i].counts[d];
+                parts[i].counts[d] = next + total;
+                total += count;
+            }
+            trivial = trivial || total == n;
+            next += total;
+        }
+        if (trivial)
+        {
+            continue;
+        }
+
+        run_parts(parts, threads, scatter_part);
+        topk_entry *temp = src;
+        src = dst;
+        dst = temp;
+    }
+
+    if (src != entries)
+    {
+        memcpy(entries, src, n * sizeof(topk_entry));
+    }
+    free(parts);
+    free(scratch);
+}
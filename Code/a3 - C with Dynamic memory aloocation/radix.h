@@ -0,0 +1,25 @@
+/** @file radix.h
+ *  @brief Function prototypes for the radix sort of ranked entries.
+ *
+ *  Entries are sorted on their integer key one byte at a time, starting
+ *  with the least significant byte, so sorting N entries takes a fixed
+ *  number of linear passes instead of N log N comparisons. The sort is
+ *  stable: entries with equal keys keep the order they were given in.
+ *  Large inputs are split between threads, each counting and moving its
+ *  own share of every pass.
+ */
+#ifndef _RADIX_H_
+#define _RADIX_H_
+
+#include <stddef.h>
+#include "topk.h"
+
+#define RADIX_KEY32 4
+#define RADIX_KEY64 8
+
+/**
+ * Function protypes associated with the radix sort.
+ */
+void radix_sort(topk_entry *entries, size_t n, size_t key_bytes, int threads);
+
+#endif
@@ -0,0 +1,461 @@
+/** @file scan.c
+ *  @brief Implementation of the parallel filter-and-rank scan.
+ *
+ * Each thread keeps at most limit rows of its range, so the merge reads at
+ * most threads * limit entries. Entries are compared with topk_compare(),
+ * which breaks ties on the row number, so the merged ordering is the one a
+ * single thread would have produced, whatever the number of threads.
+ * Row 0 holds the header line of the file and is never selected.
+ *
+ * Without a limit the parts are not ranked at all: their rows are joined
+ * in row order and radix sorted once, on every thread.
+ *
+ * Each part times its own filter with the clock of its thread. The scan
+ * then reports the sum of their CPU times and the longest of their wall
+ * times as the filter stage, and the rest of its time as the sort stage.
+ *
+ * A batch of queries shares one scan: every thread walks its range a
+ * block of rows at a time and runs each query on the block while it is
+ * still in cache, ranking the matches of every query on its own. The
+ * parts of each query are then joined as for a single one. Only the
+ * selection of each block is timed as the filter, so ranking the
+ * matches counts toward the sort stage as it does for a single query.
+ *
+ */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "scan.h"
+
+// Rows each query of a batch selects from before the next one runs
+#define SCAN_BATCH_BLOCK 16384
+
+typedef struct {
+    const song_table *table;
+    scan_select_fn select;
+    const void *arg;
+    size_t start;
+    size_t end;
+    topk_t ranking;
+    const topk_entry *ranked;
+    size_t count;
+    size_t cursor;
+    size_t matches;
+    stage_stats filter;
+    pthread_t worker;
+    bool started;
+} scan_part;
+
+typedef struct {
+    scan_part *parts;
+    size_t queries;
+    int threads;
+    stage_stats filter;
+    pthread_t worker;
+    bool started;
+} batch_range;
+
+// Prepares the i-th of the parts a query is split into
+static void init_part(scan_part *part, const song_table *table, scan_select_fn select, const void *arg,
+                      const sort_spec *spec, int limit, int i, int threads)
+{
+    size_t rows = table->rows > 0 ? table->rows - 1 : 0;
+
+    part->table = table;
+    part->select = select;
+    part->arg = arg;
+    part->start = 1 + rows * (size_t)i / (size_t)threads;
+    part->end = 1 + rows * (size_t)(i + 1) / (size_t)threads;
+    part->cursor = 0;
+    part->matches = 0;
+    memset(&part->filter, 0, sizeof(part->filter));
+    topk_init(&part->ranking, table, spec, limit);
+}
+
+// Ranks the rows a part has been offered
+static void finish_part(scan_part *part)
+{
+    if (part->ranking.limit > 0)
+    {
+        part->ranked = topk_finish(&part->ranking, &part->count);
+    }
+    else
+    {
+        // Sorted together with the other parts once they are joined
+        part->ranked = part->ranking.entries;
+        part->count = part->ranking.count;
+    }
+}
+
+// Selects and ranks the rows of one part
+static void *scan_part_run(void *arg)
+{
+    scan_part *part = (scan_part *)arg;
+    uint32_t *selection;
+    size_t matches;
+    stats_clock clock;
+
+    stats_start_thread(&clock);
+    // One slot more, so that an empty part still gets a block from emalloc()
+    selection = (uint32_t *)emalloc((part->end - part->start + 1) * sizeof(uint32_t));
+    matches = part->select(part->table, part->start, part->end, selection, part->arg);
+    stats_stop(&clock, &part->filter);
+    part->matches = matches;
+    for (size_t i = 0; i < matches; i++)
+    {
+        topk_offer(&part->ranking, selection[i]);
+    }
+    finish_part(part);
+    free(selection);
+    return NULL;
+}
+
+// Selects and ranks the rows of one range for every query of a batch, a block of rows at a time
+static void *batch_range_run(void *arg)
+{
+    batch_range *range = (batch_range *)arg;
+    // The part of query q is parts[q * threads]; they all cover the same rows
+    size_t start = range->parts[0].start;
+    size_t end = range->parts[0].end;
+    uint32_t *selection;
+    stats_clock clock;
+
+    stats_start_thread(&clock);
+    selection = (uint32_t *)emalloc(SCAN_BATCH_BLOCK * sizeof(uint32_t));
+    stats_stop(&clock, &range->filter);
+    for (size_t block = start; block < end; block += SCAN_BATCH_BLOCK)
+    {
+        size_t block_end = end - block > SCAN_BATCH_BLOCK ? block + SCAN_BATCH_BLOCK : end;
+
+        for (size_t q = 0; q < range->queries; q++)
+        {
+            scan_part *part = &range->parts[q * (size_t)range->threads];
+            size_t matches;
+
+            stats_start_thread(&clock);
+            matches = part->select(part->table, block, block_end, selection, part->arg);
+            stats_stop(&clock, &range->filter);
+            part->matches += matches;
+            for (size_t i = 0; i < matches; i++)
+            {
+                topk_offer(&part->ranking, selection[i]);
+            }
+        }
+    }
+    for (size_t q = 0; q < range->queries; q++)
+    {
+        finish_part(&range->parts[q * (size_t)range->threads]);
+    }
+    free(selection);
+    return NULL;
+}
+
+// True if the head of part a is printed before the head of part b
+static bool head_before(const scan_part *parts, int a, int b)
+{
+    return topk_compare(&parts[a].ranking, &parts[a].ranked[parts[a].cursor],
+                        &parts[b].ranked[parts[b].cursor]) < 0;
+}
+
+static void merge_sift_down(const scan_part *parts, int *heap, int n, int i)
+{
+    for (;;)
+    {
+        int first = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+
+        if (left < n && head_before(parts, heap[left], heap[first]))
+        {
+            first = left;
+        }
+        if (right < n && head_before(parts, heap[right], heap[first]))
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        int temp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = temp;
+        i = first;
+    }
+}
+
+/**
+ * Function:  merge_parts
+ * ----------------------
+ * @brief  Merges the ranked parts through a heap of their heads.
+ *
+ * @param parts The parts, each ranked by topk_finish().
+ * @param threads The number of parts.
+ * @param result Receives the merged rows.
+ * @param total The number of rows to merge, at most the sum of the parts.
+ *
+ */
+static void merge_parts(scan_part *parts, int threads, topk_entry *result, size_t total)
+{
+    int *heap = (int *)emalloc((size_t)threads * sizeof(int));
+    int live = 0;
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (parts[i].count > 0)
+        {
+            heap[live++] = i;
+        }
+    }
+    for (int i = live / 2 - 1; i >= 0; i--)
+    {
+        merge_sift_down(parts, heap, live, i);
+    }
+    for (size_t n = 0; n < total; n++)
+    {
+        scan_part *first = &parts[heap[0]];
+
+        result[n] = first->ranked[first->cursor++];
+        if (first->cursor == first->count)
+        {
+            heap[0] = heap[--live];
+        }
+        merge_sift_down(parts, heap, live, 0);
+    }
+    free(heap);
+}
+
+/**
+ * Function:  join_parts
+ * ---------------------
+ * @brief  Joins the ranked parts of a query into its output order and releases them.
+ *
+ * @param parts The parts, each finished by finish_part().
+ * @param threads The number of parts.
+ * @param limit The number of rows to keep, or 0 to keep all of them.
+ * @param count Receives the number of rows returned.
+ *
+ * @return topk_entry* The ranked rows, first printed first, to be released with free().
+ *
+ */
+static topk_entry *join_parts(scan_part *parts, int threads, int limit, size_t *count)
+{
+    topk_entry *result;
+    size_t total = 0;
+    size_t n = 0;
+
+    for (int i = 0; i < threads; i++)
+    {
+        total += parts[i].count;
+    }
+    if (limit > 0 && (size_t)limit < total)
+    {
+        total = (size_t)limit;
+    }
+    result = (topk_entry *)emalloc((total > 0 ? total : 1) * sizeof(topk_entry));
+
+    if (limit > 0)
+    {
+        merge_parts(parts, threads, result, total);
+    }
+    else
+    {
+        // The parts cover increasing ranges of rows, so joining them keeps the rows in order
+        for (int i = 0; i < threads; i++)
+        {
+            memcpy(result + n, parts[i].ranked, parts[i].count * sizeof(topk_entry));
+            n += parts[i].count;
+        }
+        topk_sort(&parts[0].ranking, result, total, threads);
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        topk_free(&parts[i].ranking);
+    }
+    *count = total;
+    return result;
+}
+
+/**
+ * Function:  scan_rank
+ * --------------------
+ * @brief  Selects the matching rows of a table and returns them in output order.
+ *
+ * @param table The table to be scanned.
+ * @param select The function that selects the matching rows of a range.
+ * @param arg The argument passed to select.
+ * @param threads The number of threads to scan with.
+ * @param spec The ordering, from sort_parse().
+ * @param limit The number of rows to keep, or 0 to keep all of them.
+ * @param count Receives the number of rows returned.
+ * @param stats The metrics of the query, to which the filter and sort stages are added.
+ *
+ * @return topk_entry* The ranked rows, first printed first, to be released with free().
+ *
+ */
+topk_entry *scan_rank(const song_table *table, scan_select_fn select, const void *arg, int threads,
+                      const sort_spec *spec, int limit, size_t *count, query_stats *stats)
+{
+    scan_part *parts;
+    topk_entry *result;
+    size_t matches = 0;
+    stats_clock clock;
+    stage_stats scan = {0, 0, 0, 0, 0, 0, 0};
+    stage_stats *filter = &stats->stages[STAGE_FILTER];
+    stage_stats *sort = &stats->stages[STAGE_SORT];
+    double filter_wall_ms = 0;
+    double filter_cpu_ms = 0;
+    uint64_t filter_allocations = 0;
+    uint64_t filter_allocated = 0;
+
+    stats_start(&clock);
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    parts = (scan_part *)emalloc((size_t)threads * sizeof(scan_part));
+    for (int i = 0; i < threads; i++)
+    {
+        init_part(&parts[i], table, select, arg, spec, limit, i, threads);
+        // The first part runs on this thread once the others are started
+        parts[i].started = i > 0 && pthread_create(&parts[i].worker, NULL, scan_part_run, &parts[i]) == 0;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (parts[i].started)
+        {
+            pthread_join(parts[i].worker, NULL);
+        }
+        else
+        {
+            scan_part_run(&parts[i]);
+        }
+        matches += parts[i].matches;
+        // The parts filter side by side, so the slowest one is the wall time of the filter
+        filter_wall_ms = parts[i].filter.wall_ms > filter_wall_ms ? parts[i].filter.wall_ms : filter_wall_ms;
+        filter_cpu_ms += parts[i].filter.cpu_ms;
+        filter_allocations += parts[i].filter.allocations;
+        filter_allocated += parts[i].filter.allocated_bytes;
+    }
+
+    result = join_parts(parts, threads, limit, count);
+    free(parts);
+
+    stats_stop(&clock, &scan);
+    filter->wall_ms += filter_wall_ms;
+    filter->cpu_ms += filter_cpu_ms;
+    filter->allocations += filter_allocations;
+    filter->allocated_bytes += filter_allocated;
+    filter->rows_in += table->rows > 0 ? table->rows - 1 : 0;
+    filter->rows_out += matches;
+    sort->wall_ms += scan.wall_ms - filter_wall_ms;
+    sort->cpu_ms += scan.cpu_ms - filter_cpu_ms;
+    // The parts count their own allocations, so the rest of the scan's are those of the sort
+    sort->allocations += scan.allocations - filter_allocations;
+    sort->allocated_bytes += scan.allocated_bytes - filter_allocated;
+    sort->rows_in += matches;
+    sort->rows_out += *count;
+    return result;
+}
+
+/**
+ * Function:  scan_rank_batch
+ * --------------------------
+ * @brief  Selects and ranks the matching rows of several queries in one scan of a table.
+ *
+ * @param table The table to be scanned.
+ * @param queries The queries; each receives its ranked rows and their number.
+ * @param n The number of queries.
+ * @param threads The number of threads to scan with.
+ * @param stats The metrics of the batch, to which the filter and sort stages are added.
+ *
+ */
+void scan_rank_batch(const song_table *table, scan_query *queries, size_t n, int threads, query_stats *stats)
+{
+    scan_part *parts;
+    batch_range *ranges;
+    size_t matches = 0;
+    stats_clock clock;
+    stage_stats scan = {0, 0, 0, 0, 0, 0, 0};
+    stage_stats *filter = &stats->stages[STAGE_FILTER];
+    stage_stats *sort = &stats->stages[STAGE_SORT];
+    double filter_wall_ms = 0;
+    double filter_cpu_ms = 0;
+    uint64_t filter_allocations = 0;
+    uint64_t filter_allocated = 0;
+
+    if (n == 0)
+    {
+        return;
+    }
+    stats_start(&clock);
+    if (threads < 1)
+    {
+        threads = 1;
+    }
+
+    parts = (scan_part *)emalloc(n * (size_t)threads * sizeof(scan_part));
+    ranges = (batch_range *)emalloc((size_t)threads * sizeof(batch_range));
+    for (size_t q = 0; q < n; q++)
+    {
+        for (int i = 0; i < threads; i++)
+        {
+            init_part(&parts[q * (size_t)threads + (size_t)i], table, queries[q].select, queries[q].arg,
+                      queries[q].spec, queries[q].limit, i, threads);
+        }
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        ranges[i].parts = &parts[i];
+        ranges[i].queries = n;
+        ranges[i].threads = threads;
+        memset(&ranges[i].filter, 0, sizeof(ranges[i].filter));
+        // The first range runs on this thread once the others are started
+        ranges[i].started = i > 0 && pthread_create(&ranges[i].worker, NULL, batch_range_run, &ranges[i]) == 0;
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (ranges[i].started)
+        {
+            pthread_join(ranges[i].worker, NULL);
+        }
+        else
+        {
+            batch_range_run(&ranges[i]);
+        }
+        filter_wall_ms = ranges[i].filter.wall_ms > filter_wall_ms ? ranges[i].filter.wall_ms : filter_wall_ms;
+        filter_cpu_ms += ranges[i].filter.cpu_ms;
+        filter_allocations += ranges[i].filter.allocations;
+        filter_allocated += ranges[i].filter.allocated_bytes;
+    }
+
+    for (size_t q = 0; q < n; q++)
+    {
+        for (int i = 0; i < threads; i++)
+        {
+            matches += parts[q * (size_t)threads + (size_t)i].matches;
+        }
+        queries[q].ranked = join_parts(&parts[q * (size_t)threads], threads, queries[q].limit, &queries[q].count);
+        sort->rows_out += queries[q].count;
+    }
+    free(ranges);
+    free(parts);
+
+    stats_stop(&clock, &scan);
+    filter->wall_ms += filter_wall_ms;
+    filter->cpu_ms += filter_cpu_ms;
+    filter->allocations += filter_allocations;
+    filter->allocated_bytes += filter_allocated;
+    filter->rows_in += table->rows > 0 ? table->rows - 1 : 0;
+    filter->rows_out += matches;
+    sort->wall_ms += scan.wall_ms - filter_wall_ms;
+    sort->cpu_ms += scan.cpu_ms - filter_cpu_ms;
+    // The parts count their own allocations, so the rest of the scan's are those of the sort
+    sort->allocations += scan.allocations - filter_allocations;
+    sort->allocated_bytes += scan.allocated_bytes - filter_allocated;
+    sort->rows_in += matches;
+}
@@ -0,0 +1,44 @@
+/** @file scan.h
+ *  @brief Function prototypes for the parallel filter-and-rank scan.
+ *
+ *  A scan splits the rows of a table into one range per thread. Every
+ *  thread selects the matching rows of its range and ranks them with its
+ *  own top-K engine; the ranked parts are then merged into one ordering.
+ *  A batch of queries can share a single scan of the table.
+ */
+#ifndef _SCAN_H_
+#define _SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "stats.h"
+#include "table.h"
+#include "topk.h"
+
+/**
+ * Selects the matching rows in [start, end) and stores them, in increasing
+ * order, in out (which has room for end - start rows). Returns the number
+ * of matching rows.
+ */
+typedef size_t (*scan_select_fn)(const song_table *table, size_t start, size_t end, uint32_t *out, const void *arg);
+
+/**
+ * One query of a batch: its filter and ordering, and then its ranked rows.
+ */
+typedef struct {
+    scan_select_fn select;
+    const void *arg;
+    const sort_spec *spec;
+    int limit;
+    topk_entry *ranked;
+    size_t count;
+} scan_query;
+
+/**
+ * Function protypes associated with the scan.
+ */
+topk_entry *scan_rank(const song_table *, scan_select_fn, const void *arg, int threads,
+                      const sort_spec *spec, int limit, size_t *count, query_stats *stats);
+void scan_rank_batch(const song_table *, scan_query *queries, size_t n, int threads, query_stats *stats);
+
+#endif
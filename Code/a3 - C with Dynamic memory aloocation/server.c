@@ -0,0 +1,278 @@
+/** @file server.c
+ *  @brief Implementation of the local query server.
+ *
+ * The main thread accepts connections until SIGINT or SIGTERM arrives.
+ * Both signals stay blocked except while ppoll() waits on the listener,
+ * so one arriving between the check and the wait is not lost; the worker
+ * threads inherit the blocked mask and never see them. Shutting down
+ * waits for the requests in progress to finish, because the callback
+ * reads data the caller frees once server_run() returns; a connection
+ * that is idle at that point is left unanswered.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "server.h"
+
+#define SERVER_BACKLOG 64
+
+typedef struct {
+    int fd;
+    server_handler handler;
+    void *ctx;
+} connection;
+
+static volatile sig_atomic_t stop_requested = 0;
+static pthread_mutex_t busy_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t busy_done = PTHREAD_COND_INITIALIZER;
+static int busy = 0;
+static bool stopping = false;
+
+static void request_stop(int signo)
+{
+    (void)signo;
+    stop_requested = 1;
+}
+
+/**
+ * Function:  serve_connection
+ * ---------------------------
+ * @brief  Answers the requests of one client until it hangs up.
+ *
+ * @param arg The connection, which this function frees.
+ *
+ * @return void* Always NULL.
+ *
+ */
+static void *serve_connection(void *arg)
+{
+    connection *conn = (connection *)arg;
+    FILE *in = fdopen(conn->fd, "r");
+    out_writer out;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t n;
+
+    if (in == NULL)
+    {
+        close(conn->fd);
+        free(conn);
+        return NULL;
+    }
+    // Answers go straight to the socket, one write() per answer
+    writer_init(&out, conn->fd);
+
+    while ((n = getline(&line, &cap, in)) > 0)
+    {
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+        {
+            line[--n] = '\0';
+        }
+        if (n == 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&busy_lock);
+        bool refused = stopping;
+        busy += !refused;
+        pthread_mutex_unlock(&busy_lock);
+        if (refused)
+        {
+            break;
+        }
+
+        conn->handler(line, &out, conn->ctx);
+        writer_char(&out, '\n');
+        int written = writer_flush(&out);
+
+        pthread_mutex_lock(&busy_lock);
+        busy--;
+        pthread_cond_broadcast(&busy_done);
+        pthread_mutex_unlock(&busy_lock);
+        if (written != 0)
+        {
+            break;
+        }
+    }
+
+    free(line);
+    writer_close(&out);
+    fclose(in);
+    free(conn);
+    return NULL;
+}
+
+/**
+ * Function:  open_socket
+ * ----------------------
+ * @brief  Creates a listening socket at a path.
+ *
+ * A socket left behind at the path by an earlier run is replaced; any
+ * other kind of file is not.
+ *
+ * @param path The path of the socket.
+ *
+ * @return int The socket, or -1 with errno set.
+ *
+ */
+static int open_socket(const char *path)
+{
+    struct sockaddr_un address;
+    struct stat st;
+    int fd;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            errno = EEXIST;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_BACKLOG) != 0)
+    {
+        int saved = errno;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Function:  server_run
+ * ---------------------
+ * @brief  Serves requests on a Unix domain socket until SIGINT or SIGTERM.
+ *
+ * @param path The path of the socket; it is removed on return.
+ * @param handler The callback that answers each request.
+ * @param ctx The context passed to the callback.
+ *
+ * @return int 0 after a clean shutdown, -1 with errno set if the socket
+ *         could not be opened or accepting failed.
+ *
+ */
+int server_run(const char *path, server_handler handler, void *ctx)
+{
+    struct sigaction action;
+    sigset_t signals;
+    sigset_t previous;
+    sigset_t waiting;
+    int status = 0;
+    int listener;
+
+    listener = open_socket(path);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    // No SA_RESTART, so that a signal makes ppoll() fail with EINTR
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    // A client hanging up mid-answer must fail the write, not end the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // Only ppoll() lets the signals through; new threads inherit the mask
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    waiting = previous;
+    sigdelset(&waiting, SIGINT);
+    sigdelset(&waiting, SIGTERM);
+    // A client that gives up after ppoll() must not leave accept() blocked
+    fcntl(listener, F_SETFL, fcntl(listener, F_GETFL) | O_NONBLOCK);
+
+    while (!stop_requested)
+    {
+        struct pollfd ready = {listener, POLLIN, 0};
+        if (ppoll(&ready, 1, NULL, &waiting) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            status = -1;
+            break;
+        }
+
+        // Flags of 0 keep the client socket blocking whatever the listener has
+        int fd = accept4(listener, NULL, NULL, 0);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN ||
+                errno == EWOULDBLOCK)
+            {
+                continue;
+            }
+            status = -1;
+            break;
+        }
+
+        connection *conn = (connection *)emalloc(sizeof(connection));
+        pthread_attr_t attributes;
+        pthread_t worker;
+
+        conn->fd = fd;
+        conn->handler = handler;
+        conn->ctx = ctx;
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        int created = pthread_create(&worker, &attributes, serve_connection, conn);
+        pthread_attr_destroy(&attributes);
+        if (created != 0)
+        {
+            // Serve the client on this thread if no new one can be started
+            serve_connection(conn);
+        }
+    }
+
+    int saved = errno;
+    close(listener);
+    unlink(path);
+
+    pthread_mutex_lock(&busy_lock);
+    stopping = true;
+    while (busy > 0)
+    {
+        pthread_cond_wait(&busy_done, &busy_lock);
+    }
+    pthread_mutex_unlock(&busy_lock);
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    errno = saved;
+    return status;
+}
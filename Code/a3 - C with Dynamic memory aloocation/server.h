@@ -0,0 +1,26 @@
+/** @file server.h
+ *  @brief Function prototypes for the local query server.
+ *
+ *  The server listens on a Unix domain socket and reads requests from each
+ *  client, one per line. Every request is handed to a callback together
+ *  with a writer to the client; the answer the callback writes is followed
+ *  by an empty line, so a client can send many requests on one connection.
+ *  Each connection is served on a thread of its own.
+ */
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include "writer.h"
+
+/**
+ * Answers one request, a line without its newline that the callback may
+ * modify, by writing to out. Called from several threads at once.
+ */
+typedef void (*server_handler)(char *request, out_writer *out, void *ctx);
+
+/**
+ * Function protypes associated with the query server.
+ */
+int server_run(const char *path, server_handler, void *ctx);
+
+#endif
@@ -0,0 +1,429 @@
+/** @file snapshot.c
+ *  @brief Implementation of the binary snapshot format.
+ *
+ * Layout (all integers in native byte order, which the header records):
+ *
+ *     header      snapshot_header, padded to 64 bytes
+ *     year        int32[rows]      month, day, spotify and apple follow
+ *     streams     int64[rows]
+ *     track       uint64[rows]     offsets into the string heap
+ *     artist      uint32[rows]     IDs into the artist dictionary
+ *     artists     uint64[artists]  offsets into the string heap
+ *     strings     char[strings_len]
+ *
+ * Every section starts on a 64-byte boundary and its offset is stored in
+ * the header. The header carries two checksums: one over the header itself,
+ * always checked on load, and one over everything after it, checked only
+ * on request because it means reading the whole file.
+ *
+ * A snapshot (or an index) is written to a temporary file next to it,
+ * flushed to disk and then renamed over the old one. A process that has
+ * the old file mapped keeps reading it, and a crash mid-write leaves the
+ * old file as it was.
+ *
+ */
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "snapshot.h"
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+enum {
+    SECTION_YEAR,
+    SECTION_MONTH,
+    SECTION_DAY,
+    SECTION_SPOTIFY,
+    SECTION_APPLE,
+    SECTION_STREAMS,
+    SECTION_TRACK,
+    SECTION_ARTIST,
+    SECTION_ARTISTS,
+    SECTION_STRINGS,
+    SECTION_COUNT
+};
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t rows;
+    uint64_t strings_len;
+    uint64_t artists;
+    uint64_t file_size;
+    uint64_t offsets[SECTION_COUNT];
+    uint64_t payload_checksum;
+    uint64_t header_checksum;
+} snapshot_header;
+
+/**
+ * Function:  snapshot_checksum
+ * ----------------------------
+ * @brief  Folds a block of bytes into a running 64-bit checksum.
+ *
+ * Eight bytes are mixed in per step (FNV-1a style on whole words), which
+ * keeps the checksum close to memory speed.
+ *
+ * @param hash The running checksum.
+ * @param data The bytes to be added.
+ * @param n The number of bytes.
+ *
+ * @return uint64_t The updated checksum.
+ *
+ */
+uint64_t snapshot_checksum(uint64_t hash, const void *data, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint64_t word;
+
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        memcpy(&word, p, 8);
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    for (; n > 0; n--, p++)
+    {
+        hash = (hash ^ *p) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static uint64_t header_checksum(const snapshot_header *header)
+{
+    return snapshot_checksum(SNAPSHOT_CHECKSUM_SEED, header, offsetof(snapshot_header, header_checksum));
+}
+
+// Size in bytes of a section of a snapshot with the given header
+static uint64_t section_size(const snapshot_header *header, int section)
+{
+    switch (section)
+    {
+    case SECTION_STREAMS:
+        return header->rows * sizeof(int64_t);
+    case SECTION_TRACK:
+        return header->rows * sizeof(uint64_t);
+    case SECTION_ARTISTS:
+        return header->artists * sizeof(uint64_t);
+    case SECTION_STRINGS:
+        return header->strings_len;
+    default:
+        return header->rows * sizeof(int32_t);
+    }
+}
+
+/**
+ * Function:  snapshot_align
+ * -------------------------
+ * @brief  Rounds a size up to the section alignment.
+ *
+ * @param n The size.
+ *
+ * @return size_t The next multiple of SNAPSHOT_ALIGN.
+ *
+ */
+size_t snapshot_align(size_t n)
+{
+    return (n + SNAPSHOT_ALIGN - 1) & ~(size_t)(SNAPSHOT_ALIGN - 1);
+}
+
+/**
+ * Function:  snapshot_probe
+ * -------------------------
+ * @brief  Tells whether a file starts like a snapshot.
+ *
+ * @param path The path of the file.
+ *
+ * @return bool True if the file starts with the snapshot magic.
+ *
+ */
+bool snapshot_probe(const char *path)
+{
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    bool found;
+
+    if (file == NULL)
+    {
+        return false;
+    }
+    found = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    fclose(file);
+    return found;
+}
+
+/**
+ * Function:  snapshot_write_section
+ * ---------------------------------
+ * @brief  Writes a section padded to the next boundary and folds it into a checksum.
+ *
+ * @param file The file being written.
+ * @param data The bytes of the section.
+ * @param n The number of bytes.
+ * @param hash The running checksum of the sections written so far.
+ * @param offset The offset of the section; advanced past its padding.
+ *
+ * @return int 0 on success, -1 if the write failed.
+ *
+ */
+int snapshot_write_section(FILE *file, const void *data, size_t n, uint64_t *hash, uint64_t *offset)
+{
+    static const char padding[SNAPSHOT_ALIGN];
+    size_t padded = snapshot_align(n);
+
+    if (n > 0 && fwrite(data, 1, n, file) != n)
+    {
+        return -1;
+    }
+    if (padded > n && fwrite(padding, 1, padded - n, file) != padded - n)
+    {
+        return -1;
+    }
+    *hash = snapshot_checksum(*hash, data, n);
+    *hash = snapshot_checksum(*hash, padding, padded - n);
+    *offset += padded;
+    return 0;
+}
+
+/**
+ * Function:  snapshot_create
+ * --------------------------
+ * @brief  Opens the temporary file a snapshot or an index is written to
+ *         before it replaces the file at its path.
+ *
+ * @param path The path the file will have.
+ * @param pending Receives the path of the temporary file, to be passed
+ *        to snapshot_commit().
+ *
+ * @return FILE* The temporary file, or NULL if it could not be created.
+ *
+ */
+FILE *snapshot_create(const char *path, char **pending)
+{
+    size_t n = strlen(path) + sizeof(SNAPSHOT_PENDING_SUFFIX);
+    FILE *file;
+
+    *pending = (char *)emalloc(n);
+    snprintf(*pending, n, "%s" SNAPSHOT_PENDING_SUFFIX, path);
+    file = fopen(*pending, "wb");
+    if (file == NULL)
+    {
+        free(*pending);
+        *pending = NULL;
+    }
+    return file;
+}
+
+/**
+ * Function:  snapshot_commit
+ * --------------------------
+ * @brief  Closes a file from snapshot_create() and, if it was written in
+ *         full, flushes it to disk and renames it over its path; removes
+ *         it otherwise.
+ *
+ * @param file The temporary file.
+ * @param pending Its path, from snapshot_create(); released here.
+ * @param path The path the file replaces.
+ * @param status 0 if every write to the file succeeded.
+ *
+ * @return int 0 on success, -1 if the file was not written or not renamed.
+ *
+ */
+int snapshot_commit(FILE *file, char *pending, const char *path, int status)
+{
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+    {
+        status = -1;
+    }
+    if (fclose(file) != 0)
+    {
+        status = -1;
+    }
+    if (status == 0 && rename(pending, path) != 0)
+    {
+        status = -1;
+    }
+    if (status != 0)
+    {
+        unlink(pending);
+    }
+    free(pending);
+    return status;
+}
+
+/**
+ * Function:  snapshot_write
+ * -------------------------
+ * @brief  Writes a table to a snapshot file.
+ *
+ * @param table The table to be written.
+ * @param path The path of the snapshot; an existing file is replaced at once.
+ *
+ * @return int 0 on success, -1 if the file could not be written.
+ *
+ */
+int snapshot_write(const song_table *table, const char *path)
+{
+    snapshot_header header;
+    const void *sections[SECTION_COUNT];
+    size_t sizes[SECTION_COUNT];
+    char block[SNAPSHOT_ALIGN * ((sizeof(snapshot_header) + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN)];
+    uint64_t offset = sizeof(block);
+    uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+    char *pending;
+    int status;
+    FILE *file;
+
+    sections[SECTION_YEAR] = table->year;
+    sections[SECTION_MONTH] = table->month;
+    sections[SECTION_DAY] = table->day;
+    sections[SECTION_SPOTIFY] = table->spotify;
+    sections[SECTION_APPLE] = table->apple;
+    sections[SECTION_STREAMS] = table->streams;
+    sections[SECTION_TRACK] = table->track;
+    sections[SECTION_ARTIST] = table->artist;
+    sections[SECTION_ARTISTS] = table->artists;
+    sections[SECTION_STRINGS] = table->strings;
+    for (int i = SECTION_YEAR; i <= SECTION_APPLE; i++)
+    {
+        sizes[i] = table->rows * sizeof(int32_t);
+    }
+    sizes[SECTION_STREAMS] = table->rows * sizeof(int64_t);
+    sizes[SECTION_TRACK] = table->rows * sizeof(uint64_t);
+    sizes[SECTION_ARTIST] = table->rows * sizeof(uint32_t);
+    sizes[SECTION_ARTISTS] = table->artist_count * sizeof(uint64_t);
+    sizes[SECTION_STRINGS] = table->strings_len;
+
+    file = snapshot_create(path, &pending);
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    // The header goes in last, once the offsets and the checksum are known
+    memset(&header, 0, sizeof(header));
+    memset(block, 0, sizeof(block));
+    status = fwrite(block, 1, sizeof(block), file) == sizeof(block) ? 0 : -1;
+    for (int i = 0; status == 0 && i < SECTION_COUNT; i++)
+    {
+        header.offsets[i] = offset;
+        status = snapshot_write_section(file, sections[i], sizes[i], &hash, &offset);
+    }
+
+    if (status == 0)
+    {
+        memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+        header.version = SNAPSHOT_VERSION;
+        header.byte_order = BYTE_ORDER_MARK;
+        header.rows = table->rows;
+        header.strings_len = table->strings_len;
+        header.artists = table->artist_count;
+        header.file_size = offset;
+        header.payload_checksum = hash;
+        header.header_checksum = header_checksum(&header);
+        memcpy(block, &header, sizeof(header));
+        if (fseek(file, 0, SEEK_SET) != 0 || fwrite(block, 1, sizeof(block), file) != sizeof(block))
+        {
+            status = -1;
+        }
+    }
+    return snapshot_commit(file, pending, path, status);
+}
+
+/**
+ * Function:  snapshot_map
+ * -----------------------
+ * @brief  Maps a snapshot and points an empty table into it.
+ *
+ * The table is read-only and must not grow; table_free() unmaps it.
+ *
+ * @param table The table to be filled in.
+ * @param path The path of the snapshot.
+ * @param verify Whether to also check the checksum of the whole file.
+ *
+ * @return int 0 on success, -1 if the file is missing, is not a snapshot of
+ *         this version, or is corrupt.
+ *
+ */
+int snapshot_map(song_table *table, const char *path, bool verify)
+{
+    snapshot_header header;
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header))
+    {
+        close(fd);
+        return -1;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, 8) == 0 && header.version == SNAPSHOT_VERSION &&
+                 header.byte_order == BYTE_ORDER_MARK && header.header_checksum == header_checksum(&header) &&
+                 header.file_size == (uint64_t)st.st_size;
+    // Every section must lie inside the file (rows is bounded first so the sizes cannot overflow)
+    valid = valid && header.rows <= header.file_size && header.strings_len <= header.file_size &&
+            header.artists <= header.file_size;
+    for (int i = 0; valid && i < SECTION_COUNT; i++)
+    {
+        valid = header.offsets[i] % SNAPSHOT_ALIGN == 0 && header.offsets[i] <= header.file_size &&
+                section_size(&header, i) <= header.file_size - header.offsets[i];
+    }
+    if (valid && verify)
+    {
+        // Fold the sections in exactly as snapshot_write() did: data, then padding
+        uint64_t hash = SNAPSHOT_CHECKSUM_SEED;
+        for (int i = 0; i < SECTION_COUNT; i++)
+        {
+            const char *section = (const char *)data + header.offsets[i];
+            uint64_t size = section_size(&header, i);
+            hash = snapshot_checksum(hash, section, size);
+            hash = snapshot_checksum(hash, section + size, snapshot_align(size) - size);
+        }
+        valid = hash == header.payload_checksum;
+    }
+    if (!valid)
+    {
+        munmap(data, (size_t)st.st_size);
+        return -1;
+    }
+
+    char *base = (char *)data;
+    table_init(table);
+    table->rows = header.rows;
+    table->capacity = header.rows;
+    table->year = (int32_t *)(base + header.offsets[SECTION_YEAR]);
+    table->month = (int32_t *)(base + header.offsets[SECTION_MONTH]);
+    table->day = (int32_t *)(base + header.offsets[SECTION_DAY]);
+    table->spotify = (int32_t *)(base + header.offsets[SECTION_SPOTIFY]);
+    table->apple = (int32_t *)(base + header.offsets[SECTION_APPLE]);
+    table->streams = (int64_t *)(base + header.offsets[SECTION_STREAMS]);
+    table->track = (uint64_t *)(base + header.offsets[SECTION_TRACK]);
+    table->artist = (uint32_t *)(base + header.offsets[SECTION_ARTIST]);
+    table->artists = (uint64_t *)(base + header.offsets[SECTION_ARTISTS]);
+    table->artist_count = header.artists;
+    table->artist_cap = header.artists;
+    table->strings = base + header.offsets[SECTION_STRINGS];
+    table->strings_len = header.strings_len;
+    table->strings_cap = header.strings_len;
+    table->mapping = data;
+    table->mapping_size = (size_t)st.st_size;
+    return 0;
+}
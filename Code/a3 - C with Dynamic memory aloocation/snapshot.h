@@ -0,0 +1,38 @@
+/** @file snapshot.h
+ *  @brief Function prototypes for the binary snapshot format.
+ *
+ *  A snapshot is a song table written to disk in the layout it has in
+ *  memory: a header, the fixed-width numeric columns, the name offsets
+ *  and artist IDs, the artist dictionary and the string heap, each
+ *  section aligned to 64 bytes. Loading a snapshot maps the file and
+ *  points the table columns into the mapping, so there is nothing to
+ *  parse.
+ */
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "table.h"
+
+#define SNAPSHOT_MAGIC "SONGSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_CHECKSUM_SEED 0xcbf29ce484222325ULL
+// Suffix of the file a snapshot or an index is written to before it replaces the old one
+#define SNAPSHOT_PENDING_SUFFIX ".tmp"
+
+/**
+ * Function protypes associated with snapshots.
+ */
+bool snapshot_probe(const char *path);
+int snapshot_write(const song_table *, const char *path);
+int snapshot_map(song_table *, const char *path, bool verify);
+uint64_t snapshot_checksum(uint64_t hash, const void *data, size_t n);
+size_t snapshot_align(size_t n);
+int snapshot_write_section(FILE *, const void *data, size_t n, uint64_t *hash, uint64_t *offset);
+FILE *snapshot_create(const char *path, char **pending);
+int snapshot_commit(FILE *, char *pending, const char *path, int status);
+
+#endif
@@ -11,240 +11,1116 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "list.h" // Include the header file for linked list operations
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "args.h" // Include the header file for the args structure
+#include "emalloc.h" // Include the header file for checked allocation
+#include "table.h" // Include the header file for the columnar song table
+#include "topk.h" // Include the header file for the top-K selection engine
+#include "scan.h" // Include the header file for the parallel filter-and-rank scan
+#include "filter.h" // Include the header file for the vectorized column predicates
+#include "snapshot.h" // Include the header file for the binary snapshot format
+#include "index.h" // Include the header file for the secondary indexes
+#include "match.h" // Include the header file for the precompiled substring matcher
+#include "server.h" // Include the header file for the local query server
+#include "stream.h" // Include the header file for the bounded-memory streaming query
+#include "writer.h" // Include the header file for the buffered output writer
+#include "where.h" // Include the header file for the --where filter expressions
+#include "stats.h" // Include the header file for the per-stage query metrics
+#include "cache.h" // Include the header file for the on-disk result cache
+#include "group.h" // Include the header file for the GROUP BY aggregation engine
 
-#define MAX_LINE_LEN 256 // Define the maximum length of a line
+#define MAX_THREADS 256 // Upper bound for --threads
+#define MAX_REQUEST_ARGS 32 // Upper bound for the arguments of one server request
+#define ERROR_LEN 256 // Room for an argument error message
+
+// Column scanned by a range filter and its bounds, both included
+typedef struct {
+    const int32_t *i32;
+    const int64_t *i64;
+    int64_t lo;
+    int64_t hi;
+} column_range;
+
+// Rows picked out by an index, in increasing order, and the artist each must contain (NULL if every row matches)
+typedef struct {
+    const uint32_t *rows;
+    size_t count;
+    const matcher_t *artist;
+} row_list;
+
+// Column a streamed range filter reads and its bounds, both included
+typedef struct {
+    sort_key column;
+    int64_t lo;
+    int64_t hi;
+} stream_range;
+
+// What every server request shares: the dataset, its index and the server's own arguments
+typedef struct {
+    const song_table *table;
+    const song_index *index;
+    const args *defaults;
+} query_context;
+
+// One query of a batch: its arguments, and the function and argument its rows are selected with
+typedef struct {
+    args query;
+    scan_select_fn select;
+    const void *select_arg;
+    uint64_t *artists;
+    int32_t year;
+    column_range range;
+} batch_query;
 
 // Function Prototypes
-void free_song_data(song_data* song); // Frees the memory allocated for a song_data struct
-void deallocate_memory(node_t*); // Frees the entire linked list and its song data
-void display_songs_ordered(node_t*, int, char*, FILE*); // Displays songs in a specific order
-node_t* process_song_details(char*); // Processes a single line of song data to create a song node
-void analyze_songs_by_artist(const char*, char*, char*, int, char*); // Filters and displays songs by artist
-void analyze_songs_by_year(const char*, char*, char*, int, char*); // Filters and displays songs by year
+void display_songs_ordered(const song_table*, const topk_entry*, size_t, int, sort_key, out_writer*); // Displays songs in a specific order
+void load_song_data(song_table*, const args*, unsigned); // Loads the given columns of the input file, or its snapshot, into a table or exits with an error
+void exit_bad_value(const csv_bad_value*, const char*); // Reports a numeric field of the input file that does not hold a number, or a column its header lacks, and exits
+uint64_t file_size(const char*); // Size of a file in bytes, or 0 if it cannot be read
+void build_snapshot(const args*); // Converts the input file into a binary snapshot
+void build_index(const args*); // Builds the year and artist indexes of the input file
+bool load_song_index(song_index*, const song_table*, const args*); // Maps the up-to-date index of the input file, if any
+size_t select_by_rows(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects the rows of a range listed by an index
+bool artist_has_name(const char*, const void*); // Tells whether an artist name contains the searched name
+size_t select_by_artist(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects the rows of a range by artist
+size_t select_by_year(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects the rows of a range by year
+size_t select_by_range(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects the rows of a range by a numeric range
+size_t select_by_where(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects the rows of a range by a --where plan
+size_t select_all(const song_table*, size_t, size_t, uint32_t*, const void*); // Selects every row of a range
+void analyze_songs_by_artist(const song_table*, const song_index*, const args*, out_writer*); // Filters and displays songs by artist
+void analyze_songs_by_year(const song_table*, const song_index*, const args*, out_writer*); // Filters and displays songs by year
+void analyze_songs_by_range(const song_table*, const args*, out_writer*); // Filters and displays songs by a numeric range
+void analyze_songs_where(const song_table*, const args*, out_writer*); // Filters and displays songs by a --where expression
+int parse_range(const char*, int64_t*, int64_t*); // Parses a "MIN:MAX" range value
+void set_column_range(const song_table*, const args*, column_range*); // Picks the column and bounds of a range filter
+void display_groups(const song_table*, const group_spec*, const group_entry*, size_t, int, out_writer*); // Displays the groups of a grouped query
+void group_and_display(const song_table*, scan_select_fn, const void*, const args*, out_writer*); // Folds matching rows into groups and displays them
+void rank_and_display(const song_table*, scan_select_fn, const void*, const args*, out_writer*); // Orders matching rows and displays them
+bool is_range_filter(const char*); // Tells whether a filter selects a numeric range
+void write_csv_header(const args*, out_writer*); // Writes the CSV header of a query
+size_t output_cap(const args*); // Number of songs a query displays at most
+unsigned filter_columns(const args*); // Columns of the input the filter of a query reads
+unsigned query_columns(const args*); // Columns of the input a query reads
+bool stream_by_artist(const stream_row*, const void*); // Tells whether a streamed row matches by artist
+bool stream_by_year(const stream_row*, const void*); // Tells whether a streamed row matches by year
+bool stream_by_range(const stream_row*, const void*); // Tells whether a streamed row matches by a numeric range
+bool stream_by_where(const stream_row*, const void*); // Tells whether a streamed row passes a --where plan
+void open_output(out_writer*, const args*); // Opens the output file or stdout, or exits with an error
+void close_output(out_writer*); // Flushes and closes the output, or exits with an error
+void stream_songs(const args*); // Filters and displays songs straight from the input file within --max-memory
+int parse_size(const char*, size_t*); // Parses a size such as "512K", "64M" or "2G"
+bool check_query(args*, char*, size_t); // Checks that a query is complete and well-formed, and parses its ordering
+void run_query(const song_table*, const song_index*, const args*, out_writer*); // Runs a checked query and writes its CSV output
+void free_query(args*); // Releases what check_query() allocated
+void report_stats(query_stats*, const args*); // Finishes the metrics of a query and prints them if --stats asked for them
+bool parse_request(args*, char*, bool, char*, size_t); // Splits a request into its arguments and stores them over the defaults
+void answer_request(char*, out_writer*, void*); // Parses and answers one server request
+size_t read_batch(const args*, char**, batch_query**); // Reads and checks the queries of a batch file, or exits with an error
+void prepare_batch_query(const song_table*, batch_query*); // Picks the function that selects the rows of a batch query
+void batch_songs(args argument); // Loads the dataset once and answers every query of a batch file in one scan
+void serve_songs(args argument); // Loads the dataset once and answers queries over a socket
+char* query_key(const args*); // Describes what a checked query writes, for the result cache
+bool fetch_cached(const args*, result_cache*, uint64_t*, char**); // Copies the results of a query from the cache, if it holds them
+void store_cached(result_cache*, uint64_t, char*, const char*); // Copies the results of a query to the output and adds them to the cache
 void process_arguments_and_filter_songs(args argument); // Processes arguments and filters songs accordingly
+int set_argument(args*, char*, bool, char*, size_t); // Stores one --name=value argument
 args parse_arguments(int argc, char *argv[]); // Parses command-line arguments into a structured form
-void display_songs_by_streams(node_t* list, int limit, FILE* output_file); // Displays songs ordered by stream count
-void display_songs_by_spotify_playlists(node_t* list, int limit, FILE* output_file); // Displays songs ordered by Spotify playlist count
-void display_songs_by_apple_playlists(node_t* list, int limit, FILE* output_file); // Displays songs ordered by Apple playlist count
+void display_songs_by_streams(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file); // Displays songs ordered by stream count
+void display_songs_by_spotify_playlists(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file); // Displays songs ordered by Spotify playlist count
+void display_songs_by_apple_playlists(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file); // Displays songs ordered by Apple playlist count
 
-// Frees the memory allocated for a song_data struct
-void free_song_data(song_data* song) {
-    if (song != NULL) {
-        free(song->artist_name);
-        free(song->track_name);
-        // Free any additional dynamically allocated fields within song_data here
-        free(song);
+// Displays songs ordered by stream count
+void display_songs_by_streams(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file) {
+    size_t counter = 0;
+
+	if(limit!=0 && (size_t)limit < count){
+		count = (size_t)limit; // Print no more than 'limit' songs
+	}
+
+    while (counter < count) {
+        uint32_t row = ranked[counter].row;
+        const char *track = table_track(table, row), *artist = table_artist(table, row);
+        writer_song(output_file, table->year[row], table->month[row], table->day[row],
+                    track, strlen(track), artist, strlen(artist), table->streams[row]);
+        counter++; // Move to the next song
     }
 }
 
-// Frees the entire linked list and its song data
-void deallocate_memory(node_t* list) {
-    while (list != NULL) {
-        node_t *temp = list; // Temporary pointer for the current node
-        list = list->next; // Move to the next node
+// Displays songs ordered by Spotify playlist count
+void display_songs_by_spotify_playlists(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file) {
+    size_t counter = 0;
+    while (counter < count && counter < (size_t)limit) {
+        uint32_t row = ranked[counter].row;
+        const char *track = table_track(table, row), *artist = table_artist(table, row);
+        writer_song(output_file, table->year[row], table->month[row], table->day[row],
+                    track, strlen(track), artist, strlen(artist), table->spotify[row]);
+        counter++; // Move to the next song
+    }
+}
 
-        // Now, free the song_data using the new function
-        free_song_data(temp->song);
+// Displays songs ordered by Apple playlist count
+void display_songs_by_apple_playlists(const song_table* table, const topk_entry* ranked, size_t count, int limit, out_writer* output_file) {
+    size_t counter = 0;
+    while (counter < count && counter < (size_t)limit) {
+        uint32_t row = ranked[counter].row;
+        const char *track = table_track(table, row), *artist = table_artist(table, row);
+        writer_song(output_file, table->year[row], table->month[row], table->day[row],
+                    track, strlen(track), artist, strlen(artist), table->apple[row]);
+        counter++; // Move to the next song
+    }
+}
 
-        // Finally, free the list node itself
-        free(temp);
+// Displays songs in a specific order
+void display_songs_ordered(const song_table* table, const topk_entry* ranked, size_t count, int limit, sort_key column, out_writer* output_file) {
+    // Display the count the songs are first ordered by
+    if (column == KEY_STREAMS) {
+        display_songs_by_streams(table, ranked, count, limit, output_file);
+    } else if (column == KEY_SPOTIFY) {
+        display_songs_by_spotify_playlists(table, ranked, count, limit, output_file);
+    } else {
+		display_songs_by_apple_playlists(table, ranked, count, limit, output_file);
     }
 }
 
-// Displays songs ordered by stream count
-void display_songs_by_streams(node_t* list, int limit, FILE* output_file) {
-    int counter = 0;
-	
-	if(limit!=0){
-	
-    while (list != NULL && counter < limit) {
-        fprintf(output_file, "%d-%d-%d,%s,%s,%ld\n",
-                list->song->year, list->song->month, list->song->day, list->song->track_name, list->song->artist_name, list->song->streams);
-        list = list->next; // Move to the next node
-        counter++; // Increment the counter
-    }
-	
-	}else {
-		
-		while (list != NULL) {
-        fprintf(output_file, "%d-%d-%d,%s,%s,%ld\n",
-                list->song->year, list->song->month, list->song->day, list->song->track_name, list->song->artist_name, list->song->streams);
-        list = list->next; // Move to the next node
-	}
-	}
+// Loads the input file into a table, exiting with an error message if it cannot be read
+void load_song_data(song_table* table, const args* argument, unsigned columns) {
+    csv_bad_value bad; // First malformed number of the input file, if any
+
+    table_init(table);
+    // A snapshot is mapped as is; anything else is parsed as CSV
+    if (snapshot_probe(argument->data)) {
+        if (snapshot_map(table, argument->data, argument->verify) != 0) {
+            fprintf(stderr, "Invalid or corrupt snapshot: %s\n", argument->data);
+            exit(1);
+        }
+    } else if (table_load_csv(table, argument->data, argument->threads, columns, &bad) != 0) {
+        if (errno == EINVAL) {
+            exit_bad_value(&bad, argument->data);
+        }
+        perror("Failed to open data file");
+        exit(1);
+    }
 }
 
-// Displays songs ordered by Spotify playlist count
-void display_songs_by_spotify_playlists(node_t* list, int limit, FILE* output_file) {
-    int counter = 0;
-    while (list != NULL && counter < limit) {
-        fprintf(output_file, "%d-%d-%d,%s,%s,%d\n",
-                list->song->year, list->song->month, list->song->day, list->song->track_name, list->song->artist_name, list->song->spotify);
-        list = list->next; // Move to the next node
-        counter++; // Increment the counter
+// Reports a numeric field of the input file that does not hold a number, or a column its header lacks, and exits
+void exit_bad_value(const csv_bad_value* bad, const char* path) {
+    if (bad->missing != NULL) {
+        fprintf(stderr, "Missing column %s in the header of %s\n", bad->missing, path);
+        exit(1);
     }
+    fprintf(stderr, "Malformed number in row %zu, field %d of %s\n", bad->row, bad->field + 1, path); // Fields are counted from 1, rows from the header
+    exit(1);
 }
 
-// Displays songs ordered by Apple playlist count
-void display_songs_by_apple_playlists(node_t* list, int limit, FILE* output_file) {
-    int counter = 0;
-    while (list != NULL && counter < limit) {
-        fprintf(output_file, "%d-%d-%d,%s,%s,%d\n",
-                list->song->year, list->song->month, list->song->day, list->song->track_name, list->song->artist_name, list->song->apple);
-        list = list->next; // Move to the next node
-        counter++; // Increment the counter
+// Size of a file in bytes, or 0 if it cannot be read
+uint64_t file_size(const char* path) {
+    struct stat st; // Metadata of the file
+
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Converts the input file into a binary snapshot that later runs can map with --data
+void build_snapshot(const args* argument) {
+    song_table table; // Columnar copy of the dataset
+
+    load_song_data(&table, argument, ALL_COLUMNS);
+    if (snapshot_write(&table, argument->build_snapshot) != 0) {
+        perror("Failed to write snapshot");
+        exit(1);
     }
+    table_free(&table);
 }
 
-// Displays songs in a specific order
-void display_songs_ordered(node_t* list, int limit, char* order_by, FILE* output_file) {
-    // Check the order_by criteria and call the appropriate function
-    if (strcmp(order_by, "STREAMS") == 0) {
-        display_songs_by_streams(list, limit, output_file);
-    } else if (strcmp(order_by, "NO_SPOTIFY_PLAYLISTS") == 0) {
-        display_songs_by_spotify_playlists(list, limit, output_file);
-    } else {
-		display_songs_by_apple_playlists(list, limit, output_file);
-    }
-}
-
-// Processes a single line of song data to create a song node
-node_t* process_song_details(char* line){
-    // Allocate memory for a new song_data structure
-    song_data* song = (song_data*)malloc(sizeof(song_data));
-    if (!song) {
-        perror("Failed to allocate song_data"); // Print an error message if allocation fails
-        return NULL;
-    }
-    // Extract and duplicate the track name
-    char* temp = strtok(line, ",");
-    song->track_name = strdup(temp ? temp : " ");
-    // Extract and duplicate the artist name
-    temp = strtok(NULL, ",");
-    song->artist_name = strdup(temp ? temp : " ");
-    
-    // Skip two fields to reach the year
-    for (int i = 0; i < 2; i++) temp = strtok(NULL, ",");
-    
-    // Extract year, month, day, spotify count, streams, and apple playlist count
-    song->year = temp ? atoi(temp) : 0;
-    temp = strtok(NULL, ",");
-    song->month = temp ? atoi(temp) : 0;
-    temp = strtok(NULL, ",");
-    song->day = temp ? atoi(temp) : 0;
-    temp = strtok(NULL, ",");
-    song->spotify = temp ? atoi(temp) : 0;
-    temp = strtok(NULL, ",");
-	char *endptr;
-    song->streams = temp ? strtol(temp, &endptr, 10) : 0;
-    temp = strtok(NULL, ",");
-    song->apple = temp ? atoi(temp) : 0;
-    // Create and return a new node with the processed song data
-    return new_node(song);
+// Builds the year and artist indexes of the input file and saves them next to it
+void build_index(const args* argument) {
+    song_table table; // Columnar copy of the dataset
+    char *path = index_path(argument->data); // Index file next to the data file
+
+    load_song_data(&table, argument, ALL_COLUMNS);
+    if (index_build(&table, argument->data, path) != 0) {
+        perror("Failed to write index");
+        exit(1);
+    }
+    free(path);
+    table_free(&table);
 }
 
-// Filters and displays songs by artist
-void analyze_songs_by_artist(const char* filename, char* order_by, char* artist_name, int limit, char* order){
-    FILE *input_file, *output_file; // File pointers for reading and writing
-    char *line = NULL; // Buffer for reading lines from the file
-    node_t *list = NULL; // Linked list for storing processed songs
-    line = (char *)malloc(MAX_LINE_LEN * sizeof(char)); // Allocate memory for the line buffer
-
-    if (!line) {
-        fprintf(stderr, "Failed to allocate memory\n"); // Print an error if memory allocation fails
-        return;
+// Maps the index of the input file; a missing index is not an error, a stale one is ignored with a warning
+bool load_song_index(song_index* index, const song_table* table, const args* argument) {
+    char *path; // Index file next to the data file
+    int status; // Outcome of mapping the index
+
+    if (!argument->use_index) {
+        return false;
     }
+    path = index_path(argument->data);
+    status = index_open(index, table, argument->data, path, argument->verify);
+    if (status > 0) {
+        fprintf(stderr, "Ignoring stale or invalid index: %s\n", path);
+    }
+    free(path);
+    return status == 0;
+}
+
+// Selects the rows in [start, end) that an index listed and, if an artist is given, that contain it
+size_t select_by_rows(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    const row_list *list = (const row_list *)arg;
+    size_t lo = 0, hi = list->count; // Binary search for the first listed row in the range
+    size_t matches = 0;
 
-    input_file = fopen(filename, "r"); // Open the input file for reading
-    output_file = fopen("output.csv", "w"); // Open (or create) the output file for writing
-    // Write the CSV header to the output file
-    fprintf(output_file, "released,track_name,artist(s)_name,streams\n");
-
-    // Read each line from the input file until EOF
-    while (fgets(line, MAX_LINE_LEN, input_file) != NULL) {
-        // Process the current line to create a song node
-        node_t *song_info = process_song_details(line);
-        // If the artist name matches, add the song to the list
-        if (strstr(song_info->song->artist_name, artist_name) != NULL) {
-            // Decide the order for adding based on the 'order' argument
-            if(strcmp(order, "DES") == 0){
-                // Add in reverse order
-                list = add_rev_order(list, song_info, order_by);
-            } else {
-                // Add in normal order
-                list = add_inorder(list, song_info, order_by);
-            }
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (list->rows[mid] < start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (size_t i = lo; i < list->count && list->rows[i] < end; i++) {
+        uint32_t row = list->rows[i];
+        if (list->artist == NULL || matcher_find(list->artist, table_artist(table, row))) {
+            out[matches++] = row;
         }
     }
-    // Display the ordered list of songs
-    display_songs_ordered(list, limit, order_by, output_file);
-    // Deallocate memory used by the list and its contents
-    deallocate_memory(list);
-    free(line); // Free the line buffer
-    fclose(input_file); // Close the input file
-    fclose(output_file); // Close the output file
+    return matches;
+}
+
+// Tells whether an artist name of the dictionary contains the searched name
+bool artist_has_name(const char* name, const void* arg) {
+    return matcher_find((const matcher_t *)arg, name);
+}
+
+// Selects the rows in [start, end) whose artist is in the set of those containing the searched name
+size_t select_by_artist(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    const uint64_t *artists = (const uint64_t *)arg;
+    size_t matches = 0;
+
+    for (size_t row = start; row < end; row++) {
+        if (table_artist_in(table, artists, row)) {
+            out[matches++] = (uint32_t)row;
+        }
+    }
+    return matches;
+}
+
+// Selects the rows in [start, end) released in the searched year
+size_t select_by_year(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    int32_t year = *(const int32_t *)arg;
+
+    return filter_range_i32(table->year, start, end, year, year, out);
+}
+
+// Selects the rows in [start, end) whose count lies within a range
+size_t select_by_range(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    const column_range *range = (const column_range *)arg;
+    (void)table;
+
+    if (range->i64 != NULL) {
+        return filter_range_i64(range->i64, start, end, range->lo, range->hi, out);
+    }
+    // The playlist counts are 32-bit, so clamp the bounds to that range
+    if (range->lo > INT32_MAX || range->hi < INT32_MIN) {
+        return 0;
+    }
+    int32_t lo = range->lo < INT32_MIN ? INT32_MIN : (int32_t)range->lo;
+    int32_t hi = range->hi > INT32_MAX ? INT32_MAX : (int32_t)range->hi;
+    return filter_range_i32(range->i32, start, end, lo, hi, out);
+}
+
+// Selects the rows in [start, end) that pass every test of a --where plan
+size_t select_by_where(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    return where_select((const where_plan *)arg, table, start, end, out);
+}
+
+// Selects every row in [start, end), for a grouped query without a filter
+size_t select_all(const song_table* table, size_t start, size_t end, uint32_t* out, const void* arg) {
+    (void)table;
+    (void)arg;
+
+    for (size_t row = start; row < end; row++) {
+        out[row - start] = (uint32_t)row;
+    }
+    return end - start;
+}
+
+// Displays the groups of a grouped query in output order, no more than 'limit' of them unless it is 0
+void display_groups(const song_table* table, const group_spec* spec, const group_entry* groups, size_t count, int limit, out_writer* output_file) {
+    if (limit > 0 && (size_t)limit < count) {
+        count = (size_t)limit;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        const group_entry *group = &groups[i];
+
+        if (spec->column == GROUP_ARTIST) {
+            const char *artist = table->strings + table->artists[group->key];
+            writer_name(output_file, artist, strlen(artist));
+        } else {
+            writer_int(output_file, (int32_t)group->key);
+        }
+        writer_char(output_file, ',');
+        if (spec->fn == AGG_AVG) {
+            writer_printf(output_file, "%.2f", (double)group->sum / (double)group->count);
+        } else {
+            writer_int(output_file, group_total(spec, group));
+        }
+        writer_char(output_file, '\n');
+        output_file->rows++;
+    }
+}
+
+// Folds the matching rows into one group per artist or year, orders the groups and displays them
+void group_and_display(const song_table* table, scan_select_fn select, const void* arg, const args* argument, out_writer* output_file) {
+    group_entry *groups; // Groups in output order
+    size_t count; // Number of groups
+    stats_clock clock; // Times the output stage
+
+    // Fold on every thread, then merge the partial groups
+    groups = group_scan(table, select, arg, argument->threads, &argument->group, &count, argument->metrics);
+    stats_start(&clock);
+    display_groups(table, &argument->group, groups, count, argument->limit, output_file);
+    stats_stop(&clock, &argument->metrics->stages[STAGE_OUTPUT]);
+    argument->metrics->stages[STAGE_OUTPUT].rows_in += count;
+    free(groups);
+}
+
+// Selects the matching rows, orders them on the 'order_by' terms and displays them
+void rank_and_display(const song_table* table, scan_select_fn select, const void* arg, const args* argument, out_writer* output_file) {
+    topk_entry *ranked; // Kept rows in output order
+    size_t count; // Number of kept rows
+    stats_clock clock; // Times the output stage
+
+    // A grouped query displays its groups instead of its songs
+    if (argument->group_by != NULL) {
+        group_and_display(table, select, arg, argument, output_file);
+        return;
+    }
+
+    // Filter and rank on every thread, then merge the partial rankings
+    ranked = scan_rank(table, select, arg, argument->threads, &argument->sort, argument->limit, &count, argument->metrics);
+    // Display the ordered songs
+    stats_start(&clock);
+    display_songs_ordered(table, ranked, count, argument->limit, argument->sort.terms[0].column, output_file);
+    stats_stop(&clock, &argument->metrics->stages[STAGE_OUTPUT]);
+    argument->metrics->stages[STAGE_OUTPUT].rows_in += count;
+    free(ranked);
+}
+
+// Filters and displays songs by artist
+void analyze_songs_by_artist(const song_table* table, const song_index* index, const args* argument, out_writer* output_file){
+    matcher_t artist_name; // Searched name, compiled once for every row
+    row_list candidates = {NULL, 0, &artist_name}; // Rows whose artist may contain the name
+
+    matcher_init(&artist_name, argument->value, argument->ignore_case);
+
+    // The words in the index keep their case, so it cannot serve a search that ignores case
+    if (index != NULL && !argument->ignore_case &&
+        (candidates.rows = index_artist(index, argument->value, &candidates.count)) != NULL) {
+        // Check only the rows sharing a word with the name, then order and display the matching songs
+        rank_and_display(table, select_by_rows, &candidates, argument, output_file);
+        free((uint32_t *)candidates.rows);
+    } else {
+        // Search each distinct artist name once, then order and display the songs of those that contain it
+        uint64_t *artists = table_match_artists(table, artist_has_name, &artist_name);
+        rank_and_display(table, select_by_artist, artists, argument, output_file);
+        free(artists);
+    }
+    matcher_free(&artist_name);
 }
 
 // Filters and displays songs by year
-void analyze_songs_by_year(const char* filename, char* order_by, char* year, int limit, char* order){
-    FILE *input_file, *output_file; // File pointers for reading and writing
-    char *line = NULL; // Buffer for reading lines from the file
-    node_t *list = NULL; // Linked list for storing processed songs
-    line = (char *)malloc(MAX_LINE_LEN * sizeof(char)); // Allocate memory for the line buffer
-
-    if (!line) {
-        fprintf(stderr, "Failed to allocate memory\n"); // Print an error if memory allocation fails
+void analyze_songs_by_year(const song_table* table, const song_index* index, const args* argument, out_writer* output_file){
+    int32_t year_released = atoi(argument->value); // Convert the year string to an integer once for comparison
+
+    if (index != NULL) {
+        // Visit only the rows of that year, then order and display them
+        row_list released = {NULL, 0, NULL};
+        released.rows = index_year(index, year_released, &released.count);
+        rank_and_display(table, select_by_rows, &released, argument, output_file);
+    } else {
+        // Scan only the year column, then order and display the matching songs
+        rank_and_display(table, select_by_year, &year_released, argument, output_file);
+    }
+}
+
+// Parses a range value: "MIN:MAX", "MIN:" or ":MAX" (bounds included), or a single number
+int parse_range(const char* value, int64_t* lo, int64_t* hi) {
+    const char *colon = strchr(value, ':');
+    char *end;
+
+    *lo = INT64_MIN;
+    *hi = INT64_MAX;
+    errno = 0;
+
+    if (colon == NULL) {
+        // A single number matches only itself
+        *lo = *hi = strtoll(value, &end, 10);
+        return (end == value || *end != '\0' || errno != 0) ? -1 : 0;
+    }
+    if (colon != value) {
+        *lo = strtoll(value, &end, 10);
+        if (end != colon || errno != 0) {
+            return -1;
+        }
+    }
+    if (colon[1] != '\0') {
+        *hi = strtoll(colon + 1, &end, 10);
+        if (*end != '\0' || errno != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Picks the column a range filter scans and its bounds, both included
+void set_column_range(const song_table* table, const args* argument, column_range* range) {
+    range->i32 = NULL;
+    range->i64 = NULL;
+    parse_range(argument->value, &range->lo, &range->hi); // Already checked by check_query()
+    if (strcmp(argument->filter, "STREAMS") == 0) {
+        range->i64 = table->streams;
+    } else if (strcmp(argument->filter, "NO_SPOTIFY_PLAYLISTS") == 0) {
+        range->i32 = table->spotify;
+    } else {
+        range->i32 = table->apple;
+    }
+}
+
+// Filters songs whose STREAMS, NO_SPOTIFY_PLAYLISTS or NO_APPLE_PLAYLISTS count is in a range and displays them
+void analyze_songs_by_range(const song_table* table, const args* argument, out_writer* output_file){
+    column_range range; // Column to scan and its bounds, both included
+
+    set_column_range(table, argument, &range);
+
+    // Scan only the filtered column, then order and display the matching songs
+    rank_and_display(table, select_by_range, &range, argument, output_file);
+}
+
+// Filters songs with a --where expression, already parsed into a plan by check_query(), and displays them
+void analyze_songs_where(const song_table* table, const args* argument, out_writer* output_file){
+    // The plan scans the most selective column, then tests only the rows it kept
+    rank_and_display(table, select_by_where, argument->plan, argument, output_file);
+}
+
+// Tells whether a filter selects the songs whose STREAMS, NO_SPOTIFY_PLAYLISTS or NO_APPLE_PLAYLISTS count is in a range
+bool is_range_filter(const char* filter) {
+    return strcmp(filter, "STREAMS") == 0 || strcmp(filter, "NO_SPOTIFY_PLAYLISTS") == 0 ||
+           strcmp(filter, "NO_APPLE_PLAYLISTS") == 0;
+}
+
+// Writes the CSV header of a query, which depends on its filter as well as on the first 'order_by' term
+void write_csv_header(const args* argument, out_writer* output_file) {
+    sort_key column = argument->sort.terms[0].column; // The count that is displayed
+    char header[64]; // Header of a grouped query
+
+    if (argument->group_by != NULL) {
+        // The group and its aggregate
+        group_header(&argument->group, header, sizeof(header));
+        writer_printf(output_file, "%s\n", header);
+    } else if (argument->where != NULL || is_range_filter(argument->filter)) {
+        // Write the CSV header matching the column that is displayed
+        if (column == KEY_STREAMS) {
+            writer_puts(output_file, "released,track_name,artist(s)_name,streams\n");
+        } else if (column == KEY_SPOTIFY) {
+            writer_puts(output_file, "released,track_name,artist(s)_name,in_spotify_playlists\n");
+        } else {
+            writer_puts(output_file, "released,track_name,artist(s)_name,in_apple_playlists\n");
+        }
+    } else if (strcmp(argument->filter, "YEAR") == 0) {
+        // Decide the CSV header based on the 'order_by' criteria
+        if(column == KEY_SPOTIFY){
+            // Header for Spotify playlists count
+            writer_puts(output_file, "released,track_name,artist(s)_name,in_spotify_playlists\n");
+        }
+        else if(column == KEY_APPLE){
+            // Header for Apple playlists count
+            writer_puts(output_file, "released,track_name,artist(s)_name,in_apple_playlists\n");
+        }
+        else{
+            // Default header (used for Apple playlists count here but can be adjusted)
+            writer_puts(output_file, "released,track_name,artist(s)_name,in_apple_playlists\n");
+        }
+    } else {
+        // Write the CSV header to the output file
+        writer_puts(output_file, "released,track_name,artist(s)_name,streams\n");
+    }
+}
+
+// Number of songs a query displays at most: as in the display functions, a zero limit means all of them for STREAMS and none otherwise
+size_t output_cap(const args* argument) {
+    if (argument->sort.terms[0].column == KEY_STREAMS && argument->limit == 0) {
+        return SIZE_MAX;
+    }
+    return (size_t)argument->limit;
+}
+
+// Columns of the input the filter of a checked query reads
+unsigned filter_columns(const args* argument) {
+    sort_key column; // Column of a range filter
+
+    if (argument->where != NULL) {
+        return where_columns(argument->plan);
+    }
+    if (argument->filter == NULL) {
+        return 0; // A grouped query may fold every song
+    }
+    if (strcmp(argument->filter, "YEAR") == 0) {
+        return FIELD_BIT(FIELD_YEAR);
+    }
+    if (is_range_filter(argument->filter)) {
+        sort_column(argument->filter, strlen(argument->filter), &column); // The range filters are named like the order_by fields
+        return sort_key_columns(column);
+    }
+    return FIELD_BIT(FIELD_ARTIST);
+}
+
+// Columns of the input a checked query reads: those of its filter and its ordering, and the displayed ones
+unsigned query_columns(const args* argument) {
+    if (argument->group_by != NULL) {
+        return filter_columns(argument) | group_columns(&argument->group);
+    }
+    return filter_columns(argument) | sort_columns(&argument->sort) | OUTPUT_COLUMNS;
+}
+
+// Tells whether the artist of a streamed row contains the searched name
+bool stream_by_artist(const stream_row* row, const void* arg) {
+    return matcher_find_n((const matcher_t *)arg, row->artist.ptr, row->artist.len);
+}
+
+// Tells whether a streamed row was released in the searched year
+bool stream_by_year(const stream_row* row, const void* arg) {
+    return row->year == *(const int32_t *)arg;
+}
+
+// Tells whether the filtered count of a streamed row lies within a range
+bool stream_by_range(const stream_row* row, const void* arg) {
+    const stream_range *range = (const stream_range *)arg;
+    int64_t value = range->column == KEY_STREAMS ? row->streams : range->column == KEY_SPOTIFY ? row->spotify : row->apple;
+
+    return value >= range->lo && value <= range->hi;
+}
+
+// Tells whether a streamed row passes every test of a --where plan
+bool stream_by_where(const stream_row* row, const void* arg) {
+    return where_match((const where_plan *)arg, row);
+}
+
+// Opens the output file or stdout, or exits with an error
+void open_output(out_writer* output_file, const args* argument) {
+    if (writer_open(output_file, argument->output) != 0) {
+        perror("Failed to open output file");
+        exit(1);
+    }
+}
+
+// Flushes and closes the output, or exits with an error
+void close_output(out_writer* output_file) {
+    if (writer_close(output_file) != 0) {
+        perror("Failed to write output");
+        exit(1);
+    }
+}
+
+// Filters and displays songs straight from the input file, holding at most --max-memory bytes of matches
+void stream_songs(const args* argument) {
+    csv_reader reader; // Reader over the input file, filled on a thread of its own
+    out_writer output_file; // Buffered writer for the results
+    matcher_t artist_name; // Searched name for an artist filter
+    int32_t year_released; // Searched year for a year filter
+    stream_range range; // Column and bounds for a range filter
+    stream_filter_fn filter; // Predicate a row must satisfy
+    const void *filter_arg; // Its argument
+    int status; // Outcome of the streamed query
+    stats_clock clock; // Times the stages run here
+    stage_stats *output = &argument->metrics->stages[STAGE_OUTPUT]; // Metrics of the output stage
+    csv_bad_value bad; // First malformed number the query reads, if any
+    size_t reading = argument->max_memory / STREAM_READ_SHARE; // Part of the budget the file is read through
+
+    stats_start(&clock);
+    if (csv_open_stream(&reader, argument->data, reading) != 0) {
+        perror("Failed to open data file");
+        exit(1);
+    }
+    stats_stop(&clock, &argument->metrics->stages[STAGE_LOAD]);
+    argument->metrics->stages[STAGE_LOAD].bytes += file_size(argument->data); // The reader only holds a block at a time
+    if (argument->where != NULL) {
+        filter = stream_by_where;
+        filter_arg = argument->plan;
+    } else if (strcmp(argument->filter, "YEAR") == 0) {
+        year_released = atoi(argument->value);
+        filter = stream_by_year;
+        filter_arg = &year_released;
+    } else if (is_range_filter(argument->filter)) {
+        sort_column(argument->filter, strlen(argument->filter), &range.column); // The range filters are named like the order_by fields
+        parse_range(argument->value, &range.lo, &range.hi); // Already checked by check_query()
+        filter = stream_by_range;
+        filter_arg = &range;
+    } else {
+        matcher_init(&artist_name, argument->value, argument->ignore_case);
+        filter = stream_by_artist;
+        filter_arg = &artist_name;
+    }
+
+    open_output(&output_file, argument); // Open (or create) the output file for writing
+    write_csv_header(argument, &output_file);
+    status = stream_query(&reader, filter, filter_arg, filter_columns(argument), &argument->sort, output_cap(argument),
+                          argument->max_memory - reading, &output_file, argument->metrics, &bad);
+    if (status != 0 && errno == EINVAL) {
+        exit_bad_value(&bad, argument->data);
+    }
+    if (status == 0 && csv_error(&reader) != 0) {
+        errno = csv_error(&reader);
+        perror("Failed to read data file");
+        exit(1);
+    }
+    if (status != 0) {
+        perror("Failed to sort matching songs");
+        exit(1);
+    }
+    output->rows_in += output_file.rows; // Rows are written as they are sorted, so every one that came out went in
+    output->rows_out += output_file.rows;
+    stats_start(&clock);
+    close_output(&output_file); // Flush and close the output file
+    stats_stop(&clock, output);
+    output->bytes += output_file.bytes;
+
+    if (filter == stream_by_artist) {
+        matcher_free(&artist_name);
+    }
+    csv_close(&reader);
+}
+
+// Parses a size in bytes with an optional K, M or G suffix
+int parse_size(const char* value, size_t* size) {
+    char *end;
+    unsigned long long n;
+
+    errno = 0;
+    n = strtoull(value, &end, 10);
+    if (end == value || errno != 0 || *value == '-') {
+        return -1;
+    }
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; // Fall through
+    case 'M': case 'm': n <<= 10; // Fall through
+    case 'K': case 'k': n <<= 10; end++; break;
+    default: break;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    *size = (size_t)n;
+    return 0;
+}
+
+// Checks that a query has every argument it needs, a well-formed value and a well-formed ordering, describing the problem otherwise
+bool check_query(args* argument, char* error, size_t size) {
+    int64_t lo, hi; // Bounds of a range value
+    bool filtered = argument->filter != NULL || argument->value != NULL; // Whether --filter or --value is given
+
+    if (argument->where != NULL && filtered) {
+        snprintf(error, size, "Use either --where or --filter and --value, not both.");
+        return false;
+    }
+    if (argument->agg != NULL && argument->group_by == NULL) {
+        snprintf(error, size, "--agg needs --group_by.");
+        return false;
+    }
+    // A grouped query may leave out the filter, to fold every song
+    if ((argument->where == NULL && (argument->filter == NULL || argument->value == NULL) &&
+         (argument->group_by == NULL || filtered)) ||
+        argument->order_by == NULL || argument->order == NULL) {
+        snprintf(error, size, "Insufficient arguments provided.");
+        return false;
+    }
+    if (argument->where == NULL && argument->filter != NULL && is_range_filter(argument->filter) &&
+        parse_range(argument->value, &lo, &hi) != 0) {
+        snprintf(error, size, "Invalid range \"%s\" for filter %s (expected MIN:MAX).", argument->value, argument->filter);
+        return false;
+    }
+    if (argument->group_by != NULL) {
+        // A grouped query orders its groups, on the aggregate or on the groups themselves
+        argument->sort.count = 0;
+        argument->sort.unordered = false;
+        if (group_parse(&argument->group, argument->group_by, argument->agg) != 0) {
+            snprintf(error, size, "Invalid group_by \"%s\" or agg \"%s\" (expected ARTIST or YEAR, and SUM, COUNT, AVG or MAX "
+                     "of STREAMS, NO_SPOTIFY_PLAYLISTS or NO_APPLE_PLAYLISTS).", argument->group_by,
+                     argument->agg != NULL ? argument->agg : "COUNT");
+            return false;
+        }
+        if (group_order(&argument->group, argument->order_by, argument->order) != 0) {
+            snprintf(error, size, "Invalid order_by \"%s\" for a grouped query (expected %s or the --agg expression).",
+                     argument->order_by, argument->group_by);
+            return false;
+        }
+    } else if (sort_parse(&argument->sort, argument->order_by, argument->order) != 0) {
+        // The ordering is parsed once, so that sorting never looks at the strings again
+        snprintf(error, size, "Invalid order_by \"%s\" (expected up to %d fields such as \"STREAMS DES, TRACK_NAME ASC\").",
+                 argument->order_by, SORT_MAX_TERMS);
+        return false;
+    }
+    // Likewise the --where expression is compiled once into a plan
+    if (argument->where != NULL) {
+        argument->plan = (where_plan *)emalloc(sizeof(where_plan));
+        if (where_parse(argument->plan, argument->where, argument->ignore_case, error, size) != 0) {
+            free_query(argument);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Releases the --where plan that check_query() compiled, if any
+void free_query(args* argument) {
+    if (argument->plan != NULL) {
+        where_free(argument->plan);
+        free(argument->plan);
+        argument->plan = NULL;
+    }
+}
+
+// Finishes the metrics of a query and prints them on stderr if --stats asked for them
+void report_stats(query_stats* metrics, const args* argument) {
+    stats_finish(metrics);
+    stats_print(metrics, argument->stats, stderr);
+}
+
+// Runs a query that passed check_query() and writes the CSV header and the matching songs
+void run_query(const song_table* table, const song_index* index, const args* argument, out_writer* output_file) {
+    stage_stats *output = &argument->metrics->stages[STAGE_OUTPUT]; // Metrics of the output stage
+    uint64_t rows = output_file->rows; // Songs the writer had written before this query
+    uint64_t bytes = output_file->bytes + output_file->used; // Bytes it had been handed before this query
+
+    write_csv_header(argument, output_file);
+
+    // Determine the filter type and call the appropriate analysis function
+    if (argument->where == NULL && argument->filter == NULL) {
+        // Fold every song of a grouped query
+        rank_and_display(table, select_all, NULL, argument, output_file);
+    } else if (argument->where != NULL) {
+        // Filter and display songs that pass every test of the --where expression
+        analyze_songs_where(table, argument, output_file);
+    } else if (strcmp(argument->filter, "YEAR") == 0) {
+        // Filter and display songs by year
+        analyze_songs_by_year(table, index, argument, output_file);
+    } else if (is_range_filter(argument->filter)) {
+        // Filter and display songs whose count is within --value="MIN:MAX"
+        analyze_songs_by_range(table, argument, output_file);
+    } else {
+        // Filter and display songs by artist
+        analyze_songs_by_artist(table, index, argument, output_file);
+    }
+    output->rows_out += output_file->rows - rows;
+    output->bytes += output_file->bytes + output_file->used - bytes;
+}
+
+// Splits a request (query arguments, each starting with "--", separated by single spaces) and stores them over the
+// defaults, whose query arguments are cleared first; a batch query may also name its --output file
+bool parse_request(args* argument, char* request, bool batch, char* error, size_t size) {
+    char *words[MAX_REQUEST_ARGS]; // The arguments of the request
+    int count = 0; // Number of arguments
+
+    // Split before every " --", so that values may contain spaces
+    while (count < MAX_REQUEST_ARGS) {
+        char *next = strstr(request, " --");
+        words[count++] = request;
+        if (next == NULL) {
+            break;
+        }
+        *next = '\0';
+        request = next + 1;
+    }
+    if (count == MAX_REQUEST_ARGS && strstr(request, " --") != NULL) {
+        snprintf(error, size, "Too many arguments.");
+        return false;
+    }
+
+    argument->filter = argument->value = argument->order_by = argument->order = argument->where = NULL;
+    argument->group_by = argument->agg = NULL;
+    argument->plan = NULL;
+    argument->limit = 0;
+    for (int i = 0; i < count; i++) {
+        if (batch && strncmp(words[i], "--output=", 9) == 0) {
+            argument->output = words[i] + 9;
+        } else if (set_argument(argument, words[i], true, error, size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Answers one server request
+void answer_request(char* request, out_writer* out, void* ctx) {
+    const query_context *context = (const query_context *)ctx;
+    args argument = *context->defaults; // Query arguments, on top of the server's own
+    char error[ERROR_LEN]; // Description of a bad request
+    query_stats metrics; // Metrics of this request
+
+    if (!parse_request(&argument, request, false, error, sizeof(error)) || !check_query(&argument, error, sizeof(error))) {
+        writer_printf(out, "ERROR: %s\n", error);
         return;
     }
+    stats_init(&metrics);
+    argument.metrics = &metrics;
+    run_query(context->table, context->index, &argument, out);
+    report_stats(&metrics, &argument);
+    free_query(&argument);
+}
+
+// Loads the dataset and its index once, then answers queries on a Unix domain socket until interrupted
+void serve_songs(args argument) {
+    song_table table; // Columnar copy of the dataset
+    song_index index; // Secondary indexes of the dataset, if built
+    query_context context; // Shared by every request
+
+    load_song_data(&table, &argument, ALL_COLUMNS); // Later requests may read any column
+    context.table = &table;
+    context.index = load_song_index(&index, &table, &argument) ? &index : NULL;
+    context.defaults = &argument;
+
+    if (server_run(argument.serve, answer_request, &context) != 0) {
+        perror("Failed to serve queries");
+        exit(1);
+    }
+
+    if (context.index != NULL) {
+        index_close(&index);
+    }
+    table_free(&table);
+}
+
+// Reads the queries of a batch file, one request per line; blank lines and lines starting with '#' are skipped
+size_t read_batch(const args* argument, char** text, batch_query** queries) {
+    FILE *file = fopen(argument->batch, "r"); // The batch file
+    size_t len = 0, cap = 4096; // Bytes read and room for them
+    size_t count = 0, room = 0; // Queries read and room for them
+    size_t line_number = 0; // Line of the query being read
+    char error[ERROR_LEN]; // Description of a bad query
+    char *line, *next; // Current and next line
 
-    input_file = fopen(filename, "r"); // Open the input file for reading
-    output_file = fopen("output.csv", "w"); // Open (or create) the output file for writing
-
-    // Decide the CSV header based on the 'order_by' criteria
-    if(strcmp(order_by, "NO_SPOTIFY_PLAYLISTS")==0){
-        // Header for Spotify playlists count
-        fprintf(output_file, "released,track_name,artist(s)_name,in_spotify_playlists\n");
-    }
-    else if(strcmp(order_by, "NO_APPLE_PLAYLISTS")==0){
-        // Header for Apple playlists count
-        fprintf(output_file, "released,track_name,artist(s)_name,in_apple_playlists\n");
-    }
-    else{
-        // Default header (used for Apple playlists count here but can be adjusted)
-        fprintf(output_file, "released,track_name,artist(s)_name,in_apple_playlists\n");
-    }
-
-    // Read each line from the input file until EOF
-    while (fgets(line, MAX_LINE_LEN, input_file) != NULL) {
-        // Process the current line to create a song node
-        node_t *song_info = process_song_details(line);
-        // Convert the year string to an integer for comparison
-        int year_released = atoi(year);
-        // If the song's year matches the specified year, add it to the list
-        if (song_info->song->year == year_released) {
-            // Decide the order for adding based on the 'order' argument
-            if(strcmp(order, "DES") == 0){
-                // Add in reverse order
-                list = add_rev_order(list, song_info, order_by);
-            } else {
-                // Add in normal order
-                list = add_inorder(list, song_info, order_by);
-            }
+    if (file == NULL) {
+        perror("Failed to open batch file");
+        exit(1);
+    }
+    // Keep the whole file: the arguments of every query point into it
+    *text = (char *)emalloc(cap);
+    while ((len += fread(*text + len, 1, cap - len - 1, file)) == cap - 1) {
+        cap *= 2;
+        *text = (char *)erealloc(*text, cap);
+    }
+    fclose(file);
+    (*text)[len] = '\0';
+
+    *queries = NULL;
+    for (line = *text; line != NULL; line = next) {
+        next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        line_number++;
+        line[strcspn(line, "\r")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (count == room) {
+            room = room == 0 ? 16 : room * 2;
+            *queries = (batch_query *)erealloc(*queries, room * sizeof(batch_query));
+        }
+        batch_query *query = &(*queries)[count++];
+        query->query = *argument;
+        query->query.output = NULL; // Numbered after the query unless the line names a file
+        if (!parse_request(&query->query, line, true, error, sizeof(error)) ||
+            !check_query(&query->query, error, sizeof(error))) {
+            fprintf(stderr, "%s:%zu: %s\n", argument->batch, line_number, error);
+            exit(1);
+        }
+        if (query->query.group_by != NULL) {
+            // The shared scan ranks songs; a grouped query folds them on its own
+            fprintf(stderr, "%s:%zu: --group_by cannot be used in a batch.\n", argument->batch, line_number);
+            exit(1);
         }
     }
-    // Display the ordered list of songs
-    display_songs_ordered(list, limit, order_by, output_file);
-    // Deallocate memory used by the list and its contents
-    deallocate_memory(list);
-    free(line); // Free the line buffer
-    fclose(input_file); // Close the input file
-    fclose(output_file); // Close the output file
+    return count;
 }
 
-// Parses command-line arguments into a structured form
+// Picks the function that selects the rows of a batch query, and prepares what it reads
+void prepare_batch_query(const song_table* table, batch_query* query) {
+    const args *argument = &query->query; // Arguments of the query
+
+    query->artists = NULL;
+    if (argument->where != NULL) {
+        query->select = select_by_where;
+        query->select_arg = argument->plan;
+    } else if (strcmp(argument->filter, "YEAR") == 0) {
+        query->year = atoi(argument->value);
+        query->select = select_by_year;
+        query->select_arg = &query->year;
+    } else if (is_range_filter(argument->filter)) {
+        set_column_range(table, argument, &query->range);
+        query->select = select_by_range;
+        query->select_arg = &query->range;
+    } else {
+        // Search each distinct artist once, as analyze_songs_by_artist() does
+        matcher_t artist_name; // Searched name
+        matcher_init(&artist_name, argument->value, argument->ignore_case);
+        query->artists = table_match_artists(table, artist_has_name, &artist_name);
+        matcher_free(&artist_name);
+        query->select = select_by_artist;
+        query->select_arg = query->artists;
+    }
+}
+
+// Loads the columns every query of a batch reads once, ranks the matches of all of them in a single scan and writes
+// each query to its own file; the scan uses the threads of the batch, not those a query asks for
+void batch_songs(args argument) {
+    song_table table; // Columnar copy of the dataset
+    char *text; // Contents of the batch file
+    batch_query *queries; // The queries of the batch
+    size_t count; // Number of queries
+    scan_query *scans; // What the shared scan needs of every query, and what it found
+    unsigned columns = 0; // Columns any query reads
+    query_stats metrics; // Metrics of the whole batch
+    stats_clock clock; // Times the stages run here
+
+    stats_init(&metrics);
+    argument.metrics = &metrics;
+    count = read_batch(&argument, &text, &queries);
+    for (size_t i = 0; i < count; i++) {
+        columns |= query_columns(&queries[i].query);
+    }
+
+    stats_start(&clock);
+    load_song_data(&table, &argument, columns);
+    stats_stop(&clock, &metrics.stages[STAGE_LOAD]);
+    metrics.stages[STAGE_LOAD].rows_in = metrics.stages[STAGE_LOAD].rows_out = table.rows;
+    metrics.stages[STAGE_LOAD].bytes = file_size(argument.data);
+
+    scans = (scan_query *)emalloc((count + 1) * sizeof(scan_query));
+    for (size_t i = 0; i < count; i++) {
+        prepare_batch_query(&table, &queries[i]);
+        scans[i].select = queries[i].select;
+        scans[i].arg = queries[i].select_arg;
+        scans[i].spec = &queries[i].query.sort;
+        scans[i].limit = queries[i].query.limit;
+    }
+    scan_rank_batch(&table, scans, count, argument.threads, &metrics);
+
+    for (size_t i = 0; i < count; i++) {
+        args *query = &queries[i].query; // Arguments of the query
+        char numbered[32]; // Output file of a query that names none
+        out_writer output_file; // Buffered writer for its results
+
+        if (query->output == NULL) {
+            snprintf(numbered, sizeof(numbered), "output_%zu.csv", i + 1);
+            query->output = numbered;
+        }
+        stats_start(&clock);
+        open_output(&output_file, query);
+        write_csv_header(query, &output_file);
+        display_songs_ordered(&table, scans[i].ranked, scans[i].count, query->limit, query->sort.terms[0].column,
+                              &output_file);
+        close_output(&output_file);
+        stats_stop(&clock, &metrics.stages[STAGE_OUTPUT]);
+        metrics.stages[STAGE_OUTPUT].rows_in += scans[i].count;
+        metrics.stages[STAGE_OUTPUT].rows_out += output_file.rows;
+        metrics.stages[STAGE_OUTPUT].bytes += output_file.bytes;
+
+        free(scans[i].ranked);
+        free(queries[i].artists);
+        free_query(query);
+    }
+    report_stats(&metrics, &argument);
+
+    free(scans);
+    free(queries);
+    free(text);
+    table_free(&table);
+}
+
+// Stores one argument of the form --name=value; a server request may only set the query arguments
+int set_argument(args* argument, char* arg, bool request, char* error, size_t size) {
+    char *name = arg;
+    char *value = strchr(name, '=');
+
+    if (strncmp(name, "--", 2) != 0 || value == NULL) {
+        snprintf(error, size, "Invalid argument: %s", arg);
+        return -1;
+    }
+    *value++ = '\0'; // Split the argument into its name and its value
+    name += 2;
+
+    if (strcmp(name, "filter") == 0) {
+        argument->filter = value;
+    } else if (strcmp(name, "value") == 0) {
+        argument->value = value;
+    } else if (strcmp(name, "order_by") == 0) {
+        argument->order_by = value;
+    } else if (strcmp(name, "order") == 0) {
+        argument->order = value;
+    } else if (strcmp(name, "limit") == 0) {
+        argument->limit = atoi(value);
+    } else if (strcmp(name, "threads") == 0) {
+        argument->threads = atoi(value);
+        if (argument->threads < 1 || argument->threads > MAX_THREADS) {
+            snprintf(error, size, "--threads must be between 1 and %d.", MAX_THREADS);
+            return -1;
+        }
+    } else if (strcmp(name, "where") == 0) {
+        argument->where = value;
+    } else if (strcmp(name, "ignore-case") == 0) {
+        argument->ignore_case = strcmp(value, "YES") == 0;
+    } else if (strcmp(name, "group_by") == 0) {
+        argument->group_by = value;
+    } else if (strcmp(name, "agg") == 0) {
+        argument->agg = value;
+    } else if (request) {
+        // The dataset and the modes are fixed when the server starts
+        snprintf(error, size, "Unknown argument: --%s", name);
+        return -1;
+    } else if (strcmp(name, "data") == 0) {
+        argument->data = value;
+    } else if (strcmp(name, "build-snapshot") == 0) {
+        argument->build_snapshot = value;
+    } else if (strcmp(name, "build-index") == 0) {
+        argument->build_index = strcmp(value, "YES") == 0;
+    } else if (strcmp(name, "index") == 0) {
+        argument->use_index = strcmp(value, "NO") != 0;
+    } else if (strcmp(name, "verify") == 0) {
+        argument->verify = strcmp(value, "YES") == 0;
+    } else if (strcmp(name, "max-memory") == 0) {
+        if (parse_size(value, &argument->max_memory) != 0 || argument->max_memory < STREAM_MIN_MEMORY) {
+            snprintf(error, size, "--max-memory must be a size of at least 1M, such as 64M or 2G.");
+            return -1;
+        }
+    } else if (strcmp(name, "serve") == 0) {
+        argument->serve = value;
+    } else if (strcmp(name, "batch") == 0) {
+        argument->batch = value;
+    } else if (strcmp(name, "cache") == 0) {
+        argument->use_cache = strcmp(value, "YES") == 0;
+    } else if (strcmp(name, "cache-size") == 0) {
+        if (parse_size(value, &argument->cache_size) != 0 || argument->cache_size == 0) {
+            snprintf(error, size, "--cache-size must be a size such as 64M or 1G.");
+            return -1;
+        }
+    } else if (strcmp(name, "output") == 0) {
+        argument->output = value;
+    } else if (strcmp(name, "stats") == 0) {
+        argument->stats = strcmp(value, "JSON") == 0 ? STATS_JSON : strcmp(value, "YES") == 0 ? STATS_TEXT : STATS_OFF;
+    } else {
+        snprintf(error, size, "Unknown argument: --%s", name);
+        return -1;
+    }
+    return 0;
+}
+
+// Parses command-line arguments of the form --name=value into a structured form
 args parse_arguments(int argc, char *argv[]) {
     args argument; // Structure to hold parsed arguments
+    char error[ERROR_LEN]; // Description of a bad argument
 
     // Initialize with default values
     argument.data = NULL;
@@ -253,51 +1129,197 @@ args parse_arguments(int argc, char *argv[]) {
     argument.order_by = NULL;
     argument.order = NULL;
     argument.limit = 0; // Default limit
+    argument.threads = 1; // Default to a single-threaded scan
+    argument.build_snapshot = NULL; // Default to running a query
+    argument.verify = false; // Default to trusting the payload of snapshots
+    argument.build_index = false; // Default to running a query
+    argument.use_index = true; // Default to using the index of the input file when there is one
+    argument.ignore_case = false; // Default to matching artist names exactly as typed
+    argument.serve = NULL; // Default to answering the query on the command line
+    argument.max_memory = 0; // Default to loading the whole dataset
+    argument.output = "output.csv"; // Default output file; "-" writes to stdout
+    argument.where = NULL; // Default to --filter and --value
+    argument.plan = NULL; // Compiled by check_query()
+    argument.stats = STATS_OFF; // Default to collecting the metrics of the query without printing them
+    argument.metrics = NULL; // Set up by whatever runs the query
+    argument.batch = NULL; // Default to answering the query on the command line
+    argument.use_cache = false; // Default to running every query in full
+    argument.cache_size = CACHE_DEFAULT_SIZE; // Default cap on the results kept by --cache=YES
+    argument.group_by = NULL; // Default to displaying songs rather than groups
+    argument.agg = NULL; // Default to counting the songs of each group
+
+    // Parse each argument and store in the 'argument' structure
+    for (int i = 1; i < argc; i++) {
+        if (set_argument(&argument, argv[i], false, error, sizeof(error)) != 0) {
+            fprintf(stderr, "%s\n", error);
+            exit(1);
+        }
+    }
 
-    //Check if the minimum number of arguments is provided
-    if (argc < 6) {
+    //Check if the arguments needed by the requested mode are provided
+    if (argument.data == NULL) {
         fprintf(stderr, "Insufficient arguments provided.\n");
-        exit(1); // Exit if not enough arguments are provided
-     }
+        exit(1);
+    }
+    if (argument.batch != NULL && argument.max_memory > 0) {
+        fprintf(stderr, "Use either --batch or --max-memory, not both.\n");
+        exit(1);
+    }
+    if (argument.group_by != NULL && argument.max_memory > 0) {
+        fprintf(stderr, "Use either --group_by or --max-memory, not both.\n");
+        exit(1);
+    }
+    if (argument.build_snapshot == NULL && !argument.build_index && argument.serve == NULL && argument.batch == NULL &&
+        !check_query(&argument, error, sizeof(error))) {
+        fprintf(stderr, "%s\n", error);
+        exit(1);
+    }
 
-    // Parse each argument and store in the 'argument' structure
-    
-	char *temp;
-    temp = strtok(argv[1], "=");
-    argument.data = strtok(NULL, "=");
+    return argument; // Return the populated 'argument' structure
+}
 
-    temp = strtok(argv[2], "=");
-    argument.filter = strtok(NULL, "=");
+// Describes what a checked query writes: queries that print the same rows read the same, whatever the threads or indexes
+char* query_key(const args* argument) {
+    char order[SORT_MAX_TERMS * 16 + 8] = ""; // The parsed ordering
+    char grouping[32] = ""; // The parsed grouping, if any
+    size_t used = 0; // Length of the ordering
+    char *key; // The description
+    int n; // Its length
 
-    temp = strtok(argv[3], "=");
-    argument.value = strtok(NULL, "=");
+    for (size_t i = 0; i < argument->sort.count; i++) {
+        used += (size_t)snprintf(order + used, sizeof(order) - used, "%d%c,", (int)argument->sort.terms[i].column,
+                                 argument->sort.terms[i].descending ? 'D' : 'A');
+    }
+    snprintf(order + used, sizeof(order) - used, "%s", argument->sort.unordered ? "none" : "");
+
+    if (argument->group_by != NULL) {
+        // The ordering of a grouped query is in its group descriptor
+        snprintf(order, sizeof(order), "%d%c%s", (int)argument->group.by_group, argument->group.descending ? 'D' : 'A',
+                 argument->group.unordered ? "none" : "");
+        snprintf(grouping, sizeof(grouping), "%d,%d,%d", (int)argument->group.column, (int)argument->group.fn,
+                 (int)argument->group.value);
+    }
+
+    n = snprintf(NULL, 0, "where=%s\nfilter=%s\nvalue=%s\norder=%s\nlimit=%d\nignore_case=%d\ngroup=%s\n",
+                 argument->where ? argument->where : "", argument->filter ? argument->filter : "",
+                 argument->value ? argument->value : "", order, argument->limit, (int)argument->ignore_case,
+                 grouping);
+    key = (char *)emalloc((size_t)n + 1);
+    snprintf(key, (size_t)n + 1, "where=%s\nfilter=%s\nvalue=%s\norder=%s\nlimit=%d\nignore_case=%d\ngroup=%s\n",
+             argument->where ? argument->where : "", argument->filter ? argument->filter : "",
+             argument->value ? argument->value : "", order, argument->limit, (int)argument->ignore_case,
+             grouping);
+    return key;
+}
 
-    temp = strtok(argv[4], "=");
-    argument.order_by = strtok(NULL, "=");
+// Copies the results of a query from the cache to its output if they are there; on a miss, *pending names the file the
+// query should be written to instead (NULL if the cache cannot be used at all)
+bool fetch_cached(const args* argument, result_cache* cache, uint64_t* key, char** pending) {
+    uint64_t fingerprint; // Fingerprint of the data file
+    char *query; // What the query writes
+    int found; // Outcome of the lookup
 
-    temp = strtok(argv[5], "=");
-    argument.order = strtok(NULL, "=");
-	
-	argument.limit = 0;
-    // If a limit argument is provided, parse and store it
-    if (argc == 7) {
-        temp = strtok(argv[6], "=");
-        argument.limit = atoi(strtok(NULL, "="));
+    *pending = NULL;
+    if (!argument->use_cache || cache_open(cache, argument->cache_size) != 0) {
+        return false;
     }
+    if (cache_fingerprint(argument->data, &fingerprint) != 0) {
+        cache_close(cache);
+        return false;
+    }
+    query = query_key(argument);
+    *key = cache_key(fingerprint, query);
+    free(query);
 
-    return argument; // Return the populated 'argument' structure
+    found = cache_fetch(cache, *key, argument->output);
+    if (found < 0) {
+        perror("Failed to write output");
+        exit(1);
+    }
+    if (found == 0) {
+        *pending = cache_begin(cache, *key);
+    }
+    if (found > 0 || *pending == NULL) {
+        cache_close(cache);
+    }
+    return found > 0;
+}
+
+// Copies the results of a query, written to the pending file, to the output, then adds them to the cache
+void store_cached(result_cache* cache, uint64_t key, char* pending, const char* output) {
+    // Copied before the commit: once the entry is in place, another process's sweep may remove it
+    if (cache_copy(pending, output) != 0) {
+        perror("Failed to write output");
+        exit(1);
+    }
+    if (cache_commit(cache, key, pending) != 0) {
+        // The results are still good even if they cannot be kept
+        unlink(pending);
+    }
+    free(pending);
+    cache_close(cache);
 }
 
 // Processes arguments and filters songs accordingly
 void process_arguments_and_filter_songs(args argument) {
-    // Determine the filter type and call the appropriate analysis function
-    if (strcmp(argument.filter, "YEAR") == 0) {
-        // Filter and display songs by year
-        analyze_songs_by_year(argument.data, argument.order_by, argument.value, argument.limit, argument.order);
+    song_table table; // Columnar copy of the dataset
+    song_index index; // Secondary indexes of the dataset, if built
+    bool indexed; // Whether the index could be used
+    out_writer output_file; // Buffered writer for the results
+    query_stats metrics; // Metrics of the query
+    stats_clock clock; // Times the stages run here
+    result_cache cache; // Results of earlier queries
+    uint64_t key; // Entry of this query in the cache
+    char *pending; // File the results go to before they join the cache, if they will
+    const char *output = argument.output; // Where the results finally go
+
+    stats_init(&metrics);
+    argument.metrics = &metrics;
+
+    // Identical queries on an unchanged dataset are copied from the cache
+    stats_start(&clock);
+    if (fetch_cached(&argument, &cache, &key, &pending)) {
+        stats_stop(&clock, &metrics.stages[STAGE_OUTPUT]);
+        report_stats(&metrics, &argument);
+        free_query(&argument);
+        return;
+    }
+    stats_stop(&clock, &metrics.stages[STAGE_LOAD]);
+    if (pending != NULL) {
+        argument.output = pending;
+    }
+
+    if (argument.max_memory > 0 && !snapshot_probe(argument.data)) {
+        // A memory budget streams the file instead; a snapshot is mapped, not loaded, so it needs no budget
+        stream_songs(&argument);
     } else {
-        // Filter and display songs by artist
-        analyze_songs_by_artist(argument.data, argument.order_by, argument.value, argument.limit, argument.order);
+        // Load the columns the query reads, and the index of the dataset if it has an up-to-date one
+        stats_start(&clock);
+        load_song_data(&table, &argument, query_columns(&argument));
+        indexed = load_song_index(&index, &table, &argument);
+        stats_stop(&clock, &metrics.stages[STAGE_LOAD]);
+        metrics.stages[STAGE_LOAD].rows_in = metrics.stages[STAGE_LOAD].rows_out = table.rows;
+        metrics.stages[STAGE_LOAD].bytes = file_size(argument.data);
+
+        open_output(&output_file, &argument); // Open (or create) the output file for writing
+        run_query(&table, indexed ? &index : NULL, &argument, &output_file);
+        stats_start(&clock);
+        close_output(&output_file); // Flush and close the output file
+        stats_stop(&clock, &metrics.stages[STAGE_OUTPUT]);
+
+        if (indexed) {
+            index_close(&index);
+        }
+        table_free(&table);
+    }
+
+    if (pending != NULL) {
+        stats_start(&clock);
+        store_cached(&cache, key, pending, output);
+        stats_stop(&clock, &metrics.stages[STAGE_OUTPUT]);
     }
+    report_stats(&metrics, &argument);
+    free_query(&argument);
 }
 
 // Entry point of the program
@@ -305,6 +1327,29 @@ int main(int argc, char *argv[]) {
     // Parse the command-line arguments
     args argument = parse_arguments(argc, argv);
 
+    if (argument.build_snapshot != NULL || argument.build_index) {
+        // Convert or index the dataset instead of running a query
+        if (argument.build_snapshot != NULL) {
+            build_snapshot(&argument);
+        }
+        if (argument.build_index) {
+            build_index(&argument);
+        }
+        return 0;
+    }
+
+    if (argument.serve != NULL) {
+        // Answer queries from clients instead of the command line
+        serve_songs(argument);
+        return 0;
+    }
+
+    if (argument.batch != NULL) {
+        // Answer every query of the batch file in one pass over the dataset
+        batch_songs(argument);
+        return 0;
+    }
+
     // Process the arguments to filter and display songs accordingly
     process_arguments_and_filter_songs(argument);
 
@@ -0,0 +1,284 @@
+/** @file songbench.c
+ *  @brief Times each stage of song_analyzer queries on a dataset.
+ *
+ *  The dataset is loaded once (the ingest stage), and then every pairing
+ *  of a filter with an order_by column and a limit is run through the
+ *  same modules song_analyzer uses: the filter selects the rows, the
+ *  top-K engine orders them (sort) and the writer formats them to
+ *  /dev/null (output). Each stage is timed on its own and reported in
+ *  milliseconds and in rows per second, the best of --repeat runs, with
+ *  the peak resident set size of the process at the end.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "csv.h"
+#include "emalloc.h"
+#include "sortkey.h"
+#include "table.h"
+#include "topk.h"
+#include "where.h"
+#include "writer.h"
+
+#define EXPR_LEN 256 // Room for a generated --where expression
+#define YEAR_SLOTS 4096 // Years counted when looking for the most common one
+
+// Options of a benchmark run
+typedef struct {
+    char *data;
+    int threads;
+    int repeat;
+} bench_args;
+
+// Best time of each stage of one query
+typedef struct {
+    double filter_ms;
+    double sort_ms;
+    double output_ms;
+    size_t matches;
+    size_t written;
+} stage_times;
+
+static const char *order_names[] = {"STREAMS", "NO_SPOTIFY_PLAYLISTS", "NO_APPLE_PLAYLISTS"};
+static const int limits[] = {100, 0};
+
+double now_ms(void); // Reads the monotonic clock in milliseconds
+long peak_rss_kb(void); // Peak resident set size of the process in KiB
+int parse_bench_arguments(int, char**, bench_args*); // Parses --name=value arguments into the options
+int common_year(const song_table*); // Most common release year of the table
+void first_artist(const song_table*, char*, size_t); // First word of the artist of the first song
+void time_query(const song_table*, const where_plan*, const sort_spec*, int, int, int, stage_times*); // Times the stages of one query
+void print_rate(const char*, const char*, double, size_t); // Prints one line of the report
+
+// Reads the monotonic clock in milliseconds
+double now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+// Peak resident set size of the process in KiB
+long peak_rss_kb(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Parses --name=value arguments into the options, describing a bad one on stderr
+int parse_bench_arguments(int argc, char* argv[], bench_args* options) {
+    options->data = NULL;
+    options->threads = 1; // Default to loading and sorting on one thread
+    options->repeat = 3; // Default to the best of three runs
+
+    for (int i = 1; i < argc; i++) {
+        char *name = argv[i];
+        char *value = strchr(name, '=');
+
+        if (strncmp(name, "--", 2) != 0 || value == NULL) {
+            fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+            return -1;
+        }
+        *value++ = '\0';
+        name += 2;
+        if (strcmp(name, "data") == 0) {
+            options->data = value;
+        } else if (strcmp(name, "threads") == 0) {
+            options->threads = atoi(value);
+        } else if (strcmp(name, "repeat") == 0) {
+            options->repeat = atoi(value);
+        } else {
+            fprintf(stderr, "Unknown argument: --%s\n", name);
+            return -1;
+        }
+    }
+
+    if (options->data == NULL || options->threads < 1 || options->repeat < 1) {
+        fprintf(stderr, "Usage: songbench --data=PATH [--threads=N] [--repeat=N]\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Most common release year of the table, so that the YEAR filter keeps a realistic share of the rows
+int common_year(const song_table* table) {
+    size_t *counts = (size_t *)calloc(YEAR_SLOTS, sizeof(size_t)); // Songs per year
+    int best = 0; // Most common year so far
+
+    if (counts == NULL) {
+        return 2023;
+    }
+    for (size_t row = 0; row < table->rows; row++) {
+        if (table->year[row] >= 0 && table->year[row] < YEAR_SLOTS) {
+            counts[table->year[row]]++;
+        }
+    }
+    for (int year = 1; year < YEAR_SLOTS; year++) {
+        best = counts[year] > counts[best] ? year : best;
+    }
+    free(counts);
+    return best;
+}
+
+// First word of the artist of the first song, which the ARTIST filter searches for
+void first_artist(const song_table* table, char* name, size_t size) {
+    const char *artist = table->rows > 1 ? table_artist(table, 1) : ""; // Row 0 is the header
+    size_t n = strcspn(artist, " '");
+
+    n = n < size - 1 ? n : size - 1;
+    memcpy(name, artist, n);
+    name[n] = '\0';
+}
+
+// Times the filter, sort and output stages of one query, keeping the best of several runs
+void time_query(const song_table* table, const where_plan* plan, const sort_spec* spec, int limit, int threads,
+                int repeat, stage_times* best) {
+    uint32_t *selection = (uint32_t *)emalloc((table->rows + 1) * sizeof(uint32_t)); // Rows the filter keeps
+    int devnull = open("/dev/null", O_WRONLY); // Where the output stage writes
+    sort_key column = spec->terms[0].column; // The count that is displayed
+
+    best->filter_ms = best->sort_ms = best->output_ms = -1;
+    for (int run = 0; run < repeat; run++) {
+        topk_t ranking; // Orders the selected rows
+        const topk_entry *ranked; // Kept rows in output order
+        size_t count; // Number of kept rows
+        out_writer out; // Formats the kept rows
+        double start = now_ms();
+
+        size_t matches = where_select(plan, table, 0, table->rows, selection);
+        double filtered = now_ms();
+
+        topk_init(&ranking, table, spec, limit);
+        for (size_t i = 0; i < matches; i++) {
+            topk_offer(&ranking, selection[i]);
+        }
+        if (limit > 0) {
+            ranked = topk_finish(&ranking, &count);
+        } else {
+            // As scan_rank() does without a limit: one radix sort on every thread
+            topk_sort(&ranking, ranking.entries, ranking.count, threads);
+            ranked = ranking.entries;
+            count = ranking.count;
+        }
+        double sorted = now_ms();
+
+        writer_init(&out, devnull);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t row = ranked[i].row;
+            const char *track = table_track(table, row), *artist = table_artist(table, row);
+            int64_t value = column == KEY_STREAMS ? table->streams[row]
+                            : column == KEY_SPOTIFY ? table->spotify[row] : table->apple[row];
+            writer_song(&out, table->year[row], table->month[row], table->day[row], track, strlen(track), artist,
+                        strlen(artist), value);
+        }
+        writer_close(&out);
+        double written = now_ms();
+
+        if (best->filter_ms < 0 || filtered - start < best->filter_ms) {
+            best->filter_ms = filtered - start;
+        }
+        if (best->sort_ms < 0 || sorted - filtered < best->sort_ms) {
+            best->sort_ms = sorted - filtered;
+        }
+        if (best->output_ms < 0 || written - sorted < best->output_ms) {
+            best->output_ms = written - sorted;
+        }
+        best->matches = matches;
+        best->written = count;
+        topk_free(&ranking);
+    }
+    if (devnull >= 0) {
+        close(devnull);
+    }
+    free(selection);
+}
+
+// Prints one line of the report: the stage, the query, its time and the rows it handled per second
+void print_rate(const char* stage, const char* query, double ms, size_t rows) {
+    double rate = ms > 0 ? (double)rows / (ms / 1e3) : 0;
+
+    printf("%-7s %-62s %10.2f %12zu %14.0f\n", stage, query, ms, rows, rate);
+}
+
+// Entry point of the benchmark
+int main(int argc, char *argv[]) {
+    bench_args options; // Parsed options
+    song_table table; // The dataset
+    struct stat st; // Size of the input file
+    char artist[64]; // Searched artist
+    char filters[4][EXPR_LEN]; // The filters, as --where expressions
+    const char *filter_names[4] = {"YEAR", "ARTIST", "STREAMS", "WHERE"}; // The filters, as song_analyzer names them
+    char error[EXPR_LEN]; // Description of a bad expression
+    csv_bad_value bad; // First malformed number of the dataset, if any
+
+    if (parse_bench_arguments(argc, argv, &options) != 0) {
+        return 1;
+    }
+
+    table_init(&table);
+    double start = now_ms();
+    if (table_load_csv(&table, options.data, options.threads, ALL_COLUMNS, &bad) != 0) {
+        if (errno == EINVAL && bad.missing != NULL) {
+            fprintf(stderr, "Missing column %s in the header of %s\n", bad.missing, options.data);
+            return 1;
+        }
+        if (errno == EINVAL) {
+            fprintf(stderr, "Malformed number in row %zu, field %d of %s\n", bad.row, bad.field + 1, options.data);
+            return 1;
+        }
+        perror("Failed to open data file");
+        return 1;
+    }
+    double loaded = now_ms();
+    stat(options.data, &st);
+
+    printf("dataset %s: %zu rows, %.1f MB, %d thread(s), best of %d\n", options.data, table.rows,
+           (double)st.st_size / 1e6, options.threads, options.repeat);
+    printf("%-7s %-62s %10s %12s %14s\n", "stage", "query", "ms", "rows", "rows/sec");
+    print_rate("ingest", "all columns", loaded - start, table.rows);
+
+    first_artist(&table, artist, sizeof(artist));
+    snprintf(filters[0], EXPR_LEN, "year=%d", common_year(&table));
+    snprintf(filters[1], EXPR_LEN, "artist~'%s'", artist);
+    snprintf(filters[2], EXPR_LEN, "streams>=100000000 AND streams<=500000000");
+    snprintf(filters[3], EXPR_LEN, "year>=2015 AND spotify>1000 AND artist~'a'");
+
+    for (int f = 0; f < 4; f++) {
+        where_plan plan; // The compiled filter
+
+        if (where_parse(&plan, filters[f], false, error, sizeof(error)) != 0) {
+            fprintf(stderr, "%s\n", error);
+            return 1;
+        }
+        for (size_t o = 0; o < sizeof(order_names) / sizeof(order_names[0]); o++) {
+            for (size_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+                sort_spec spec; // The ordering
+                stage_times times; // Best time of each stage
+                char query[EXPR_LEN * 2]; // Description of the query
+
+                sort_parse(&spec, order_names[o], "DES");
+                time_query(&table, &plan, &spec, limits[l], options.threads, options.repeat, &times);
+                snprintf(query, sizeof(query), "%s %s / %s DES / %s", filter_names[f], filters[f], order_names[o],
+                         limits[l] > 0 ? "limit 100" : "all");
+                print_rate("filter", query, times.filter_ms, table.rows);
+                print_rate("sort", query, times.sort_ms, times.matches);
+                print_rate("output", query, times.output_ms, times.written);
+            }
+        }
+        where_free(&plan);
+    }
+
+    printf("peak RSS: %.1f MB\n", (double)peak_rss_kb() / 1024);
+    table_free(&table);
+    return 0;
+}
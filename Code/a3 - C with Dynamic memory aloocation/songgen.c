@@ -0,0 +1,377 @@
+/** @file songgen.c
+ *  @brief Generates synthetic song datasets for benchmarking song_analyzer.
+ *
+ *  Rows have the columns of data.csv, or with --wide=YES all 24 columns
+ *  of the Kaggle export in its own order. Artists are drawn from a Zipfian
+ *  distribution, so a few artists have most of the songs as in the real
+ *  charts, and release years are skewed towards the most recent ones.
+ *  Every value comes from a seeded generator, so a seed always gives the
+ *  same file.
+ *
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "writer.h"
+
+#define NAME_LEN 64 // Room for a generated name
+
+// Options of a generated dataset
+typedef struct {
+    long long rows;
+    char *output;
+    uint64_t seed;
+    long artists;
+    double zipf;
+    double year_skew;
+    int first_year;
+    int last_year;
+    bool wide;
+    bool quoted;
+} gen_args;
+
+static const char *syllables[] = {
+    "ka", "ri", "lo", "ma", "te", "su", "no", "vi", "da", "ze", "ba", "lu", "mi", "ro", "sa", "ne",
+    "to", "el", "an", "jo", "ry", "ve", "ko", "li", "ta", "mo", "ra", "di", "sh", "en", "ax", "or",
+};
+
+static const char *words[] = {
+    "Love", "Night", "Summer", "Heart", "Dance", "Fire", "Dream", "Money", "Blue", "Gold",
+    "City", "Rain", "Lights", "Forever", "Baby", "Wild", "Sky", "Ocean", "Dark", "Queen",
+    "Radio", "Paradise", "Stars", "Wave", "Ghost", "Sugar", "Home", "Time", "Crazy", "Alone",
+    "Feat", "Remix", "Again", "Tonight", "Electric", "Sweet", "Lost", "Young", "Free", "Angel",
+};
+
+// The columns the real Kaggle export has besides those of data.csv: one between in_spotify_playlists and
+// streams, and the others after in_apple_playlists
+static const char *wide_charts = ",in_spotify_charts";
+static const char *wide_header = ",in_apple_charts,in_deezer_playlists,in_deezer_charts,in_shazam_charts,bpm,key,"
+                                 "mode,danceability_%,valence_%,energy_%,acousticness_%,instrumentalness_%,"
+                                 "liveness_%,speechiness_%";
+
+static const char *keys[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+
+uint64_t next_random(uint64_t*); // Returns the next number of a xorshift64* sequence
+double next_unit(uint64_t*); // Returns a uniform number in [0, 1)
+double next_normal(uint64_t*); // Returns a standard normal number
+double* zipf_table(long, double); // Builds the cumulative Zipfian weights of the artists
+long pick_index(const double*, long, uint64_t*); // Draws an index from cumulative weights
+double* year_table(const gen_args*); // Builds the cumulative weights of the release years
+void artist_name(long, char*); // Spells the name of an artist from its number
+size_t track_name(uint64_t*, bool, char*); // Makes up the name of a track
+void write_name(out_writer*, const char*, size_t); // Writes a name, quoted when it holds a comma or a quote
+int days_in_month(int, int); // Number of days of a month
+int parse_gen_arguments(int, char**, gen_args*); // Parses --name=value arguments into the options
+void generate_songs(const gen_args*); // Writes the dataset
+
+// Returns the next number of a xorshift64* sequence
+uint64_t next_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Returns a uniform number in [0, 1)
+double next_unit(uint64_t* state) {
+    return (double)(next_random(state) >> 11) / 9007199254740992.0;
+}
+
+// Returns a standard normal number (Box-Muller)
+double next_normal(uint64_t* state) {
+    double u = 1.0 - next_unit(state); // In (0, 1], so that the logarithm is finite
+    double v = next_unit(state);
+
+    return sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v);
+}
+
+// Builds the cumulative Zipfian weights of the artists: artist k has weight 1 / (k + 1)^s
+double* zipf_table(long artists, double s) {
+    double *cumulative = (double *)emalloc((size_t)artists * sizeof(double));
+    double total = 0;
+
+    for (long k = 0; k < artists; k++) {
+        total += 1.0 / pow((double)(k + 1), s);
+        cumulative[k] = total;
+    }
+    for (long k = 0; k < artists; k++) {
+        cumulative[k] /= total;
+    }
+    return cumulative;
+}
+
+// Draws an index, such as an artist or a year, from cumulative weights with a binary search
+long pick_index(const double* cumulative, long count, uint64_t* state) {
+    double u = next_unit(state);
+    long lo = 0, hi = count - 1;
+
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        if (cumulative[mid] < u) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Builds the cumulative weights of the release years: each year weighs year_skew times the one after it
+double* year_table(const gen_args* options) {
+    int years = options->last_year - options->first_year + 1;
+    double *cumulative = (double *)emalloc((size_t)years * sizeof(double));
+    double weight = 1, total = 0;
+
+    for (int i = years - 1; i >= 0; i--) {
+        cumulative[i] = weight;
+        total += weight;
+        weight *= options->year_skew;
+    }
+    double running = 0;
+    for (int i = 0; i < years; i++) {
+        running += cumulative[i] / total;
+        cumulative[i] = running;
+    }
+    return cumulative;
+}
+
+// Spells the name of an artist from its number, so that every run names the artists alike
+void artist_name(long artist, char* name) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL ^ (uint64_t)(artist + 1) * 0xBF58476D1CE4E5B9ULL; // Seeded by the number alone
+    size_t n = 0;
+    int parts = 1 + (int)(next_random(&state) % 2); // One or two words
+
+    for (int part = 0; part < parts; part++) {
+        int count = 2 + (int)(next_random(&state) % 2); // Syllables in the word
+        if (part > 0) {
+            name[n++] = ' ';
+        }
+        size_t start = n;
+        for (int i = 0; i < count; i++) {
+            const char *syllable = syllables[next_random(&state) % (sizeof(syllables) / sizeof(syllables[0]))];
+            size_t len = strlen(syllable);
+            memcpy(name + n, syllable, len);
+            n += len;
+        }
+        name[start] = (char)(name[start] - 'a' + 'A');
+    }
+    name[n] = '\0';
+}
+
+// Makes up the name of a track from one to four words, with the odd comma or quote when asked for
+size_t track_name(uint64_t* state, bool quoted, char* name) {
+    int count = 1 + (int)(next_random(state) % 4); // Words in the name
+    size_t n = 0;
+
+    for (int i = 0; i < count; i++) {
+        const char *word = words[next_random(state) % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        if (i > 0) {
+            name[n++] = quoted && next_random(state) % 16 == 0 ? ',' : ' ';
+            if (name[n - 1] == ',') {
+                name[n++] = ' ';
+            }
+        }
+        memcpy(name + n, word, len);
+        n += len;
+    }
+    if (quoted && next_random(state) % 32 == 0) {
+        memcpy(name + n, " \"Live\"", 7);
+        n += 7;
+    }
+    name[n] = '\0';
+    return n;
+}
+
+// Writes a name, quoted as RFC 4180 asks when it holds a comma or a quote
+void write_name(out_writer* out, const char* name, size_t len) {
+    if (memchr(name, ',', len) == NULL && memchr(name, '"', len) == NULL) {
+        writer_put(out, name, len);
+        return;
+    }
+    writer_char(out, '"');
+    for (size_t i = 0; i < len; i++) {
+        if (name[i] == '"') {
+            writer_char(out, '"');
+        }
+        writer_char(out, name[i]);
+    }
+    writer_char(out, '"');
+}
+
+// Number of days of a month
+int days_in_month(int year, int month) {
+    static const int days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+
+    return month == 2 && leap ? 29 : days[month - 1];
+}
+
+// Parses --name=value arguments into the options, describing a bad one on stderr
+int parse_gen_arguments(int argc, char* argv[], gen_args* options) {
+    options->rows = -1;
+    options->output = WRITER_STDOUT; // Default to stdout
+    options->seed = 1;
+    options->artists = 20000;
+    options->zipf = 1.1;
+    options->year_skew = 0.8;
+    options->first_year = 1950;
+    options->last_year = 2023;
+    options->wide = false; // Default to the nine columns of data.csv
+    options->quoted = false; // Default to names without commas or quotes
+
+    for (int i = 1; i < argc; i++) {
+        char *name = argv[i];
+        char *value = strchr(name, '=');
+
+        if (strncmp(name, "--", 2) != 0 || value == NULL) {
+            fprintf(stderr, "Invalid argument: %s\n", argv[i]);
+            return -1;
+        }
+        *value++ = '\0';
+        name += 2;
+        if (strcmp(name, "rows") == 0) {
+            options->rows = atoll(value);
+        } else if (strcmp(name, "output") == 0) {
+            options->output = value;
+        } else if (strcmp(name, "seed") == 0) {
+            options->seed = strtoull(value, NULL, 10);
+        } else if (strcmp(name, "artists") == 0) {
+            options->artists = atol(value);
+        } else if (strcmp(name, "zipf") == 0) {
+            options->zipf = atof(value);
+        } else if (strcmp(name, "year-skew") == 0) {
+            options->year_skew = atof(value);
+        } else if (strcmp(name, "first-year") == 0) {
+            options->first_year = atoi(value);
+        } else if (strcmp(name, "last-year") == 0) {
+            options->last_year = atoi(value);
+        } else if (strcmp(name, "wide") == 0) {
+            options->wide = strcmp(value, "YES") == 0;
+        } else if (strcmp(name, "quoted") == 0) {
+            options->quoted = strcmp(value, "YES") == 0;
+        } else {
+            fprintf(stderr, "Unknown argument: --%s\n", name);
+            return -1;
+        }
+    }
+
+    if (options->rows < 0 || options->artists < 1 || options->zipf < 0 || options->year_skew <= 0 ||
+        options->first_year > options->last_year) {
+        fprintf(stderr, "Usage: songgen --rows=N [--output=PATH] [--seed=N] [--artists=N] [--zipf=S] "
+                        "[--year-skew=R] [--first-year=Y] [--last-year=Y] [--wide=YES] [--quoted=YES]\n");
+        return -1;
+    }
+    if (options->seed == 0) {
+        options->seed = 1; // xorshift never leaves zero
+    }
+    return 0;
+}
+
+// Writes the header and the rows of the dataset
+void generate_songs(const gen_args* options) {
+    out_writer out; // Buffered writer for the rows
+    double *artists = zipf_table(options->artists, options->zipf); // Cumulative weights of the artists
+    double *years = year_table(options); // Cumulative weights of the release years
+    long year_count = options->last_year - options->first_year + 1; // Number of possible years
+    uint64_t state = options->seed; // Generator state
+    char track[NAME_LEN * 4]; // Name of the current track
+    char artist[NAME_LEN * 3]; // Name(s) of the current artists
+
+    if (writer_open(&out, options->output) != 0) {
+        perror("Failed to open output file");
+        exit(1);
+    }
+    writer_puts(&out, "track_name,artist(s)_name,artist_count,released_year,released_month,released_day,"
+                      "in_spotify_playlists");
+    if (options->wide) {
+        writer_puts(&out, wide_charts);
+    }
+    writer_puts(&out, ",streams,in_apple_playlists");
+    if (options->wide) {
+        writer_puts(&out, wide_header);
+    }
+    writer_char(&out, '\n');
+
+    for (long long row = 0; row < options->rows; row++) {
+        int artist_count = next_unit(&state) < 0.8 ? 1 : next_unit(&state) < 0.75 ? 2 : 3; // Most songs have one artist
+        size_t artist_len = 0;
+        for (int i = 0; i < artist_count; i++) {
+            if (i > 0) {
+                artist[artist_len++] = ' ';
+            }
+            artist_name(pick_index(artists, options->artists, &state), artist + artist_len);
+            artist_len += strlen(artist + artist_len);
+        }
+        size_t track_len = track_name(&state, options->quoted, track);
+
+        int year = options->first_year + (int)pick_index(years, year_count, &state);
+        int month = 1 + (int)(next_random(&state) % 12);
+        int day = 1 + (int)(next_random(&state) % (uint64_t)days_in_month(year, month));
+        // Streams are log-normal around 200 million; the playlist counts follow them loosely
+        double streams = exp(log(2e8) + 1.1 * next_normal(&state));
+        double spotify = streams / 1e5 * exp(0.5 * next_normal(&state));
+        double apple = spotify / 40 * exp(0.5 * next_normal(&state));
+
+        write_name(&out, track, track_len);
+        writer_char(&out, ',');
+        write_name(&out, artist, artist_len);
+        writer_char(&out, ',');
+        writer_int(&out, artist_count);
+        writer_char(&out, ',');
+        writer_int(&out, year);
+        writer_char(&out, ',');
+        writer_int(&out, month);
+        writer_char(&out, ',');
+        writer_int(&out, day);
+        writer_char(&out, ',');
+        writer_int(&out, spotify < 60000 ? (int64_t)spotify : 60000);
+        writer_char(&out, ',');
+        if (options->wide) {
+            writer_int(&out, (int64_t)(next_random(&state) % 150)); // in_spotify_charts
+            writer_char(&out, ',');
+        }
+        writer_int(&out, streams < 4e9 ? (int64_t)streams : 4000000000LL);
+        writer_char(&out, ',');
+        writer_int(&out, apple < 700 ? (int64_t)apple : 700);
+        if (options->wide) {
+            // Charts, tempo, key, mode and audio features, none of which song_analyzer reads
+            for (int i = 0; i < 4; i++) {
+                writer_char(&out, ',');
+                writer_int(&out, (int64_t)(next_random(&state) % 200));
+            }
+            writer_char(&out, ',');
+            writer_int(&out, 65 + (int64_t)(next_random(&state) % 141)); // bpm
+            writer_char(&out, ',');
+            writer_puts(&out, keys[next_random(&state) % 12]);
+            writer_puts(&out, next_unit(&state) < 0.57 ? ",Major" : ",Minor");
+            for (int i = 0; i < 7; i++) {
+                writer_char(&out, ',');
+                writer_int(&out, (int64_t)(next_random(&state) % 100));
+            }
+        }
+        writer_char(&out, '\n');
+    }
+
+    if (writer_close(&out) != 0) {
+        perror("Failed to write output");
+        exit(1);
+    }
+    free(years);
+    free(artists);
+}
+
+// Entry point of the generator
+int main(int argc, char *argv[]) {
+    gen_args options; // Parsed options
+
+    if (parse_gen_arguments(argc, argv, &options) != 0) {
+        return 1;
+    }
+    generate_songs(&options);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/** @file sortkey.c
+ *  @brief Implementation of the sort-key descriptor.
+ *
+ * A term is a column name, optionally followed by ASC, DES or DESC; terms
+ * are separated by commas. A term without a direction takes the one given
+ * by --order. The first term must be one of the counts, since that is the
+ * column displayed; later terms may also be RELEASED, TRACK_NAME or
+ * ARTIST. As before, a lone unknown name orders by NO_APPLE_PLAYLISTS.
+ *
+ * Callers keep the first term as a plain integer key of their own and
+ * only call sort_compare_ties() when two keys are equal, so most
+ * comparisons never get here.
+ *
+ */
+#include <string.h>
+#include "sortkey.h"
+#include "table.h"
+
+static const struct {
+    const char *name;
+    sort_key column;
+} column_names[] = {
+    {"STREAMS", KEY_STREAMS},
+    {"NO_SPOTIFY_PLAYLISTS", KEY_SPOTIFY},
+    {"NO_APPLE_PLAYLISTS", KEY_APPLE},
+    {"RELEASED", KEY_RELEASED},
+    {"TRACK_NAME", KEY_TRACK},
+    {"ARTIST", KEY_ARTIST},
+};
+
+// Tells whether [s, s + n) is exactly the word
+static bool word_is(const char *s, size_t n, const char *word)
+{
+    return strlen(word) == n && memcmp(s, word, n) == 0;
+}
+
+// Compares two numbers, returning -1, 0 or 1
+static int compare_numbers(int64_t a, int64_t b)
+{
+    return (a > b) - (a < b);
+}
+
+// Compares two byte strings as strcmp() would compare them if they were NUL-terminated
+static int compare_text(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+    int c = memcmp(a, b, a_len < b_len ? a_len : b_len);
+
+    if (c != 0)
+    {
+        return c < 0 ? -1 : 1;
+    }
+    return compare_numbers((int64_t)a_len, (int64_t)b_len);
+}
+
+/**
+ * Function:  sort_column
+ * ----------------------
+ * @brief  Maps the name of a field to the column it reads.
+ *
+ * @param name The name, which need not be NUL-terminated.
+ * @param len The length of the name.
+ * @param column Receives the column.
+ *
+ * @return bool False if the name is not one of the fields.
+ *
+ */
+bool sort_column(const char *name, size_t len, sort_key *column)
+{
+    for (size_t i = 0; i < sizeof(column_names) / sizeof(column_names[0]); i++)
+    {
+        if (word_is(name, len, column_names[i].name))
+        {
+            *column = column_names[i].column;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Function:  sort_parse
+ * ---------------------
+ * @brief  Parses --order_by and --order into a descriptor.
+ *
+ * @param spec The descriptor to be filled in.
+ * @param order_by One or more terms, such as "STREAMS DES, TRACK_NAME ASC".
+ * @param order The direction of terms that have none (ASC or DES), or NONE
+ *        to keep the order of the file.
+ *
+ * @return int 0 on success, -1 if a term is malformed or there are more
+ *         than SORT_MAX_TERMS of them.
+ *
+ */
+int sort_parse(sort_spec *spec, const char *order_by, const char *order)
+{
+    const char *p = order_by;
+
+    spec->count = 0;
+    spec->unordered = strcmp(order, "NONE") == 0;
+
+    for (;;)
+    {
+        const char *end = strchr(p, ',');
+        const char *name;
+        const char *direction;
+        sort_term term;
+
+        if (end == NULL)
+        {
+            end = p + strlen(p);
+        }
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        name = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+        size_t name_len = (size_t)(p - name);
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+        direction = p;
+        while (p < end && *p != ' ')
+        {
+            p++;
+        }
+        size_t direction_len = (size_t)(p - direction);
+        while (p < end && *p == ' ')
+        {
+            p++;
+        }
+
+        if (p != end || spec->count == SORT_MAX_TERMS)
+        {
+            return -1;
+        }
+
+        if (direction_len == 0)
+        {
+            term.descending = strcmp(order, "DES") == 0;
+        }
+        else if (word_is(direction, direction_len, "ASC"))
+        {
+            term.descending = false;
+        }
+        else if (word_is(direction, direction_len, "DES") || word_is(direction, direction_len, "DESC"))
+        {
+            term.descending = true;
+        }
+        else
+        {
+            return -1;
+        }
+
+        if (!sort_column(name, name_len, &term.column))
+        {
+            // The original single-field form never rejected a name
+            if (spec->count > 0 || direction_len > 0 || *end != '\0')
+            {
+                return -1;
+            }
+            term.column = KEY_APPLE;
+        }
+        if (spec->count == 0 && term.column != KEY_STREAMS && term.column != KEY_SPOTIFY &&
+            term.column != KEY_APPLE)
+        {
+            return -1;
+        }
+        spec->terms[spec->count++] = term;
+
+        if (*end == '\0')
+        {
+            return 0;
+        }
+        p = end + 1;
+    }
+}
+
+/**
+ * Function:  sort_compare_ties
+ * ----------------------------
+ * @brief  Compares two songs on every term but the first.
+ *
+ * @param spec The descriptor.
+ * @param a The first song.
+ * @param b The second song.
+ *
+ * @return int Negative if a comes first, positive if b does, 0 if no term
+ *         tells them apart.
+ *
+ */
+int sort_compare_ties(const sort_spec *spec, const sort_row *a, const sort_row *b)
+{
+    for (size_t i = 1; i < spec->count; i++)
+    {
+        int c;
+
+        switch (spec->terms[i].column)
+        {
+        case KEY_STREAMS:
+            c = compare_numbers(a->streams, b->streams);
+            break;
+        case KEY_SPOTIFY:
+            c = compare_numbers(a->spotify, b->spotify);
+            break;
+        case KEY_APPLE:
+            c = compare_numbers(a->apple, b->apple);
+            break;
+        case KEY_RELEASED:
+            c = compare_numbers(a->year, b->year);
+            c = c != 0 ? c : compare_numbers(a->month, b->month);
+            c = c != 0 ? c : compare_numbers(a->day, b->day);
+            break;
+        case KEY_TRACK:
+            c = compare_text(a->track, a->track_len, b->track, b->track_len);
+            break;
+        default:
+            c = compare_text(a->artist, a->artist_len, b->artist, b->artist_len);
+            break;
+        }
+        if (c != 0)
+        {
+            return spec->terms[i].descending ? -c : c;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Function:  sort_key_columns
+ * ---------------------------
+ * @brief  Returns the set of input columns a sort key reads.
+ *
+ * @param column The sort key.
+ *
+ * @return unsigned The columns, as FIELD_BIT() of their positions.
+ *
+ */
+unsigned sort_key_columns(sort_key column)
+{
+    switch (column)
+    {
+    case KEY_STREAMS:
+        return FIELD_BIT(FIELD_STREAMS);
+    case KEY_SPOTIFY:
+        return FIELD_BIT(FIELD_SPOTIFY);
+    case KEY_APPLE:
+        return FIELD_BIT(FIELD_APPLE);
+    case KEY_RELEASED:
+        return FIELD_BIT(FIELD_YEAR) | FIELD_BIT(FIELD_MONTH) | FIELD_BIT(FIELD_DAY);
+    case KEY_TRACK:
+        return FIELD_BIT(FIELD_TRACK);
+    default:
+        return FIELD_BIT(FIELD_ARTIST);
+    }
+}
+
+/**
+ * Function:  sort_columns
+ * -----------------------
+ * @brief  Returns the set of input columns the terms of a descriptor read.
+ *
+ * @param spec The descriptor.
+ *
+ * @return unsigned The columns, as FIELD_BIT() of their positions.
+ *
+ */
+unsigned sort_columns(const sort_spec *spec)
+{
+    unsigned columns = 0;
+
+    for (size_t i = 0; i < spec->count; i++)
+    {
+        columns |= sort_key_columns(spec->terms[i].column);
+    }
+    return columns;
+}
@@ -0,0 +1,62 @@
+/** @file sortkey.h
+ *  @brief Function prototypes for the sort-key descriptor.
+ *
+ *  --order_by is parsed once per query into a list of terms, each a column
+ *  and a direction, such as "STREAMS DES, TRACK_NAME ASC". The first term
+ *  is the count that is displayed; the others only break its ties. The
+ *  sorts compare columns through the descriptor and never look at the
+ *  order_by string again.
+ */
+#ifndef _SORTKEY_H_
+#define _SORTKEY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SORT_MAX_TERMS 4
+
+typedef enum {
+    KEY_STREAMS,
+    KEY_SPOTIFY,
+    KEY_APPLE,
+    KEY_RELEASED,
+    KEY_TRACK,
+    KEY_ARTIST
+} sort_key;
+
+typedef struct {
+    sort_key column;
+    bool descending;
+} sort_term;
+
+typedef struct {
+    sort_term terms[SORT_MAX_TERMS];
+    size_t count;
+    bool unordered;
+} sort_spec;
+
+// The columns of one song that a tie can be broken on
+typedef struct {
+    int64_t streams;
+    int32_t spotify;
+    int32_t apple;
+    int32_t year;
+    int32_t month;
+    int32_t day;
+    const char *track;
+    size_t track_len;
+    const char *artist;
+    size_t artist_len;
+} sort_row;
+
+/**
+ * Function protypes associated with the sort-key descriptor.
+ */
+int sort_parse(sort_spec *, const char *order_by, const char *order);
+bool sort_column(const char *name, size_t len, sort_key *column);
+int sort_compare_ties(const sort_spec *, const sort_row *a, const sort_row *b);
+unsigned sort_key_columns(sort_key column);
+unsigned sort_columns(const sort_spec *);
+
+#endif
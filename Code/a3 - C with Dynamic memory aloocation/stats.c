@@ -0,0 +1,189 @@
+/** @file stats.c
+ *  @brief Implementation of the per-stage query metrics.
+ *
+ * Stages run one after the other, so the CPU time of the whole process
+ * over a stage is the CPU time of every thread that worked on it; only
+ * work split inside one set of threads, such as the filter and the sort
+ * of a parallel scan, needs the clock of each thread.
+ *
+ * Allocations are counted by emalloc() and erealloc() in the same way:
+ * a clock from stats_start() takes the counts of the whole process, and
+ * one from stats_start_thread() those of the calling thread, so each stage
+ * reports the allocations made while it ran. The totals of a query are
+ * those made between stats_init() and stats_finish(). Counts of the whole
+ * process include those of any query running alongside.
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "emalloc.h"
+#include "stats.h"
+
+static const char *stage_names[STAGE_COUNT] = {"load", "filter", "sort", "output"};
+
+// Reads a clock in milliseconds
+static double clock_ms(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+/**
+ * Function:  stats_init
+ * ---------------------
+ * @brief  Clears the metrics of a query and starts counting its allocations.
+ *
+ * @param stats The metrics to be initialized.
+ *
+ */
+void stats_init(query_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    // Until stats_finish() these hold the counts the query started from
+    emalloc_counts(&stats->allocations, &stats->allocated_bytes);
+}
+
+/**
+ * Function:  stats_start
+ * ----------------------
+ * @brief  Starts timing a stage run by the whole process.
+ *
+ * @param clock Receives the starting times.
+ *
+ */
+void stats_start(stats_clock *clock)
+{
+    clock->cpu_clock = CLOCK_PROCESS_CPUTIME_ID;
+    clock->wall_ms = clock_ms(CLOCK_MONOTONIC);
+    clock->cpu_ms = clock_ms(clock->cpu_clock);
+    emalloc_counts(&clock->allocations, &clock->allocated_bytes);
+}
+
+/**
+ * Function:  stats_start_thread
+ * -----------------------------
+ * @brief  Starts timing the share of a stage run by the calling thread.
+ *
+ * @param clock Receives the starting times.
+ *
+ */
+void stats_start_thread(stats_clock *clock)
+{
+    clock->cpu_clock = CLOCK_THREAD_CPUTIME_ID;
+    clock->wall_ms = clock_ms(CLOCK_MONOTONIC);
+    clock->cpu_ms = clock_ms(clock->cpu_clock);
+    emalloc_thread_counts(&clock->allocations, &clock->allocated_bytes);
+}
+
+/**
+ * Function:  stats_stop
+ * ---------------------
+ * @brief  Adds the time elapsed and the allocations made since a clock was started to a stage.
+ *
+ * @param clock The clock, from stats_start() or stats_start_thread() on the same thread.
+ * @param stage The stage the time and allocations are added to.
+ *
+ */
+void stats_stop(const stats_clock *clock, stage_stats *stage)
+{
+    uint64_t allocations, bytes;
+
+    stage->wall_ms += clock_ms(CLOCK_MONOTONIC) - clock->wall_ms;
+    stage->cpu_ms += clock_ms(clock->cpu_clock) - clock->cpu_ms;
+    if (clock->cpu_clock == CLOCK_THREAD_CPUTIME_ID)
+    {
+        emalloc_thread_counts(&allocations, &bytes);
+    }
+    else
+    {
+        emalloc_counts(&allocations, &bytes);
+    }
+    stage->allocations += allocations - clock->allocations;
+    stage->allocated_bytes += bytes - clock->allocated_bytes;
+}
+
+/**
+ * Function:  stats_finish
+ * -----------------------
+ * @brief  Counts the allocations made since stats_init() and reads the peak memory.
+ *
+ * @param stats The metrics of the query.
+ *
+ */
+void stats_finish(query_stats *stats)
+{
+    uint64_t allocations, bytes;
+    struct rusage usage;
+
+    emalloc_counts(&allocations, &bytes);
+    stats->allocations = allocations - stats->allocations;
+    stats->allocated_bytes = bytes - stats->allocated_bytes;
+    stats->peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+// Prints one stage as a line of the table
+static void print_text_stage(const char *name, const stage_stats *stage, FILE *out)
+{
+    fprintf(out, "%-7s %10.2f %10.2f %12llu %12llu %14llu %10llu %14llu\n", name, stage->wall_ms, stage->cpu_ms,
+            (unsigned long long)stage->rows_in, (unsigned long long)stage->rows_out,
+            (unsigned long long)stage->bytes, (unsigned long long)stage->allocations,
+            (unsigned long long)stage->allocated_bytes);
+}
+
+// Prints one stage as a member of a JSON object
+static void print_json_stage(const char *name, const stage_stats *stage, FILE *out)
+{
+    fprintf(out, "\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f,\"rows_in\":%llu,\"rows_out\":%llu,\"bytes\":%llu,"
+            "\"allocations\":%llu,\"allocated_bytes\":%llu}", name, stage->wall_ms, stage->cpu_ms,
+            (unsigned long long)stage->rows_in, (unsigned long long)stage->rows_out, (unsigned long long)stage->bytes,
+            (unsigned long long)stage->allocations, (unsigned long long)stage->allocated_bytes);
+}
+
+/**
+ * Function:  stats_print
+ * ----------------------
+ * @brief  Prints the metrics of a query as a table, or as one line of JSON.
+ *
+ * @param stats The metrics, from stats_finish().
+ * @param format STATS_TEXT or STATS_JSON; STATS_OFF prints nothing.
+ * @param out The stream to print to.
+ *
+ */
+void stats_print(const query_stats *stats, stats_format format, FILE *out)
+{
+    double wall_ms = 0, cpu_ms = 0;
+
+    for (int i = 0; i < STAGE_COUNT; i++)
+    {
+        wall_ms += stats->stages[i].wall_ms;
+        cpu_ms += stats->stages[i].cpu_ms;
+    }
+
+    if (format == STATS_TEXT)
+    {
+        fprintf(out, "%-7s %10s %10s %12s %12s %14s %10s %14s\n", "stage", "wall ms", "cpu ms", "rows in", "rows out",
+                "bytes", "allocs", "alloc bytes");
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            print_text_stage(stage_names[i], &stats->stages[i], out);
+        }
+        fprintf(out, "%-7s %10.2f %10.2f\n", "total", wall_ms, cpu_ms);
+        fprintf(out, "allocations: %llu (%.1f MB), peak RSS: %.1f MB\n", (unsigned long long)stats->allocations,
+                (double)stats->allocated_bytes / (1024 * 1024), (double)stats->peak_rss_kb / 1024);
+    }
+    else if (format == STATS_JSON)
+    {
+        fputc('{', out);
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            print_json_stage(stage_names[i], &stats->stages[i], out);
+            fputc(',', out);
+        }
+        fprintf(out, "\"total\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f},\"allocations\":%llu,\"allocated_bytes\":%llu,"
+                "\"peak_rss_kb\":%ld}\n", wall_ms, cpu_ms, (unsigned long long)stats->allocations,
+                (unsigned long long)stats->allocated_bytes, stats->peak_rss_kb);
+    }
+}
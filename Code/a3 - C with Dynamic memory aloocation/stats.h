@@ -0,0 +1,69 @@
+/** @file stats.h
+ *  @brief Function prototypes for the per-stage query metrics.
+ *
+ *  A query runs in four stages: loading the dataset, filtering it, sorting
+ *  the matches and writing them out. Each stage records its wall-clock
+ *  time, the CPU time of every thread that worked on it, the rows and bytes
+ *  that went through it, and the allocations made while it ran. The counters are plain fields owned by one
+ *  thread at a time; threads keep their own and the owner of the query
+ *  adds them up when they are joined, so collecting them costs a few clock
+ *  reads per stage and the metrics are always on. --stats only decides
+ *  whether they are printed.
+ */
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+typedef enum {
+    STAGE_LOAD,
+    STAGE_FILTER,
+    STAGE_SORT,
+    STAGE_OUTPUT,
+    STAGE_COUNT
+} stats_stage;
+
+typedef enum {
+    STATS_OFF,
+    STATS_TEXT,
+    STATS_JSON
+} stats_format;
+
+typedef struct {
+    double wall_ms;
+    double cpu_ms;
+    uint64_t rows_in;
+    uint64_t rows_out;
+    uint64_t bytes;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} stage_stats;
+
+typedef struct {
+    stage_stats stages[STAGE_COUNT];
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+    long peak_rss_kb;
+} query_stats;
+
+typedef struct {
+    clockid_t cpu_clock;
+    double wall_ms;
+    double cpu_ms;
+    uint64_t allocations;
+    uint64_t allocated_bytes;
+} stats_clock;
+
+/**
+ * Function protypes associated with the query metrics.
+ */
+void stats_init(query_stats *);
+void stats_start(stats_clock *);
+void stats_start_thread(stats_clock *);
+void stats_stop(const stats_clock *, stage_stats *);
+void stats_finish(query_stats *);
+void stats_print(const query_stats *, stats_format, FILE *);
+
+#endif
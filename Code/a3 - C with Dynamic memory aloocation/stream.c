@@ -0,0 +1,733 @@
+/** @file stream.c
+ *  @brief Implementation of the bounded-memory streaming query.
+ *
+ * Matches are packed into one buffer of max_memory bytes: records grow from
+ * the front, and the offset of each record is pushed from the back, so the
+ * buffer is full exactly when the two meet. A full buffer is sorted by
+ * its offsets and written out as a run of records in output order. With a
+ * limit, only the first max_rows records of a run can ever be printed, so
+ * the rest are not written.
+ *
+ * At the end the runs are merged with a binary heap, at most
+ * SPILL_FANIN at a time; longer lists of runs are first merged into
+ * fewer, longer runs. Ties are broken as in topk_compare(): on the later
+ * terms of --order_by, and then among rows with an equal key, the one
+ * read later comes first. A record keeps every count for that reason.
+ *
+ * A row is split only up to the last column the query reads, and only the
+ * columns of the filter are converted before it runs, so the rows it
+ * rejects cost no more than the tests themselves.
+ *
+ * The pages of the input already read are handed back to the kernel every
+ * RELEASE_STEP bytes, so the mapping does not count against the budget.
+ *
+ * Reading and filtering the rows is the filter stage of the metrics, and
+ * sorting and spilling the matches and merging the runs is the sort
+ * stage. Sorted rows are formatted as they come out of the buffer or the
+ * last merge, so that is counted in the sort stage too.
+ *
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "table.h"
+#include "stream.h"
+
+#define SPILL_FANIN 64
+#define RELEASE_STEP (16 * 1024 * 1024)
+#define RECORD_ALIGN 8
+
+typedef struct {
+    int64_t key;
+    uint64_t row;
+    int64_t streams;
+    int32_t spotify;
+    int32_t apple;
+    int32_t year;
+    int32_t month;
+    int32_t day;
+    uint32_t track_len;
+    uint32_t artist_len;
+} run_record;
+
+typedef struct {
+    const sort_spec *spec;
+    sort_key key;
+    bool descending;
+    bool ties;
+    size_t max_rows;
+    size_t run_buffer_size;
+} stream_order;
+
+// Records packed from the front of data, their offsets stacked from the back
+typedef struct {
+    char *data;
+    size_t size;
+    size_t used;
+    size_t count;
+} run_buffer;
+
+// Sequential reader over one spilled run
+typedef struct {
+    FILE *file;
+    run_record record;
+    char *text;
+    size_t text_cap;
+} run_reader;
+
+// Gathers the columns of a record that the later terms of --order_by may read
+static void record_columns(const run_record *record, const char *text, sort_row *out)
+{
+    out->streams = record->streams;
+    out->spotify = record->spotify;
+    out->apple = record->apple;
+    out->year = record->year;
+    out->month = record->month;
+    out->day = record->day;
+    out->track = text;
+    out->track_len = record->track_len;
+    out->artist = text + record->track_len;
+    out->artist_len = record->artist_len;
+}
+
+// Compares two records, each followed by its text, by output position
+static int compare_records(const run_record *a, const char *a_text, const run_record *b, const char *b_text,
+                           const stream_order *order)
+{
+    if (a->key != b->key)
+    {
+        if (order->descending)
+        {
+            return a->key > b->key ? -1 : 1;
+        }
+        return a->key < b->key ? -1 : 1;
+    }
+    if (order->ties)
+    {
+        sort_row first;
+        sort_row second;
+
+        record_columns(a, a_text, &first);
+        record_columns(b, b_text, &second);
+        int c = sort_compare_ties(order->spec, &first, &second);
+        if (c != 0)
+        {
+            return c;
+        }
+    }
+    return a->row > b->row ? -1 : 1;
+}
+
+static int compare_offsets(const void *a, const void *b, void *arg)
+{
+    const void **context = (const void **)arg;
+    const char *data = (const char *)context[0];
+    const run_record *first = (const run_record *)(data + *(const size_t *)a);
+    const run_record *second = (const run_record *)(data + *(const size_t *)b);
+
+    return compare_records(first, (const char *)(first + 1), second, (const char *)(second + 1),
+                           (const stream_order *)context[1]);
+}
+
+// Compares the current records of two runs by output position
+static int compare_readers(const run_reader *a, const run_reader *b, const stream_order *order)
+{
+    return compare_records(&a->record, a->text, &b->record, b->text, order);
+}
+
+static size_t *buffer_offsets(const run_buffer *buffer)
+{
+    return (size_t *)(buffer->data + buffer->size) - buffer->count;
+}
+
+/**
+ * Function:  buffer_add
+ * ---------------------
+ * @brief  Packs a matching row into the buffer.
+ *
+ * @param buffer The buffer.
+ * @param record The numbers of the row.
+ * @param track The track name.
+ * @param artist The artist name(s).
+ *
+ * @return bool False if the buffer has no room left for the row.
+ *
+ */
+static bool buffer_add(run_buffer *buffer, const run_record *record, field_t track, field_t artist)
+{
+    size_t bytes = sizeof(run_record) + track.len + artist.len;
+    size_t padded = (bytes + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+
+    if (buffer->used + padded + (buffer->count + 1) * sizeof(size_t) > buffer->size)
+    {
+        return false;
+    }
+
+    char *p = buffer->data + buffer->used;
+    memcpy(p, record, sizeof(run_record));
+    memcpy(p + sizeof(run_record), track.ptr, track.len);
+    memcpy(p + sizeof(run_record) + track.len, artist.ptr, artist.len);
+    buffer->count++;
+    buffer_offsets(buffer)[0] = buffer->used;
+    buffer->used += padded;
+    return true;
+}
+
+// Sorts the records of the buffer into output order and returns their offsets in that order
+static size_t *buffer_sort(run_buffer *buffer, const stream_order *order)
+{
+    const void *context[2] = {buffer->data, order};
+    size_t *offsets = buffer_offsets(buffer);
+
+    qsort_r(offsets, buffer->count, sizeof(size_t), compare_offsets, (void *)context);
+    return offsets;
+}
+
+static void write_row(out_writer *out, const run_record *record, const char *text)
+{
+    writer_song(out, record->year, record->month, record->day, text, record->track_len, text + record->track_len,
+                record->artist_len, record->key);
+}
+
+static int write_record(FILE *run, const run_record *record, const char *text)
+{
+    size_t n = (size_t)record->track_len + record->artist_len;
+
+    if (fwrite(record, sizeof(run_record), 1, run) != 1 || (n > 0 && fwrite(text, 1, n, run) != n))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function:  open_run
+ * -------------------
+ * @brief  Creates an anonymous temporary file for a run.
+ *
+ * The file lives in $TMPDIR (or /tmp) and is unlinked at once, so it goes
+ * away with the stream whatever happens to the process.
+ *
+ * @param buffer_size The size of the stdio buffer of the file.
+ *
+ * @return FILE* The file, open for writing and then reading, or NULL.
+ *
+ */
+static FILE *open_run(size_t buffer_size)
+{
+    const char *dir = getenv("TMPDIR");
+    char path[4096];
+    int fd;
+
+    if (dir == NULL || *dir == '\0')
+    {
+        dir = "/tmp";
+    }
+    if (snprintf(path, sizeof(path), "%s/song_analyzer.XXXXXX", dir) >= (int)sizeof(path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    unlink(path);
+
+    FILE *run = fdopen(fd, "w+b");
+    if (run == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    setvbuf(run, NULL, _IOFBF, buffer_size);
+    return run;
+}
+
+/**
+ * Function:  spill
+ * ----------------
+ * @brief  Sorts the buffer, writes it to a new run and empties it.
+ *
+ * @param buffer The buffer.
+ * @param order The output order.
+ *
+ * @return FILE* The run, rewound for reading, or NULL if it could not be written.
+ *
+ */
+static FILE *spill(run_buffer *buffer, const stream_order *order)
+{
+    size_t *offsets = buffer_sort(buffer, order);
+    size_t n = buffer->count < order->max_rows ? buffer->count : order->max_rows;
+    FILE *run = open_run(order->run_buffer_size);
+
+    for (size_t i = 0; run != NULL && i < n; i++)
+    {
+        const run_record *record = (const run_record *)(buffer->data + offsets[i]);
+        if (write_record(run, record, (const char *)(record + 1)) != 0)
+        {
+            fclose(run);
+            run = NULL;
+        }
+    }
+    if (run != NULL && (fflush(run) != 0 || fseek(run, 0, SEEK_SET) != 0))
+    {
+        fclose(run);
+        run = NULL;
+    }
+
+    buffer->used = 0;
+    buffer->count = 0;
+    return run;
+}
+
+// Reads the next record of a run; returns false at its end
+static bool reader_next(run_reader *reader)
+{
+    if (fread(&reader->record, sizeof(run_record), 1, reader->file) != 1)
+    {
+        return false;
+    }
+
+    size_t n = (size_t)reader->record.track_len + reader->record.artist_len;
+    if (n > reader->text_cap)
+    {
+        reader->text_cap = n;
+        reader->text = erealloc(reader->text, n);
+    }
+    return n == 0 || fread(reader->text, 1, n, reader->file) == n;
+}
+
+// Moves the reader at heap position i down until both children come later in the output
+static void sift_down(run_reader *readers, size_t *heap, size_t n, size_t i, const stream_order *order)
+{
+    for (;;)
+    {
+        size_t first = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < n && compare_readers(&readers[heap[left]], &readers[heap[first]], order) < 0)
+        {
+            first = left;
+        }
+        if (right < n && compare_readers(&readers[heap[right]], &readers[heap[first]], order) < 0)
+        {
+            first = right;
+        }
+        if (first == i)
+        {
+            return;
+        }
+        size_t temp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = temp;
+        i = first;
+    }
+}
+
+/**
+ * Function:  merge_runs
+ * ---------------------
+ * @brief  Merges sorted runs into rows of output or into one longer run.
+ *
+ * The runs are closed.
+ *
+ * @param runs The runs, rewound.
+ * @param n The number of runs, at most SPILL_FANIN.
+ * @param order The output order.
+ * @param merged The run to write records to for a later merge, or NULL to write rows.
+ * @param out The writer the rows go to when merged is NULL.
+ *
+ * @return int 0 on success, -1 if a run could not be read or written.
+ *
+ */
+static int merge_runs(FILE **runs, size_t n, const stream_order *order, FILE *merged, out_writer *out)
+{
+    run_reader readers[SPILL_FANIN];
+    size_t heap[SPILL_FANIN];
+    size_t live = 0;
+    size_t written = 0;
+    int status = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        readers[i].file = runs[i];
+        readers[i].text = NULL;
+        readers[i].text_cap = 0;
+        if (reader_next(&readers[i]))
+        {
+            heap[live++] = i;
+        }
+    }
+    for (size_t i = live / 2; i > 0; i--)
+    {
+        sift_down(readers, heap, live, i - 1, order);
+    }
+
+    while (live > 0 && written < order->max_rows && status == 0)
+    {
+        run_reader *first = &readers[heap[0]];
+
+        if (merged != NULL)
+        {
+            status = write_record(merged, &first->record, first->text);
+        }
+        else
+        {
+            write_row(out, &first->record, first->text);
+        }
+        written++;
+        if (!reader_next(first))
+        {
+            heap[0] = heap[--live];
+        }
+        sift_down(readers, heap, live, 0, order);
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        status = ferror(runs[i]) ? -1 : status;
+        fclose(runs[i]);
+        free(readers[i].text);
+    }
+    return status;
+}
+
+// Converts the numbers of a row whose columns are in the set, leaving the others as they were; gives the position
+// of the first malformed field, or -1
+static int decode_numbers(const field_t *fields, int count, unsigned columns, const field_map *map,
+                          stream_row *song)
+{
+    const int *at = map->position;
+
+    if ((columns & FIELD_BIT(FIELD_YEAR)) && csv_field_int32(csv_field(fields, count, at[FIELD_YEAR]), &song->year) != 0)
+    {
+        return at[FIELD_YEAR];
+    }
+    if ((columns & FIELD_BIT(FIELD_MONTH)) &&
+        csv_field_int32(csv_field(fields, count, at[FIELD_MONTH]), &song->month) != 0)
+    {
+        return at[FIELD_MONTH];
+    }
+    if ((columns & FIELD_BIT(FIELD_DAY)) && csv_field_int32(csv_field(fields, count, at[FIELD_DAY]), &song->day) != 0)
+    {
+        return at[FIELD_DAY];
+    }
+    if ((columns & FIELD_BIT(FIELD_SPOTIFY)) &&
+        csv_field_int32(csv_field(fields, count, at[FIELD_SPOTIFY]), &song->spotify) != 0)
+    {
+        return at[FIELD_SPOTIFY];
+    }
+    if ((columns & FIELD_BIT(FIELD_STREAMS)) &&
+        csv_field_int64(csv_field(fields, count, at[FIELD_STREAMS]), &song->streams) != 0)
+    {
+        return at[FIELD_STREAMS];
+    }
+    if ((columns & FIELD_BIT(FIELD_APPLE)) &&
+        csv_field_int32(csv_field(fields, count, at[FIELD_APPLE]), &song->apple) != 0)
+    {
+        return at[FIELD_APPLE];
+    }
+    return -1;
+}
+
+// Points the escaped names of a row at their text, unescaped into a scratch buffer that grows as needed
+static void unescape_names(stream_row *song, char **scratch, size_t *cap)
+{
+    char *p;
+
+    if (!song->track.escaped && !song->artist.escaped)
+    {
+        return;
+    }
+    if (song->track.len + song->artist.len > *cap)
+    {
+        *cap = song->track.len + song->artist.len;
+        *scratch = erealloc(*scratch, *cap);
+    }
+    p = *scratch;
+    if (song->track.escaped)
+    {
+        song->track.len = csv_unescape(song->track, p);
+        song->track.ptr = p;
+        song->track.escaped = false;
+        p += song->track.len;
+    }
+    if (song->artist.escaped)
+    {
+        song->artist.len = csv_unescape(song->artist, p);
+        song->artist.ptr = p;
+        song->artist.escaped = false;
+    }
+}
+
+/**
+ * Function:  stream_query
+ * -----------------------
+ * @brief  Filters the rows of a CSV file and writes the matches in output order.
+ *
+ * @param reader The reader over the input file, from csv_open() or csv_open_stream().
+ * @param filter The predicate a row must satisfy.
+ * @param arg The argument of the predicate.
+ * @param filter_columns The set of columns the predicate reads. Only these
+ *        are converted before it runs; the rest of the output columns are
+ *        converted for the rows it keeps.
+ * @param spec The ordering, from sort_parse().
+ * @param max_rows The number of rows to write at most.
+ * @param max_memory The size of the buffer matches are sorted in: what is left of the budget once the
+ *        reader has its share.
+ * @param out The writer the rows go to.
+ * @param stats The metrics of the query, to which the filter and sort stages are added.
+ * @param bad Receives the first field the query converts that does not
+ *        hold a number, with its row counted from the header and its
+ *        position in the row, or the name of a column the header lacks.
+ *
+ * @return int 0 on success, -1 with errno set if a temporary file failed
+ *         or a row does not fit in max_memory, or to EINVAL if a numeric
+ *         field is malformed or a column is missing.
+ *
+ */
+int stream_query(csv_reader *reader, stream_filter_fn filter, const void *arg, unsigned filter_columns,
+                 const sort_spec *spec, size_t max_rows, size_t max_memory, out_writer *out, query_stats *stats,
+                 csv_bad_value *bad)
+{
+    // The buffers of the runs being merged share the budget
+    stream_order plan = {spec, spec->terms[0].column, spec->terms[0].descending, spec->count > 1, max_rows,
+                         max_memory / (SPILL_FANIN + 1)};
+    bool unordered = spec->unordered;
+    unsigned output_columns = OUTPUT_COLUMNS | sort_columns(spec);
+    // The header is split whole; after it, the fields past the last column anyone reads are not
+    int limit = MAX_FIELDS;
+    field_map map;
+    field_t fields[MAX_FIELDS];
+    int count;
+    stream_row song = {0};
+    char *names = NULL;
+    size_t names_cap = 0;
+    uint64_t row = 0;
+    size_t released = 0;
+    size_t written = 0;
+    uint64_t matches = 0;
+    size_t start = reader->offset + reader->pos;
+    stats_clock clock;
+    stats_clock spilling;
+    stage_stats spilled = {0, 0, 0, 0, 0, 0, 0};
+    stage_stats *filtering = &stats->stages[STAGE_FILTER];
+    stage_stats *sorting = &stats->stages[STAGE_SORT];
+    run_buffer buffer = {NULL, max_memory & ~(size_t)(RECORD_ALIGN - 1), 0, 0};
+    FILE **runs = NULL;
+    size_t run_count = 0;
+    size_t run_cap = 0;
+    int status = 0;
+
+    if (max_rows == 0)
+    {
+        return 0;
+    }
+    if (!unordered)
+    {
+        buffer.data = (char *)emalloc(buffer.size);
+    }
+
+    stats_start(&clock);
+    while (status == 0 && csv_next_row(reader, fields, limit, &count))
+    {
+        run_record record;
+
+        if (reader->offset + reader->pos - released >= RELEASE_STEP)
+        {
+            released = csv_release(reader, released);
+        }
+
+        if (row == 0)
+        {
+            if (table_map_fields(&map, fields, count, output_columns | filter_columns, bad) != 0)
+            {
+                errno = EINVAL;
+                status = -1;
+                break;
+            }
+            limit = csv_field_limit(map.positions);
+            // The header line is no song, so the filter never sees it
+            row++;
+            continue;
+        }
+        song.track = csv_field(fields, count, map.position[FIELD_TRACK]);
+        song.artist = csv_field(fields, count, map.position[FIELD_ARTIST]);
+        unescape_names(&song, &names, &names_cap);
+        bad->field = decode_numbers(fields, count, filter_columns, &map, &song);
+        if (bad->field < 0 && !filter(&song, arg))
+        {
+            row++;
+            continue;
+        }
+        // Only the rows the filter kept pay for converting the other columns
+        if (bad->field < 0)
+        {
+            bad->field = decode_numbers(fields, count, output_columns & ~filter_columns, &map, &song);
+        }
+        if (bad->field >= 0)
+        {
+            bad->row = row;
+            bad->missing = NULL;
+            errno = EINVAL;
+            status = -1;
+            break;
+        }
+        matches++;
+
+        record.key = plan.key == KEY_STREAMS ? song.streams : plan.key == KEY_SPOTIFY ? song.spotify : song.apple;
+        record.row = row++;
+        record.streams = song.streams;
+        record.spotify = song.spotify;
+        record.apple = song.apple;
+        record.year = song.year;
+        record.month = song.month;
+        record.day = song.day;
+        record.track_len = (uint32_t)song.track.len;
+        record.artist_len = (uint32_t)song.artist.len;
+
+        if (unordered)
+        {
+            // Nothing to sort: the row can go out as soon as it matches
+            writer_song(out, record.year, record.month, record.day, song.track.ptr, song.track.len, song.artist.ptr,
+                        song.artist.len, record.key);
+            if (++written == max_rows)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (buffer_add(&buffer, &record, song.track, song.artist))
+        {
+            continue;
+        }
+        if (buffer.count == 0)
+        {
+            // Not even an empty buffer can hold this row
+            errno = EFBIG;
+            status = -1;
+            break;
+        }
+        if (run_count == run_cap)
+        {
+            run_cap = run_cap == 0 ? 16 : run_cap * 2;
+            runs = erealloc(runs, run_cap * sizeof(FILE *));
+        }
+        stats_start(&spilling);
+        runs[run_count] = spill(&buffer, &plan);
+        stats_stop(&spilling, &spilled);
+        if (runs[run_count] == NULL)
+        {
+            status = -1;
+            break;
+        }
+        run_count++;
+        if (!buffer_add(&buffer, &record, song.track, song.artist))
+        {
+            errno = EFBIG;
+            status = -1;
+        }
+    }
+    // Spilling was measured on its own, so take it out of the time and allocations of the loop
+    stats_stop(&clock, filtering);
+    filtering->wall_ms -= spilled.wall_ms;
+    filtering->cpu_ms -= spilled.cpu_ms;
+    sorting->wall_ms += spilled.wall_ms;
+    sorting->cpu_ms += spilled.cpu_ms;
+    filtering->allocations -= spilled.allocations;
+    filtering->allocated_bytes -= spilled.allocated_bytes;
+    sorting->allocations += spilled.allocations;
+    sorting->allocated_bytes += spilled.allocated_bytes;
+    filtering->rows_in += row > 0 ? row - 1 : 0;
+    filtering->rows_out += matches;
+    filtering->bytes += reader->offset + reader->pos - start;
+
+    stats_start(&clock);
+    if (status == 0 && !unordered && run_count == 0)
+    {
+        // Everything fit: print straight from the buffer
+        size_t *offsets = buffer_sort(&buffer, &plan);
+        for (size_t i = 0; i < buffer.count && i < max_rows; i++)
+        {
+            const run_record *record = (const run_record *)(buffer.data + offsets[i]);
+            write_row(out, record, (const char *)(record + 1));
+        }
+    }
+    else if (status == 0 && !unordered)
+    {
+        if (buffer.count > 0)
+        {
+            if (run_count == run_cap)
+            {
+                runs = erealloc(runs, ++run_cap * sizeof(FILE *));
+            }
+            runs[run_count] = spill(&buffer, &plan);
+            status = runs[run_count] == NULL ? -1 : 0;
+            run_count += status == 0;
+        }
+        free(buffer.data);
+        buffer.data = NULL;
+
+        size_t first = 0;
+        while (status == 0 && run_count - first > SPILL_FANIN)
+        {
+            FILE *merged = open_run(plan.run_buffer_size);
+            if (merged == NULL)
+            {
+                status = -1;
+                break;
+            }
+            status = merge_runs(runs + first, SPILL_FANIN, &plan, merged, NULL);
+            first += SPILL_FANIN;
+            if (status != 0 || fflush(merged) != 0 || fseek(merged, 0, SEEK_SET) != 0)
+            {
+                fclose(merged);
+                status = -1;
+                break;
+            }
+            if (run_count == run_cap)
+            {
+                run_cap *= 2;
+                runs = erealloc(runs, run_cap * sizeof(FILE *));
+            }
+            runs[run_count++] = merged;
+        }
+        if (status == 0)
+        {
+            status = merge_runs(runs + first, run_count - first, &plan, NULL, out);
+            first = run_count;
+        }
+        // Close whatever a failure left unmerged
+        for (size_t i = first; i < run_count; i++)
+        {
+            fclose(runs[i]);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < run_count; i++)
+        {
+            fclose(runs[i]);
+        }
+    }
+
+    if (!unordered)
+    {
+        stats_stop(&clock, sorting);
+        sorting->rows_in += matches;
+        sorting->rows_out += matches < max_rows ? matches : max_rows;
+    }
+
+    free(runs);
+    free(buffer.data);
+    free(names);
+    return status;
+}
@@ -0,0 +1,49 @@
+/** @file stream.h
+ *  @brief Function prototypes for the bounded-memory streaming query.
+ *
+ *  A streamed query reads the input file row by row without building a
+ *  table. Rows that need no ordering are written as soon as they match.
+ *  Otherwise matches are collected in a buffer of fixed size; each time it
+ *  fills up it is sorted and spilled to a temporary file, and the sorted
+ *  runs are merged at the end. Memory use stays within the given budget
+ *  whatever the size of the input; the buffers the file is read through
+ *  take 1/STREAM_READ_SHARE of it and the matches the rest.
+ */
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "csv.h"
+#include "sortkey.h"
+#include "stats.h"
+#include "writer.h"
+
+#define STREAM_MIN_MEMORY (1024 * 1024)
+#define STREAM_READ_SHARE 4
+
+typedef struct {
+    int32_t year;
+    int32_t month;
+    int32_t day;
+    int32_t spotify;
+    int32_t apple;
+    int64_t streams;
+    field_t track;
+    field_t artist;
+} stream_row;
+
+/**
+ * Tells whether a row of the input matches the query.
+ */
+typedef bool (*stream_filter_fn)(const stream_row *row, const void *arg);
+
+/**
+ * Function protypes associated with streamed queries.
+ */
+int stream_query(csv_reader *, stream_filter_fn, const void *arg, unsigned filter_columns, const sort_spec *,
+                 size_t max_rows, size_t max_memory, out_writer *out, query_stats *stats, csv_bad_value *bad);
+
+#endif
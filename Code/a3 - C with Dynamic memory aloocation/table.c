@@ -0,0 +1,681 @@
+/** @file table.c
+ *  @brief Implementation of the columnar song table.
+ *
+ * Columns grow together by doubling, and the string heap grows on its own.
+ * Names are stored as offsets rather than pointers so the heap can move
+ * when it grows.
+ *
+ * Artist names are interned through an open-addressing hash table of
+ * their IDs (plus one, so that 0 marks a free slot), kept at most half
+ * full. A loaded name is copied to the end of the heap before it is
+ * looked up, and the copy is dropped again if the name is already known,
+ * so the heap holds each artist once.
+ *
+ * A file can be loaded by several threads: each one parses a chunk of the
+ * file into a table of its own, and the partial tables are then appended
+ * in file order, so row numbers are the same as with a single thread.
+ * A caller that reads only some of the columns can load just those.
+ *
+ * Columns are found by name in the header row, so a file may hold them in
+ * any order and carry others besides, like the full Kaggle export does.
+ *
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "emalloc.h"
+#include "csv.h"
+#include "table.h"
+
+#define UTF8_BOM "\xef\xbb\xbf"
+
+// The header name of each column, by its FIELD_* number
+static const char *const field_names[FIELD_COUNT] = {
+    [FIELD_TRACK] = "track_name",
+    [FIELD_ARTIST] = "artist(s)_name",
+    [FIELD_YEAR] = "released_year",
+    [FIELD_MONTH] = "released_month",
+    [FIELD_DAY] = "released_day",
+    [FIELD_SPOTIFY] = "in_spotify_playlists",
+    [FIELD_STREAMS] = "streams",
+    [FIELD_APPLE] = "in_apple_playlists",
+};
+
+/**
+ * Function:  table_init
+ * ---------------------
+ * @brief  Prepares an empty table.
+ *
+ * @param table The table to be initialized.
+ *
+ */
+void table_init(song_table *table)
+{
+    assert(table != NULL);
+
+    memset(table, 0, sizeof(*table));
+}
+
+// Tells whether a header field is the given name, ignoring a byte order mark at the start of the file
+static bool is_name(field_t field, bool first, const char *name)
+{
+    size_t bom = strlen(UTF8_BOM);
+
+    if (first && field.len >= bom && memcmp(field.ptr, UTF8_BOM, bom) == 0)
+    {
+        field.ptr += bom;
+        field.len -= bom;
+    }
+    return field.len == strlen(name) && memcmp(field.ptr, name, field.len) == 0;
+}
+
+/**
+ * Function:  table_map_fields
+ * ---------------------------
+ * @brief  Finds the columns of a file from the names in its header row.
+ *
+ * Only the first MAX_FIELDS - 1 fields of the header are searched, since
+ * a row is never split into more slices than that.
+ *
+ * @param map Receives the position of each column in the set, and -1 for
+ *        the others.
+ * @param header The fields of the header row, split with MAX_FIELDS.
+ * @param count The number of fields.
+ * @param columns The set of columns that must be present.
+ * @param bad Receives the name of the first column of the set that the
+ *        header lacks.
+ *
+ * @return int 0 on success, -1 if a column is missing.
+ *
+ */
+int table_map_fields(field_map *map, const field_t *header, int count, unsigned columns, csv_bad_value *bad)
+{
+    int searched = count < MAX_FIELDS - 1 ? count : MAX_FIELDS - 1;
+
+    map->positions = 0;
+    for (int field = 0; field < FIELD_COUNT; field++)
+    {
+        map->position[field] = -1;
+        if (!(columns & FIELD_BIT(field)) || field_names[field] == NULL)
+        {
+            continue;
+        }
+        for (int i = 0; i < searched && map->position[field] < 0; i++)
+        {
+            if (is_name(header[i], i == 0, field_names[field]))
+            {
+                map->position[field] = i;
+            }
+        }
+        if (map->position[field] < 0)
+        {
+            bad->row = 0;
+            bad->field = -1;
+            bad->missing = field_names[field];
+            return -1;
+        }
+        map->positions |= 1u << map->position[field];
+    }
+    return 0;
+}
+
+/**
+ * Function:  table_add_row
+ * ------------------------
+ * @brief  Appends a row, growing every column if needed.
+ *
+ * The values of the new row are left for the caller to fill in.
+ *
+ * @param table The table.
+ *
+ * @return size_t The index of the new row.
+ *
+ */
+size_t table_add_row(song_table *table)
+{
+    if (table->rows == table->capacity)
+    {
+        table_reserve(table, table->capacity == 0 ? 1024 : table->capacity * 2);
+    }
+
+    return table->rows++;
+}
+
+/**
+ * Function:  table_reserve
+ * ------------------------
+ * @brief  Makes room for a number of rows without adding them.
+ *
+ * @param table The table.
+ * @param capacity The number of rows the columns must be able to hold.
+ *
+ */
+void table_reserve(song_table *table, size_t capacity)
+{
+    if (capacity > table->capacity)
+    {
+        table->year = erealloc(table->year, capacity * sizeof(int32_t));
+        table->month = erealloc(table->month, capacity * sizeof(int32_t));
+        table->day = erealloc(table->day, capacity * sizeof(int32_t));
+        table->spotify = erealloc(table->spotify, capacity * sizeof(int32_t));
+        table->apple = erealloc(table->apple, capacity * sizeof(int32_t));
+        table->streams = erealloc(table->streams, capacity * sizeof(int64_t));
+        table->track = erealloc(table->track, capacity * sizeof(uint64_t));
+        table->artist = erealloc(table->artist, capacity * sizeof(uint32_t));
+        table->capacity = capacity;
+    }
+}
+
+/**
+ * Function:  table_add_string
+ * ---------------------------
+ * @brief  Copies a name into the string heap.
+ *
+ * @param table The table.
+ * @param s The bytes of the name.
+ * @param n The length of the name.
+ *
+ * @return uint64_t The offset of the NUL-terminated copy in the heap.
+ *
+ */
+uint64_t table_add_string(song_table *table, const char *s, size_t n)
+{
+    uint64_t offset = table->strings_len;
+
+    if (table->strings_len + n + 1 > table->strings_cap)
+    {
+        size_t capacity = table->strings_cap == 0 ? 64 * 1024 : table->strings_cap * 2;
+        while (capacity < table->strings_len + n + 1)
+        {
+            capacity *= 2;
+        }
+        table->strings = erealloc(table->strings, capacity);
+        table->strings_cap = capacity;
+    }
+
+    memcpy(table->strings + table->strings_len, s, n);
+    table->strings[table->strings_len + n] = '\0';
+    table->strings_len += n + 1;
+    return offset;
+}
+
+// Hashes a NUL-terminated name (FNV-1a)
+static uint64_t hash_name(const char *s)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (; *s != '\0'; s++)
+    {
+        hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Doubles the hash table of the artists and puts every known one back in it
+static void grow_artist_slots(song_table *table)
+{
+    size_t size = table->artist_slots_size == 0 ? 1024 : table->artist_slots_size * 2;
+    uint32_t *slots = (uint32_t *)emalloc(size * sizeof(uint32_t));
+
+    memset(slots, 0, size * sizeof(uint32_t));
+    for (size_t id = 0; id < table->artist_count; id++)
+    {
+        size_t slot = hash_name(table->strings + table->artists[id]) & (size - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+        slots[slot] = (uint32_t)id + 1;
+    }
+    free(table->artist_slots);
+    table->artist_slots = slots;
+    table->artist_slots_size = size;
+}
+
+/**
+ * Function:  intern_artist
+ * ------------------------
+ * @brief  Finds an artist name of the string heap in the dictionary, adding it if it is new.
+ *
+ * @param table The table.
+ * @param offset The offset of the NUL-terminated name in the heap.
+ * @param added Set to true if the name was new and its copy at offset is now the dictionary's.
+ *
+ * @return uint32_t The ID of the artist.
+ *
+ */
+static uint32_t intern_artist(song_table *table, uint64_t offset, bool *added)
+{
+    const char *name = table->strings + offset;
+    size_t mask;
+    size_t slot;
+
+    if (2 * (table->artist_count + 1) > table->artist_slots_size)
+    {
+        grow_artist_slots(table);
+    }
+    mask = table->artist_slots_size - 1;
+    slot = hash_name(name) & mask;
+    while (table->artist_slots[slot] != 0)
+    {
+        uint32_t id = table->artist_slots[slot] - 1;
+        if (strcmp(table->strings + table->artists[id], name) == 0)
+        {
+            *added = false;
+            return id;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (table->artist_count == table->artist_cap)
+    {
+        table->artist_cap = table->artist_cap == 0 ? 1024 : table->artist_cap * 2;
+        table->artists = erealloc(table->artists, table->artist_cap * sizeof(uint64_t));
+    }
+    table->artists[table->artist_count] = offset;
+    table->artist_slots[slot] = (uint32_t)table->artist_count + 1;
+    *added = true;
+    return (uint32_t)table->artist_count++;
+}
+
+// Interns the artist name last copied into the heap, dropping the copy if the name was already known
+static uint32_t intern_last(song_table *table, uint64_t offset)
+{
+    bool added;
+    uint32_t id = intern_artist(table, offset, &added);
+
+    if (!added)
+    {
+        table->strings_len = offset;
+    }
+    return id;
+}
+
+/**
+ * Function:  table_add_artist
+ * ---------------------------
+ * @brief  Finds an artist name in the dictionary, copying it into the string heap if it is new.
+ *
+ * @param table The table.
+ * @param s The bytes of the name.
+ * @param n The length of the name.
+ *
+ * @return uint32_t The ID of the artist.
+ *
+ */
+uint32_t table_add_artist(song_table *table, const char *s, size_t n)
+{
+    return intern_last(table, table_add_string(table, s, n));
+}
+
+/**
+ * Function:  table_match_artists
+ * ------------------------------
+ * @brief  Tests every distinct artist of the table once.
+ *
+ * @param table The table.
+ * @param keep The test an artist name must pass.
+ * @param arg The argument of the test.
+ *
+ * @return uint64_t* The set of the artists that passed, one bit per ID, for
+ *         table_artist_in(); to be released with free().
+ *
+ */
+uint64_t *table_match_artists(const song_table *table, table_name_fn keep, const void *arg)
+{
+    size_t words = (table->artist_count + 63) / 64 + 1;
+    uint64_t *set = (uint64_t *)emalloc(words * sizeof(uint64_t));
+
+    memset(set, 0, words * sizeof(uint64_t));
+    for (size_t id = 0; id < table->artist_count; id++)
+    {
+        if (keep(table->strings + table->artists[id], arg))
+        {
+            set[id >> 6] |= (uint64_t)1 << (id & 63);
+        }
+    }
+    return set;
+}
+
+/**
+ * Function:  table_append
+ * -----------------------
+ * @brief  Appends every row of another table.
+ *
+ * @param table The table that receives the rows.
+ * @param other The table whose rows are copied.
+ *
+ */
+void table_append(song_table *table, const song_table *other)
+{
+    size_t base = table->rows;
+    uint64_t shift = table->strings_len;
+    uint32_t *ids;
+
+    table_reserve(table, base + other->rows);
+    memcpy(table->year + base, other->year, other->rows * sizeof(int32_t));
+    memcpy(table->month + base, other->month, other->rows * sizeof(int32_t));
+    memcpy(table->day + base, other->day, other->rows * sizeof(int32_t));
+    memcpy(table->spotify + base, other->spotify, other->rows * sizeof(int32_t));
+    memcpy(table->apple + base, other->apple, other->rows * sizeof(int32_t));
+    memcpy(table->streams + base, other->streams, other->rows * sizeof(int64_t));
+
+    if (other->strings_len > 0)
+    {
+        if (table->strings_len + other->strings_len > table->strings_cap)
+        {
+            table->strings_cap = table->strings_len + other->strings_len;
+            table->strings = erealloc(table->strings, table->strings_cap);
+        }
+        memcpy(table->strings + table->strings_len, other->strings, other->strings_len);
+        table->strings_len += other->strings_len;
+    }
+
+    // The other dictionary is now in the heap too; a name both tables know keeps its first copy
+    ids = (uint32_t *)emalloc((other->artist_count + 1) * sizeof(uint32_t));
+    for (size_t id = 0; id < other->artist_count; id++)
+    {
+        bool added;
+        ids[id] = intern_artist(table, other->artists[id] + shift, &added);
+    }
+    for (size_t row = 0; row < other->rows; row++)
+    {
+        table->track[base + row] = other->track[row] + shift;
+        table->artist[base + row] = ids[other->artist[row]];
+    }
+    table->rows += other->rows;
+    free(ids);
+}
+
+// Copies a name into the string heap, turning the doubled quotes of an escaped field into single ones
+static uint64_t load_name(song_table *table, field_t field)
+{
+    uint64_t offset = table_add_string(table, field.ptr, field.len);
+
+    if (field.escaped)
+    {
+        size_t n = csv_unescape(field, table->strings + offset);
+        table->strings[offset + n] = '\0';
+        table->strings_len = offset + n + 1;
+    }
+    return offset;
+}
+
+// Converts a field of the row into a column if it is in the set, and sets 0 otherwise; false if it is not a number
+static bool load_int32(int32_t *value, const field_t *fields, int count, unsigned columns, const field_map *map,
+                       int field)
+{
+    *value = 0;
+    return !(columns & FIELD_BIT(field)) ||
+           csv_field_int32(csv_field(fields, count, map->position[field]), value) == 0;
+}
+
+// Same as load_int32() for a 64-bit column
+static bool load_int64(int64_t *value, const field_t *fields, int count, unsigned columns, const field_map *map,
+                       int field)
+{
+    *value = 0;
+    return !(columns & FIELD_BIT(field)) ||
+           csv_field_int64(csv_field(fields, count, map->position[field]), value) == 0;
+}
+
+/**
+ * Function:  load_rows
+ * --------------------
+ * @brief  Appends every row a reader yields to the table.
+ *
+ * Only the columns in the set are converted or copied; the others read
+ * as 0, or as an empty name, and the fields after the last wanted one
+ * are not split at all. The names of the header row are kept like any
+ * others, but its numbers read as 0. Loading stops at the first field
+ * of a numeric column that does not hold a number.
+ *
+ * @param table The table.
+ * @param reader The reader (or chunk of a reader) to be consumed.
+ * @param columns The set of columns to be loaded.
+ * @param map Where the columns are in each row; filled in from the
+ *        header when the reader starts with it.
+ * @param header Whether the first row is the header of the file.
+ * @param bad Receives the malformed field, with its row counted from the
+ *        first one of the reader and its position in the row, or the
+ *        name of a column the header lacks.
+ *
+ * @return int 0 on success, -1 if a numeric field is malformed or a
+ *         column is missing.
+ *
+ */
+static int load_rows(song_table *table, csv_reader *reader, unsigned columns, field_map *map, bool header,
+                     csv_bad_value *bad)
+{
+    field_t fields[MAX_FIELDS];
+    // The header is split whole, so that any of its fields can be a column
+    int limit = header ? MAX_FIELDS : csv_field_limit(map->positions);
+    int count;
+    bool tracks = (columns & FIELD_BIT(FIELD_TRACK)) != 0;
+    bool artists = (columns & FIELD_BIT(FIELD_ARTIST)) != 0;
+    // Names that are not loaded all share one empty string
+    uint64_t blank = tracks ? 0 : table_add_string(table, "", 0);
+    uint32_t nobody = artists ? 0 : table_add_artist(table, "", 0);
+    size_t first = table->rows;
+
+    while (csv_next_row(reader, fields, limit, &count))
+    {
+        size_t row = table_add_row(table);
+        unsigned numbers = columns;
+
+        if (header && row == first)
+        {
+            if (table_map_fields(map, fields, count, columns, bad) != 0)
+            {
+                return -1;
+            }
+            limit = csv_field_limit(map->positions);
+            numbers = 0;
+        }
+        table->track[row] = tracks ? load_name(table, csv_field(fields, count, map->position[FIELD_TRACK])) : blank;
+        table->artist[row] =
+            artists ? intern_last(table, load_name(table, csv_field(fields, count, map->position[FIELD_ARTIST])))
+                    : nobody;
+        int field = !load_int32(&table->year[row], fields, count, numbers, map, FIELD_YEAR) ? FIELD_YEAR
+                    : !load_int32(&table->month[row], fields, count, numbers, map, FIELD_MONTH) ? FIELD_MONTH
+                    : !load_int32(&table->day[row], fields, count, numbers, map, FIELD_DAY) ? FIELD_DAY
+                    : !load_int32(&table->spotify[row], fields, count, numbers, map, FIELD_SPOTIFY) ? FIELD_SPOTIFY
+                    : !load_int64(&table->streams[row], fields, count, numbers, map, FIELD_STREAMS) ? FIELD_STREAMS
+                    : !load_int32(&table->apple[row], fields, count, numbers, map, FIELD_APPLE) ? FIELD_APPLE
+                    : -1;
+        if (field >= 0)
+        {
+            bad->row = row - first;
+            bad->field = map->position[field];
+            bad->missing = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    csv_reader chunk;
+    unsigned columns;
+    field_map map;
+    bool header;
+    song_table part;
+    csv_bad_value bad;
+    int status;
+    pthread_t worker;
+    bool started;
+} load_job;
+
+static void *load_chunk(void *arg)
+{
+    load_job *job = (load_job *)arg;
+
+    job->status = load_rows(&job->part, &job->chunk, job->columns, &job->map, job->header, &job->bad);
+    return NULL;
+}
+
+/**
+ * Function:  table_load_csv
+ * -------------------------
+ * @brief  Appends every row of a song CSV file to the table.
+ *
+ * @param table The table.
+ * @param filename The path of the CSV file.
+ * @param threads The number of threads that parse the file.
+ * @param columns The set of columns the caller will read, such as
+ *        ALL_COLUMNS; the others are left as 0 or as empty names.
+ * @param bad Receives the first field of a numeric column that does not
+ *        hold a number, with its row counted from the header (row 0) of
+ *        the file, or the name of a column of the set the header lacks.
+ *
+ * @return int 0 on success, -1 if the file could not be read, or with
+ *         errno set to EINVAL if a numeric field is malformed or a column
+ *         is missing.
+ *
+ */
+int table_load_csv(song_table *table, const char *filename, int threads, unsigned columns, csv_bad_value *bad)
+{
+    csv_reader reader;
+    csv_reader header;
+    field_t fields[MAX_FIELDS];
+    int count;
+    field_map map;
+    int status = 0;
+
+    if (threads <= 1)
+    {
+        // One parser: read the file on a thread of its own while it parses
+        if (csv_open_stream(&reader, filename, 0) != 0)
+        {
+            return -1;
+        }
+        status = load_rows(table, &reader, columns, &map, true, bad);
+        int error = csv_error(&reader);
+        csv_close(&reader);
+        if (error != 0)
+        {
+            errno = error;
+            return -1;
+        }
+        if (status != 0)
+        {
+            errno = EINVAL;
+        }
+        return status;
+    }
+
+    if (csv_open(&reader, filename) != 0)
+    {
+        return -1;
+    }
+
+    // Every chunk needs the columns, but only the first one holds the header
+    header = reader;
+    if (!csv_next_row(&header, fields, MAX_FIELDS, &count))
+    {
+        count = 0;
+    }
+    if (table_map_fields(&map, fields, count, count > 0 ? columns : 0, bad) != 0)
+    {
+        csv_close(&reader);
+        errno = EINVAL;
+        return -1;
+    }
+
+    load_job *jobs = (load_job *)emalloc((size_t)threads * sizeof(load_job));
+    csv_reader *chunks = (csv_reader *)emalloc((size_t)threads * sizeof(csv_reader));
+
+    csv_split(&reader, threads, chunks);
+    for (int i = 0; i < threads; i++)
+    {
+        jobs[i].chunk = chunks[i];
+        jobs[i].columns = columns;
+        jobs[i].map = map;
+        jobs[i].header = i == 0;
+        table_init(&jobs[i].part);
+        jobs[i].started = pthread_create(&jobs[i].worker, NULL, load_chunk, &jobs[i]) == 0;
+        if (!jobs[i].started)
+        {
+            // Parse the chunk on this thread if no new one can be started
+            load_chunk(&jobs[i]);
+        }
+    }
+
+    size_t rows = table->rows;
+    for (int i = 0; i < threads; i++)
+    {
+        if (jobs[i].started)
+        {
+            pthread_join(jobs[i].worker, NULL);
+        }
+        rows += jobs[i].part.rows;
+    }
+
+    // The first malformed field in file order is in the first chunk that failed
+    size_t before = 0;
+    for (int i = 0; i < threads && status == 0; i++)
+    {
+        if (jobs[i].status != 0)
+        {
+            *bad = jobs[i].bad;
+            bad->row += before;
+            errno = EINVAL;
+            status = -1;
+        }
+        before += jobs[i].part.rows;
+    }
+
+    if (status == 0)
+    {
+        table_reserve(table, rows);
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        if (status == 0)
+        {
+            table_append(table, &jobs[i].part);
+        }
+        table_free(&jobs[i].part);
+    }
+
+    free(chunks);
+    free(jobs);
+    csv_close(&reader);
+    return status;
+}
+
+/**
+ * Function:  table_free
+ * ---------------------
+ * @brief  Releases every column and the string heap, or unmaps them.
+ *
+ * @param table The table.
+ *
+ */
+void table_free(song_table *table)
+{
+    if (table->mapping != NULL)
+    {
+        munmap(table->mapping, table->mapping_size);
+        table_init(table);
+        return;
+    }
+
+    free(table->year);
+    free(table->month);
+    free(table->day);
+    free(table->spotify);
+    free(table->apple);
+    free(table->streams);
+    free(table->track);
+    free(table->artist);
+    free(table->artists);
+    free(table->artist_slots);
+    free(table->strings);
+    table_init(table);
+}
@@ -0,0 +1,125 @@
+/** @file table.h
+ *  @brief Function prototypes for the columnar song table.
+ *
+ *  The table stores the dataset as one contiguous array per column. Track
+ *  and artist names live in a single string heap and each row keeps the
+ *  offset of its NUL-terminated track name, so a scan over one numeric
+ *  column touches nothing but that column. Artist names repeat across many
+ *  rows, so each distinct one is stored once in a dictionary and rows keep
+ *  its 32-bit ID; a test on the artist runs once per distinct name and the
+ *  rows only look up the answer. A table loaded from a snapshot points
+ *  into the mapped file instead of owning its columns.
+ */
+#ifndef _TABLE_H_
+#define _TABLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The columns used from each row of the input file, numbered by their
+// positions in the original dataset; table_map_fields() finds where they
+// are in a given file from the names in its header
+#define FIELD_TRACK 0
+#define FIELD_ARTIST 1
+#define FIELD_YEAR 3
+#define FIELD_MONTH 4
+#define FIELD_DAY 5
+#define FIELD_SPOTIFY 6
+#define FIELD_STREAMS 7
+#define FIELD_APPLE 8
+#define FIELD_COUNT 9
+
+// A set of columns holds the bit of each of their numbers
+#define FIELD_BIT(field) (1u << (field))
+// The columns every displayed song needs besides its count
+#define OUTPUT_COLUMNS (FIELD_BIT(FIELD_TRACK) | FIELD_BIT(FIELD_ARTIST) | FIELD_BIT(FIELD_YEAR) | \
+                        FIELD_BIT(FIELD_MONTH) | FIELD_BIT(FIELD_DAY))
+// Every column the table stores
+#define ALL_COLUMNS (OUTPUT_COLUMNS | FIELD_BIT(FIELD_SPOTIFY) | FIELD_BIT(FIELD_STREAMS) | FIELD_BIT(FIELD_APPLE))
+
+struct csv_bad_value;
+struct field_t;
+
+// Where the columns are in the rows of one input file
+typedef struct {
+    int position[FIELD_COUNT];
+    unsigned positions;
+} field_map;
+
+/**
+ * Tells whether an artist name passes a test.
+ */
+typedef bool (*table_name_fn)(const char *name, const void *arg);
+
+typedef struct {
+    size_t rows;
+    size_t capacity;
+    int32_t *year;
+    int32_t *month;
+    int32_t *day;
+    int32_t *spotify;
+    int32_t *apple;
+    int64_t *streams;
+    uint64_t *track;
+    uint32_t *artist;
+    uint64_t *artists;
+    size_t artist_count;
+    size_t artist_cap;
+    uint32_t *artist_slots;
+    size_t artist_slots_size;
+    char *strings;
+    size_t strings_len;
+    size_t strings_cap;
+    void *mapping;
+    size_t mapping_size;
+} song_table;
+
+/**
+ * Function protypes associated with the song table.
+ */
+void table_init(song_table *);
+int table_map_fields(field_map *, const struct field_t *header, int count, unsigned columns,
+                     struct csv_bad_value *bad);
+int table_load_csv(song_table *, const char *filename, int threads, unsigned columns, struct csv_bad_value *bad);
+void table_reserve(song_table *, size_t capacity);
+size_t table_add_row(song_table *);
+void table_append(song_table *, const song_table *);
+uint64_t table_add_string(song_table *, const char *, size_t);
+uint32_t table_add_artist(song_table *, const char *, size_t);
+uint64_t *table_match_artists(const song_table *, table_name_fn, const void *arg);
+void table_free(song_table *);
+
+/**
+ * Function:  table_track
+ * ----------------------
+ * @brief  Returns the track name of a row.
+ */
+static inline const char *table_track(const song_table *table, size_t row)
+{
+    return table->strings + table->track[row];
+}
+
+/**
+ * Function:  table_artist
+ * -----------------------
+ * @brief  Returns the artist name(s) of a row.
+ */
+static inline const char *table_artist(const song_table *table, size_t row)
+{
+    return table->strings + table->artists[table->artist[row]];
+}
+
+/**
+ * Function:  table_artist_in
+ * --------------------------
+ * @brief  Tells whether the artist of a row is in a set from table_match_artists().
+ */
+static inline bool table_artist_in(const song_table *table, const uint64_t *set, size_t row)
+{
+    uint32_t id = table->artist[row];
+
+    return (set[id >> 6] >> (id & 63)) & 1;
+}
+
+#endif
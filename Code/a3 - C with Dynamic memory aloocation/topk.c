@@ -0,0 +1,360 @@
+/** @file topk.c
+ *  @brief Implementation of the top-K selection engine.
+ *
+ * Candidates are kept in an array-backed binary heap whose root is the
+ * candidate that would be printed last. When a limit is given the heap never
+ * grows past it, so ordering N matches costs O(N log K) instead of the
+ * O(N^2) of sorted list insertion. Without a limit every candidate is
+ * appended and the array is radix sorted once in topk_finish(), in time
+ * linear in the number of candidates.
+ *
+ * Each entry carries a copy of its key, already flipped for a descending
+ * order, and a tie-breaker, so comparing two entries takes two integer
+ * comparisons and never goes back to the table. Only when the keys are
+ * equal and --order_by has further terms are the rows themselves
+ * compared. Remaining ties are broken the way the original sorted list
+ * insertion broke them: among rows with an equal key, the one read later
+ * comes first. Without an order, every key is 0 and the tie-breaker
+ * alone keeps the order of the file.
+ *
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emalloc.h"
+#include "radix.h"
+#include "topk.h"
+
+/**
+ * Function:  row_key
+ * ------------------
+ * @brief  Returns the value of the column a row is ordered by.
+ *
+ * @param table The table holding the row.
+ * @param row The row to read the key from.
+ * @param key The column to be read.
+ *
+ * @return int64_t The value of the column.
+ *
+ */
+static int64_t row_key(const song_table *table, uint32_t row, sort_key key)
+{
+    switch (key)
+    {
+    case KEY_STREAMS:
+        return table->streams[row];
+    case KEY_SPOTIFY:
+        return table->spotify[row];
+    default:
+        return table->apple[row];
+    }
+}
+
+// Gathers the columns of a row that the later terms of --order_by read
+static void row_columns(const song_table *table, const sort_spec *spec, uint32_t row, sort_row *out)
+{
+    for (size_t i = 1; i < spec->count; i++)
+    {
+        switch (spec->terms[i].column)
+        {
+        case KEY_STREAMS:
+            out->streams = table->streams[row];
+            break;
+        case KEY_SPOTIFY:
+            out->spotify = table->spotify[row];
+            break;
+        case KEY_APPLE:
+            out->apple = table->apple[row];
+            break;
+        case KEY_RELEASED:
+            out->year = table->year[row];
+            out->month = table->month[row];
+            out->day = table->day[row];
+            break;
+        case KEY_TRACK:
+            out->track = table_track(table, row);
+            out->track_len = strlen(out->track);
+            break;
+        default:
+            out->artist = table_artist(table, row);
+            out->artist_len = strlen(out->artist);
+            break;
+        }
+    }
+}
+
+/**
+ * Function:  topk_compare
+ * -----------------------
+ * @brief  Compares two candidates by output position.
+ *
+ * @param t The engine holding the ordering criteria.
+ * @param a The first candidate.
+ * @param b The second candidate.
+ *
+ * @return int Negative if a is printed before b, positive otherwise.
+ *
+ */
+int topk_compare(const topk_t *t, const topk_entry *a, const topk_entry *b)
+{
+    if (a->key != b->key)
+    {
+        return a->key < b->key ? -1 : 1;
+    }
+    if (t->ties)
+    {
+        sort_row first;
+        sort_row second;
+
+        row_columns(t->table, &t->spec, a->row, &first);
+        row_columns(t->table, &t->spec, b->row, &second);
+        int c = sort_compare_ties(&t->spec, &first, &second);
+        if (c != 0)
+        {
+            return c;
+        }
+    }
+
+    return a->tie < b->tie ? -1 : 1;
+}
+
+// qsort_r() form of topk_compare()
+static int compare_entries(const void *a, const void *b, void *t)
+{
+    return topk_compare((const topk_t *)t, (const topk_entry *)a, (const topk_entry *)b);
+}
+
+static void swap_entries(topk_entry *a, topk_entry *b)
+{
+    topk_entry temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+// Moves the entry at i up until its parent is printed after it
+static void sift_up(topk_t *t, size_t i)
+{
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if (topk_compare(t, &t->entries[parent], &t->entries[i]) > 0)
+        {
+            break;
+        }
+        swap_entries(&t->entries[parent], &t->entries[i]);
+        i = parent;
+    }
+}
+
+// Moves the entry at i down until both children are printed before it
+static void sift_down(topk_t *t, size_t i, size_t n)
+{
+    for (;;)
+    {
+        size_t last = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+
+        if (left < n && topk_compare(t, &t->entries[left], &t->entries[last]) > 0)
+        {
+            last = left;
+        }
+        if (right < n && topk_compare(t, &t->entries[right], &t->entries[last]) > 0)
+        {
+            last = right;
+        }
+        if (last == i)
+        {
+            return;
+        }
+        swap_entries(&t->entries[i], &t->entries[last]);
+        i = last;
+    }
+}
+
+/**
+ * Function:  topk_init
+ * --------------------
+ * @brief  Prepares an empty engine for a query.
+ *
+ * @param t The engine to be initialized.
+ * @param table The table the offered rows belong to.
+ * @param spec The ordering, from sort_parse().
+ * @param limit The number of songs to keep, or 0 to keep all of them.
+ *
+ */
+void topk_init(topk_t *t, const song_table *table, const sort_spec *spec, int limit)
+{
+    assert(t != NULL && table != NULL && spec != NULL && spec->count > 0);
+
+    t->entries = NULL;
+    t->count = 0;
+    t->capacity = 0;
+    t->limit = limit > 0 ? (size_t)limit : 0;
+    t->table = table;
+    t->spec = *spec;
+    t->ties = spec->count > 1 && !spec->unordered;
+}
+
+/**
+ * Function:  topk_offer
+ * ---------------------
+ * @brief  Offers a matching row to the engine.
+ *
+ * Rows must be offered in increasing order so that ties keep the order
+ * of the input file.
+ *
+ * @param t The engine.
+ * @param row The index of the matching row in the table.
+ *
+ * @return bool True if the row is currently among the kept candidates.
+ *
+ */
+bool topk_offer(topk_t *t, uint32_t row)
+{
+    topk_entry entry;
+
+    if (t->spec.unordered)
+    {
+        entry.key = 0;
+        entry.tie = row;
+    }
+    else
+    {
+        entry.key = row_key(t->table, row, t->spec.terms[0].column);
+        // ~ reverses the order of every int64_t without overflowing
+        entry.key = t->spec.terms[0].descending ? ~entry.key : entry.key;
+        entry.tie = ~row;
+    }
+    entry.row = row;
+
+    if (t->limit == 0 || t->count < t->limit)
+    {
+        if (t->count == t->capacity)
+        {
+            size_t capacity = t->capacity == 0 ? 64 : t->capacity * 2;
+            if (t->limit != 0 && capacity > t->limit)
+            {
+                capacity = t->limit;
+            }
+            t->entries = (topk_entry *)erealloc(t->entries, capacity * sizeof(topk_entry));
+            t->capacity = capacity;
+        }
+
+        t->entries[t->count++] = entry;
+        // The unbounded path is heapified once in topk_finish()
+        if (t->limit != 0)
+        {
+            sift_up(t, t->count - 1);
+        }
+        return true;
+    }
+
+    if (topk_compare(t, &entry, &t->entries[0]) > 0)
+    {
+        return false;
+    }
+
+    t->entries[0] = entry;
+    sift_down(t, 0, t->count);
+    return true;
+}
+
+/**
+ * Function:  topk_finish
+ * ----------------------
+ * @brief  Sorts the kept rows into output order.
+ *
+ * @param t The engine.
+ * @param count Receives the number of kept rows.
+ *
+ * @return const topk_entry* The kept rows, first printed first. The array
+ *         belongs to the engine and lives until topk_free().
+ *
+ */
+const topk_entry *topk_finish(topk_t *t, size_t *count)
+{
+    size_t i;
+    size_t n = t->count;
+
+    *count = n;
+    if (n == 0)
+    {
+        return t->entries;
+    }
+
+    if (t->limit == 0)
+    {
+        // Everything was kept, in the order it was offered
+        topk_sort(t, t->entries, n, 1);
+        return t->entries;
+    }
+
+    // Heapsort: repeatedly move the last-printed candidate to the back
+    for (i = n - 1; i > 0; i--)
+    {
+        swap_entries(&t->entries[0], &t->entries[i]);
+        sift_down(t, 0, i);
+    }
+
+    return t->entries;
+}
+
+/**
+ * Function:  topk_sort
+ * --------------------
+ * @brief  Sorts unranked entries into output order with a radix sort.
+ *
+ * The radix sort is stable and orders on the first term only, so the
+ * entries are first reversed to put later rows first among equal keys;
+ * runs of equal keys are then sorted on the later terms, if there are any.
+ *
+ * @param t The engine holding the ordering criteria.
+ * @param entries Entries of rows offered to engines with this ordering, in increasing row order.
+ * @param n The number of entries.
+ * @param threads The number of threads to sort with.
+ *
+ */
+void topk_sort(const topk_t *t, topk_entry *entries, size_t n, int threads)
+{
+    if (t->spec.unordered)
+    {
+        // Increasing row order already is the order of the file
+        return;
+    }
+
+    for (size_t i = 0, j = n; i + 1 < j; i++, j--)
+    {
+        swap_entries(&entries[i], &entries[j - 1]);
+    }
+    radix_sort(entries, n, t->spec.terms[0].column == KEY_STREAMS ? RADIX_KEY64 : RADIX_KEY32, threads);
+
+    if (t->ties)
+    {
+        for (size_t i = 0, j; i < n; i = j)
+        {
+            for (j = i + 1; j < n && entries[j].key == entries[i].key; j++)
+                ;
+            if (j - i > 1)
+            {
+                qsort_r(entries + i, j - i, sizeof(topk_entry), compare_entries, (void *)t);
+            }
+        }
+    }
+}
+
+/**
+ * Function:  topk_free
+ * --------------------
+ * @brief  Releases the memory used by the engine itself.
+ *
+ * @param t The engine.
+ *
+ */
+void topk_free(topk_t *t)
+{
+    free(t->entries);
+    t->entries = NULL;
+    t->count = 0;
+    t->capacity = 0;
+}
@@ -0,0 +1,44 @@
+/** @file topk.h
+ *  @brief Function prototypes for the top-K selection engine.
+ *
+ *  The engine orders matching rows of a song table on the order_by terms.
+ *  With a limit it keeps only the best K candidates in a bounded binary
+ *  heap; without one it collects every candidate and radix sorts them
+ *  once at the end.
+ */
+#ifndef _TOPK_H_
+#define _TOPK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sortkey.h"
+#include "table.h"
+
+typedef struct {
+    int64_t key;
+    uint32_t row;
+    uint32_t tie;
+} topk_entry;
+
+typedef struct {
+    topk_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t limit;
+    const song_table *table;
+    sort_spec spec;
+    bool ties;
+} topk_t;
+
+/**
+ * Function protypes associated with the top-K engine.
+ */
+void topk_init(topk_t *, const song_table *, const sort_spec *, int limit);
+bool topk_offer(topk_t *, uint32_t row);
+const topk_entry *topk_finish(topk_t *, size_t *count);
+void topk_sort(const topk_t *, topk_entry *entries, size_t n, int threads);
+void topk_free(topk_t *);
+int topk_compare(const topk_t *, const topk_entry *, const topk_entry *);
+
+#endif
@@ -0,0 +1,711 @@
+/** @file where.c
+ *  @brief Implementation of the --where filter expressions.
+ *
+ * The grammar is
+ *
+ *     expression := test { AND test }
+ *     test       := field op value
+ *     field      := year | month | day | spotify | apple | streams | track | artist
+ *     op         := = | == | != | <> | < | <= | > | >=      (numbers and text)
+ *                 | ~ | !~                                  (text: contains, does not contain)
+ *     value      := integer | 'text' | "text"
+ *
+ * Quoted text runs up to the next quote of the same kind; track and
+ * artist only take the equality and substring operators. Keywords and
+ * field names ignore case. Text tests honour --ignore-case like the
+ * ARTIST filter does.
+ *
+ * Every comparison of a number becomes an inclusive range, so all tests
+ * on one field intersect into one; a != on the edge of that range narrows
+ * it instead. A range that admits every value of its column is dropped,
+ * and an empty one marks the whole plan as matching nothing. The tests
+ * left are ordered by their rank: equalities, then two-sided and
+ * one-sided ranges, then !=, then text equality and substrings, with
+ * negated text tests last since they rarely reject a row.
+ *
+ * On a table the first test, when it is a range, runs as a vectorized
+ * column scan; every later test only looks at the rows the earlier ones
+ * kept. An artist test that still has more rows to look at than the table
+ * has distinct artists is run on the artist dictionary instead, and the
+ * rows only look up their artist in the result.
+ *
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+#include "where.h"
+
+static const struct {
+    const char *name;
+    where_field field;
+} field_names[] = {
+    {"year", WHERE_YEAR},
+    {"month", WHERE_MONTH},
+    {"day", WHERE_DAY},
+    {"spotify", WHERE_SPOTIFY},
+    {"apple", WHERE_APPLE},
+    {"streams", WHERE_STREAMS},
+    {"track", WHERE_TRACK},
+    {"artist", WHERE_ARTIST},
+};
+
+typedef enum {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_CONTAINS,
+    OP_NOT_CONTAINS
+} where_op;
+
+static const struct {
+    const char *symbol;
+    where_op op;
+} operators[] = {
+    // Two-character operators first, so that "<=" is not read as "<"
+    {"<=", OP_LE}, {">=", OP_GE}, {"!=", OP_NE}, {"<>", OP_NE}, {"==", OP_EQ}, {"!~", OP_NOT_CONTAINS},
+    {"<", OP_LT},  {">", OP_GT},  {"=", OP_EQ},  {"~", OP_CONTAINS},
+};
+
+// Tells whether a field holds text
+static bool is_text(where_field field)
+{
+    return field == WHERE_TRACK || field == WHERE_ARTIST;
+}
+
+// Smallest value of the column a numeric field is stored in
+static int64_t field_min(where_field field)
+{
+    return field == WHERE_STREAMS ? INT64_MIN : INT32_MIN;
+}
+
+// Largest value of the column a numeric field is stored in
+static int64_t field_max(where_field field)
+{
+    return field == WHERE_STREAMS ? INT64_MAX : INT32_MAX;
+}
+
+// Tells whether [s, s + n) is the word, ignoring case
+static bool word_is(const char *s, size_t n, const char *word)
+{
+    return strlen(word) == n && strncasecmp(s, word, n) == 0;
+}
+
+// Reads a word of letters and underscores; returns its length, 0 if there is none
+static size_t read_word(const char **p)
+{
+    const char *start = *p;
+
+    while (isalpha((unsigned char)**p) || **p == '_')
+    {
+        (*p)++;
+    }
+    return (size_t)(*p - start);
+}
+
+static void skip_spaces(const char **p)
+{
+    while (**p == ' ' || **p == '\t')
+    {
+        (*p)++;
+    }
+}
+
+/**
+ * Function:  parse_test
+ * ---------------------
+ * @brief  Parses one test into the next free slot of a plan.
+ *
+ * @param plan The plan.
+ * @param p The position in the expression, moved past the test.
+ * @param ignore_case Whether text tests ignore the case of ASCII letters.
+ * @param error Receives a description of a malformed test.
+ * @param size The size of error.
+ *
+ * @return int 0 on success, -1 if the test is malformed.
+ *
+ */
+static int parse_test(where_plan *plan, const char **p, bool ignore_case, char *error, size_t size)
+{
+    where_test *test = &plan->tests[plan->count];
+    const char *name = *p;
+    size_t name_len = read_word(p);
+    size_t i;
+    where_op op;
+
+    for (i = 0; i < sizeof(field_names) / sizeof(field_names[0]); i++)
+    {
+        if (word_is(name, name_len, field_names[i].name))
+        {
+            break;
+        }
+    }
+    if (i == sizeof(field_names) / sizeof(field_names[0]))
+    {
+        snprintf(error, size, "Unknown field in --where at \"%.20s\".", name);
+        return -1;
+    }
+    test->field = field_names[i].field;
+    test->negate = false;
+
+    skip_spaces(p);
+    for (i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        size_t n = strlen(operators[i].symbol);
+        if (strncmp(*p, operators[i].symbol, n) == 0)
+        {
+            *p += n;
+            break;
+        }
+    }
+    if (i == sizeof(operators) / sizeof(operators[0]))
+    {
+        snprintf(error, size, "Expected a comparison in --where at \"%.20s\".", *p);
+        return -1;
+    }
+    op = operators[i].op;
+    skip_spaces(p);
+
+    if (is_text(test->field))
+    {
+        char quote = **p;
+        const char *close;
+
+        if (op != OP_EQ && op != OP_NE && op != OP_CONTAINS && op != OP_NOT_CONTAINS)
+        {
+            snprintf(error, size, "Text in --where can only be compared with =, !=, ~ or !~.");
+            return -1;
+        }
+        close = quote == '\'' || quote == '"' ? strchr(*p + 1, quote) : NULL;
+        if (close == NULL)
+        {
+            snprintf(error, size, "Expected quoted text in --where at \"%.20s\".", *p);
+            return -1;
+        }
+
+        char *text = strndup(*p + 1, (size_t)(close - *p - 1));
+        matcher_init(&test->text, text, ignore_case);
+        free(text);
+        test->kind = op == OP_EQ || op == OP_NE ? WHERE_EQUALS : WHERE_CONTAINS;
+        test->negate = op == OP_NE || op == OP_NOT_CONTAINS;
+        *p = close + 1;
+        plan->count++;
+        return 0;
+    }
+
+    char *end;
+    errno = 0;
+    int64_t value = strtoll(*p, &end, 10);
+    if (end == *p || errno == ERANGE || isalnum((unsigned char)*end))
+    {
+        snprintf(error, size, "Expected an integer in --where at \"%.20s\".", *p);
+        return -1;
+    }
+    *p = end;
+
+    test->kind = WHERE_RANGE;
+    test->lo = INT64_MIN;
+    test->hi = INT64_MAX;
+    switch (op)
+    {
+    case OP_EQ:
+        test->lo = test->hi = value;
+        break;
+    case OP_NE:
+        test->kind = WHERE_NOT_EQUAL;
+        test->lo = test->hi = value;
+        break;
+    case OP_LT:
+        if (value == INT64_MIN)
+        {
+            // Nothing is below INT64_MIN: an empty range
+            test->lo = INT64_MAX;
+            test->hi = INT64_MIN;
+        }
+        else
+        {
+            test->hi = value - 1;
+        }
+        break;
+    case OP_LE:
+        test->hi = value;
+        break;
+    case OP_GT:
+        if (value == INT64_MAX)
+        {
+            test->lo = INT64_MAX;
+            test->hi = INT64_MIN;
+        }
+        else
+        {
+            test->lo = value + 1;
+        }
+        break;
+    case OP_GE:
+        test->lo = value;
+        break;
+    default:
+        snprintf(error, size, "Numbers in --where cannot be compared with ~ or !~.");
+        return -1;
+    }
+    plan->count++;
+    return 0;
+}
+
+// Orders the tests: cheap and selective first
+static int test_rank(const where_test *test)
+{
+    switch (test->kind)
+    {
+    case WHERE_RANGE:
+        if (test->lo == test->hi)
+        {
+            return 0;
+        }
+        return test->lo == field_min(test->field) || test->hi == field_max(test->field) ? 2 : 1;
+    case WHERE_NOT_EQUAL:
+        return 3;
+    case WHERE_EQUALS:
+        return test->negate ? 6 : 4;
+    default:
+        return test->negate ? 7 : 5;
+    }
+}
+
+/**
+ * Function:  fold_numbers
+ * -----------------------
+ * @brief  Intersects the tests on each numeric field and drops those that cannot fail.
+ *
+ * @param plan The plan, whose tests are rewritten in place.
+ *
+ */
+static void fold_numbers(where_plan *plan)
+{
+    where_test folded[WHERE_MAX_TESTS];
+    size_t count = 0;
+
+    for (where_field field = WHERE_YEAR; field <= WHERE_STREAMS; field++)
+    {
+        int64_t lo = field_min(field);
+        int64_t hi = field_max(field);
+        bool narrowed = true;
+        bool empty = false;
+
+        for (size_t i = 0; i < plan->count; i++)
+        {
+            const where_test *test = &plan->tests[i];
+            if (test->field == field && test->kind == WHERE_RANGE)
+            {
+                lo = test->lo > lo ? test->lo : lo;
+                hi = test->hi < hi ? test->hi : hi;
+            }
+        }
+        empty = lo > hi;
+        // A != on an edge of the range moves the edge, which may put another != on the new edge
+        while (narrowed && !empty)
+        {
+            narrowed = false;
+            for (size_t i = 0; i < plan->count && !empty; i++)
+            {
+                const where_test *test = &plan->tests[i];
+                if (test->field != field || test->kind != WHERE_NOT_EQUAL)
+                {
+                    continue;
+                }
+                if (test->lo == lo && lo == hi)
+                {
+                    empty = true;
+                }
+                else if (test->lo == lo)
+                {
+                    lo++;
+                    narrowed = true;
+                }
+                else if (test->lo == hi)
+                {
+                    hi--;
+                    narrowed = true;
+                }
+            }
+        }
+        if (empty)
+        {
+            plan->never = true;
+            continue;
+        }
+
+        if (lo != field_min(field) || hi != field_max(field))
+        {
+            where_test *range = &folded[count++];
+            range->field = field;
+            range->kind = WHERE_RANGE;
+            range->negate = false;
+            range->lo = lo;
+            range->hi = hi;
+        }
+        for (size_t i = 0; i < plan->count; i++)
+        {
+            const where_test *test = &plan->tests[i];
+            // A value the range already excludes needs no test of its own
+            if (test->field == field && test->kind == WHERE_NOT_EQUAL && test->lo > lo && test->lo < hi)
+            {
+                folded[count++] = *test;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        if (is_text(plan->tests[i].field))
+        {
+            folded[count++] = plan->tests[i];
+        }
+    }
+    memcpy(plan->tests, folded, count * sizeof(where_test));
+    plan->count = count;
+}
+
+/**
+ * Function:  where_parse
+ * ----------------------
+ * @brief  Parses a filter expression into a plan.
+ *
+ * @param plan The plan to be filled in; release it with where_free(), even on failure.
+ * @param expr The expression, such as "year>=2020 AND artist~'Drake'".
+ * @param ignore_case Whether text tests ignore the case of ASCII letters.
+ * @param error Receives a description of a malformed expression.
+ * @param size The size of error.
+ *
+ * @return int 0 on success, -1 if the expression is malformed.
+ *
+ */
+int where_parse(where_plan *plan, const char *expr, bool ignore_case, char *error, size_t size)
+{
+    const char *p = expr;
+
+    plan->count = 0;
+    plan->never = false;
+
+    for (;;)
+    {
+        skip_spaces(&p);
+        if (plan->count == WHERE_MAX_TESTS)
+        {
+            snprintf(error, size, "--where takes at most %d tests.", WHERE_MAX_TESTS);
+            return -1;
+        }
+        if (parse_test(plan, &p, ignore_case, error, size) != 0)
+        {
+            return -1;
+        }
+        skip_spaces(&p);
+        if (*p == '\0')
+        {
+            break;
+        }
+
+        const char *keyword = p;
+        size_t keyword_len = read_word(&p);
+        if (!word_is(keyword, keyword_len, "AND"))
+        {
+            snprintf(error, size, "Expected AND in --where at \"%.20s\".", keyword);
+            return -1;
+        }
+    }
+
+    fold_numbers(plan);
+
+    // Insertion sort keeps tests of equal rank in the order they were written
+    for (size_t i = 1; i < plan->count; i++)
+    {
+        where_test test = plan->tests[i];
+        size_t j = i;
+        while (j > 0 && test_rank(&plan->tests[j - 1]) > test_rank(&test))
+        {
+            plan->tests[j] = plan->tests[j - 1];
+            j--;
+        }
+        plan->tests[j] = test;
+    }
+    return 0;
+}
+
+// Returns the column a numeric field of a table is stored in, for the 32-bit ones
+static const int32_t *table_column(const song_table *table, where_field field)
+{
+    switch (field)
+    {
+    case WHERE_YEAR:
+        return table->year;
+    case WHERE_MONTH:
+        return table->month;
+    case WHERE_DAY:
+        return table->day;
+    case WHERE_SPOTIFY:
+        return table->spotify;
+    default:
+        return table->apple;
+    }
+}
+
+// Tells whether a number passes a numeric test
+static bool test_number(const where_test *test, int64_t value)
+{
+    if (test->kind == WHERE_RANGE)
+    {
+        return value >= test->lo && value <= test->hi;
+    }
+    return value != test->lo;
+}
+
+// Tells whether a text passes a text test
+static bool test_text(const where_test *test, const char *s, size_t n)
+{
+    bool found;
+
+    if (test->kind == WHERE_CONTAINS)
+    {
+        found = matcher_find_n(&test->text, s, n);
+    }
+    else if (test->text.ignore_case)
+    {
+        found = n == test->text.len && strncasecmp(s, test->text.needle, n) == 0;
+    }
+    else
+    {
+        found = n == test->text.len && memcmp(s, test->text.needle, n) == 0;
+    }
+    return found != test->negate;
+}
+
+// Tells whether a row of a table passes a test
+static bool test_row(const where_test *test, const song_table *table, uint32_t row)
+{
+    const char *s;
+
+    switch (test->field)
+    {
+    case WHERE_STREAMS:
+        return test_number(test, table->streams[row]);
+    case WHERE_TRACK:
+        s = table_track(table, row);
+        return test_text(test, s, strlen(s));
+    case WHERE_ARTIST:
+        s = table_artist(table, row);
+        return test_text(test, s, strlen(s));
+    default:
+        return test_number(test, table_column(table, test->field)[row]);
+    }
+}
+
+// Tells whether an artist name of the dictionary passes a text test
+static bool artist_passes(const char *name, const void *arg)
+{
+    return test_text((const where_test *)arg, name, strlen(name));
+}
+
+/**
+ * Function:  where_select
+ * -----------------------
+ * @brief  Selects the rows of a range of a table that pass every test of a plan.
+ *
+ * Row 0 holds the header line of the file, whose numbers read as 0, so
+ * it is never selected even when the range starts there.
+ *
+ * @param plan The plan.
+ * @param table The table.
+ * @param start The first row of the range.
+ * @param end The row past the range.
+ * @param out Receives the passing rows in increasing order; room for end - start rows.
+ *
+ * @return size_t The number of passing rows.
+ *
+ */
+size_t where_select(const where_plan *plan, const song_table *table, size_t start, size_t end, uint32_t *out)
+{
+    size_t n = 0;
+    size_t first = 0;
+
+    if (plan->never)
+    {
+        return 0;
+    }
+    if (start == 0)
+    {
+        start = 1;
+    }
+    if (start >= end)
+    {
+        return 0;
+    }
+
+    if (plan->count > 0 && plan->tests[0].kind == WHERE_RANGE)
+    {
+        const where_test *test = &plan->tests[0];
+        if (test->field == WHERE_STREAMS)
+        {
+            n = filter_range_i64(table->streams, start, end, test->lo, test->hi, out);
+        }
+        else
+        {
+            // Folding clamped the range to the 32-bit column
+            n = filter_range_i32(table_column(table, test->field), start, end, (int32_t)test->lo,
+                                 (int32_t)test->hi, out);
+        }
+        first = 1;
+    }
+    else
+    {
+        for (size_t row = start; row < end; row++)
+        {
+            out[n++] = (uint32_t)row;
+        }
+    }
+
+    for (size_t i = first; i < plan->count; i++)
+    {
+        const where_test *test = &plan->tests[i];
+        size_t kept = 0;
+
+        if (test->field == WHERE_ARTIST && n > table->artist_count)
+        {
+            uint64_t *artists = table_match_artists(table, artist_passes, test);
+            for (size_t j = 0; j < n; j++)
+            {
+                if (table_artist_in(table, artists, out[j]))
+                {
+                    out[kept++] = out[j];
+                }
+            }
+            free(artists);
+            n = kept;
+            continue;
+        }
+        for (size_t j = 0; j < n; j++)
+        {
+            if (test_row(test, table, out[j]))
+            {
+                out[kept++] = out[j];
+            }
+        }
+        n = kept;
+    }
+    return n;
+}
+
+/**
+ * Function:  where_match
+ * ----------------------
+ * @brief  Tells whether a streamed row passes every test of a plan.
+ *
+ * The stream never passes the header line here, as its numbers would
+ * read as 0.
+ *
+ * @param plan The plan.
+ * @param row The row.
+ *
+ * @return bool True if the row passes.
+ *
+ */
+bool where_match(const where_plan *plan, const stream_row *row)
+{
+    if (plan->never)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        const where_test *test = &plan->tests[i];
+        bool passed;
+
+        switch (test->field)
+        {
+        case WHERE_YEAR:
+            passed = test_number(test, row->year);
+            break;
+        case WHERE_MONTH:
+            passed = test_number(test, row->month);
+            break;
+        case WHERE_DAY:
+            passed = test_number(test, row->day);
+            break;
+        case WHERE_SPOTIFY:
+            passed = test_number(test, row->spotify);
+            break;
+        case WHERE_APPLE:
+            passed = test_number(test, row->apple);
+            break;
+        case WHERE_STREAMS:
+            passed = test_number(test, row->streams);
+            break;
+        case WHERE_TRACK:
+            passed = test_text(test, row->track.ptr, row->track.len);
+            break;
+        default:
+            passed = test_text(test, row->artist.ptr, row->artist.len);
+            break;
+        }
+        if (!passed)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Function:  where_columns
+ * ------------------------
+ * @brief  Returns the set of input columns the tests of a plan read.
+ *
+ * @param plan The plan.
+ *
+ * @return unsigned The columns, as FIELD_BIT() of their positions.
+ *
+ */
+unsigned where_columns(const where_plan *plan)
+{
+    static const int positions[] = {
+        [WHERE_YEAR] = FIELD_YEAR,
+        [WHERE_MONTH] = FIELD_MONTH,
+        [WHERE_DAY] = FIELD_DAY,
+        [WHERE_SPOTIFY] = FIELD_SPOTIFY,
+        [WHERE_APPLE] = FIELD_APPLE,
+        [WHERE_STREAMS] = FIELD_STREAMS,
+        [WHERE_TRACK] = FIELD_TRACK,
+        [WHERE_ARTIST] = FIELD_ARTIST,
+    };
+    unsigned columns = 0;
+
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        columns |= FIELD_BIT(positions[plan->tests[i].field]);
+    }
+    return columns;
+}
+
+/**
+ * Function:  where_free
+ * ---------------------
+ * @brief  Releases the memory held by the text tests of a plan.
+ *
+ * @param plan The plan.
+ *
+ */
+void where_free(where_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++)
+    {
+        if (is_text(plan->tests[i].field))
+        {
+            matcher_free(&plan->tests[i].text);
+        }
+    }
+    plan->count = 0;
+}
@@ -0,0 +1,65 @@
+/** @file where.h
+ *  @brief Function prototypes for the --where filter expressions.
+ *
+ *  An expression is a list of tests joined by AND, such as
+ *  "year>=2020 AND spotify>5000 AND artist~'Drake'". It is parsed once
+ *  into a plan: the tests on each number are folded into a single range,
+ *  tests that cannot change the result are dropped, and the rest are put
+ *  in the order they are cheapest to run and most likely to fail in, so
+ *  that substring searches only see the rows every number test kept.
+ */
+#ifndef _WHERE_H_
+#define _WHERE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "match.h"
+#include "stream.h"
+#include "table.h"
+
+#define WHERE_MAX_TESTS 16
+
+typedef enum {
+    WHERE_YEAR,
+    WHERE_MONTH,
+    WHERE_DAY,
+    WHERE_SPOTIFY,
+    WHERE_APPLE,
+    WHERE_STREAMS,
+    WHERE_TRACK,
+    WHERE_ARTIST
+} where_field;
+
+typedef enum {
+    WHERE_RANGE,
+    WHERE_NOT_EQUAL,
+    WHERE_EQUALS,
+    WHERE_CONTAINS
+} where_kind;
+
+typedef struct {
+    where_field field;
+    where_kind kind;
+    bool negate;
+    int64_t lo;
+    int64_t hi;
+    matcher_t text;
+} where_test;
+
+typedef struct {
+    where_test tests[WHERE_MAX_TESTS];
+    size_t count;
+    bool never;
+} where_plan;
+
+/**
+ * Function protypes associated with filter expressions.
+ */
+int where_parse(where_plan *, const char *expr, bool ignore_case, char *error, size_t size);
+size_t where_select(const where_plan *, const song_table *, size_t start, size_t end, uint32_t *out);
+bool where_match(const where_plan *, const stream_row *);
+unsigned where_columns(const where_plan *);
+void where_free(where_plan *);
+
+#endif
@@ -0,0 +1,412 @@
+/** @file writer.c
+ *  @brief Implementation of the buffered output writer.
+ *
+ * Integers are written two digits at a time from a 200-byte table of the
+ * pairs "00" to "99", right to left into a small scratch area, and then
+ * copied into the buffer. A song row reserves room for its longest
+ * possible form up front, so each field is copied without a bounds check.
+ * A name holding a comma, a quote or a line break is written quoted as
+ * RFC 4180 asks, with its quotes doubled; such rows take the slow path.
+ *
+ * A failed write is remembered rather than reported at once: later output
+ * is dropped, and writer_flush() and writer_close() return -1 with errno
+ * from the failure.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "emalloc.h"
+#include "writer.h"
+
+// Longest decimal form of an int64_t, with its sign
+#define MAX_DIGITS 20
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/**
+ * Function:  format_int
+ * ---------------------
+ * @brief  Writes the decimal form of a number.
+ *
+ * @param out Where the digits go; it must have room for MAX_DIGITS bytes.
+ * @param value The number.
+ *
+ * @return size_t The number of bytes written.
+ *
+ */
+static inline size_t format_int(char *out, int64_t value)
+{
+    char scratch[MAX_DIGITS];
+    char *p = scratch + MAX_DIGITS;
+    // Work on the magnitude as unsigned so that INT64_MIN has one too
+    uint64_t n = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+    while (n >= 100)
+    {
+        unsigned pair = (unsigned)(n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (n >= 10)
+    {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    }
+    else
+    {
+        *--p = (char)('0' + n);
+    }
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+
+    size_t length = (size_t)(scratch + MAX_DIGITS - p);
+    memcpy(out, p, length);
+    return length;
+}
+
+/**
+ * Function:  write_all
+ * --------------------
+ * @brief  Writes a block to the descriptor, retrying short and interrupted writes.
+ *
+ * @param w The writer.
+ * @param data The bytes.
+ * @param n The number of bytes.
+ *
+ */
+static void write_all(out_writer *w, const char *data, size_t n)
+{
+    while (n > 0 && !w->failed)
+    {
+        ssize_t done = write(w->fd, data, n);
+        if (done < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            w->failed = true;
+            w->error = errno;
+            return;
+        }
+        data += done;
+        n -= (size_t)done;
+        w->bytes += (uint64_t)done;
+    }
+}
+
+/**
+ * Function:  writer_init
+ * ----------------------
+ * @brief  Prepares a writer over an open descriptor, which it does not close.
+ *
+ * @param w The writer to be initialized.
+ * @param fd The descriptor to write to.
+ *
+ */
+void writer_init(out_writer *w, int fd)
+{
+    w->fd = fd;
+    w->owns_fd = false;
+    w->failed = false;
+    w->error = 0;
+    w->buffer = (char *)emalloc(WRITER_BUFFER_SIZE);
+    w->used = 0;
+    w->size = WRITER_BUFFER_SIZE;
+    w->rows = 0;
+    w->bytes = 0;
+}
+
+/**
+ * Function:  writer_open
+ * ----------------------
+ * @brief  Prepares a writer over a file, created or truncated, or over stdout.
+ *
+ * @param w The writer to be initialized.
+ * @param path The path of the file, or WRITER_STDOUT for the standard output.
+ *
+ * @return int 0 on success, -1 if the file could not be opened.
+ *
+ */
+int writer_open(out_writer *w, const char *path)
+{
+    if (strcmp(path, WRITER_STDOUT) == 0)
+    {
+        // Anything stdio already buffered must come first
+        fflush(stdout);
+        writer_init(w, STDOUT_FILENO);
+        return 0;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    writer_init(w, fd);
+    w->owns_fd = true;
+    return 0;
+}
+
+/**
+ * Function:  writer_put
+ * ---------------------
+ * @brief  Appends bytes to the output.
+ *
+ * @param w The writer.
+ * @param s The bytes.
+ * @param n The number of bytes.
+ *
+ */
+void writer_put(out_writer *w, const char *s, size_t n)
+{
+    if (w->used + n > w->size)
+    {
+        writer_flush(w);
+        if (n > w->size)
+        {
+            // Too big to be worth copying: write it straight through
+            write_all(w, s, n);
+            return;
+        }
+    }
+    memcpy(w->buffer + w->used, s, n);
+    w->used += n;
+}
+
+// Appends a NUL-terminated string to the output
+void writer_puts(out_writer *w, const char *s)
+{
+    writer_put(w, s, strlen(s));
+}
+
+// Appends one byte to the output
+void writer_char(out_writer *w, char c)
+{
+    if (w->used == w->size)
+    {
+        writer_flush(w);
+    }
+    w->buffer[w->used++] = c;
+}
+
+// Appends the decimal form of a number to the output
+void writer_int(out_writer *w, int64_t value)
+{
+    if (w->used + MAX_DIGITS > w->size)
+    {
+        writer_flush(w);
+    }
+    w->used += format_int(w->buffer + w->used, value);
+}
+
+/**
+ * Function:  writer_printf
+ * ------------------------
+ * @brief  Appends formatted text, for the rare lines that are not song rows.
+ *
+ * @param w The writer.
+ * @param format The printf() format.
+ *
+ */
+void writer_printf(out_writer *w, const char *format, ...)
+{
+    char line[1024];
+    va_list ap;
+
+    va_start(ap, format);
+    int n = vsnprintf(line, sizeof(line), format, ap);
+    va_end(ap);
+    if (n < 0)
+    {
+        return;
+    }
+    if ((size_t)n < sizeof(line))
+    {
+        writer_put(w, line, (size_t)n);
+        return;
+    }
+
+    char *long_line = (char *)emalloc((size_t)n + 1);
+    va_start(ap, format);
+    vsnprintf(long_line, (size_t)n + 1, format, ap);
+    va_end(ap);
+    writer_put(w, long_line, (size_t)n);
+    free(long_line);
+}
+
+// Bytes that force a name to be quoted
+static const unsigned char special[256] = {[','] = 1, ['"'] = 1, ['\n'] = 1, ['\r'] = 1};
+
+// Tells whether a name can be written as it is
+static bool plain_name(const char *s, size_t n)
+{
+    unsigned char found = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        found |= special[(unsigned char)s[i]];
+    }
+    return found == 0;
+}
+
+/**
+ * Function:  writer_name
+ * ----------------------
+ * @brief  Appends a name as a CSV field, enclosed in quotes with its own
+ *         quotes doubled if it holds a comma, a quote or a line break.
+ *
+ * @param w The writer.
+ * @param s The name, which need not be NUL-terminated.
+ * @param n The length of the name.
+ *
+ */
+void writer_name(out_writer *w, const char *s, size_t n)
+{
+    const char *quote;
+
+    if (plain_name(s, n))
+    {
+        writer_put(w, s, n);
+        return;
+    }
+    writer_char(w, '"');
+    while ((quote = memchr(s, '"', n)) != NULL)
+    {
+        size_t head = (size_t)(quote - s) + 1;
+        writer_put(w, s, head);
+        writer_char(w, '"');
+        s += head;
+        n -= head;
+    }
+    writer_put(w, s, n);
+    writer_char(w, '"');
+}
+
+/**
+ * Function:  writer_song
+ * ----------------------
+ * @brief  Appends a song row: "year-month-day,track,artist,value" and a newline.
+ *
+ * @param w The writer.
+ * @param year The release year.
+ * @param month The release month.
+ * @param day The release day.
+ * @param track The track name.
+ * @param track_len The length of the track name.
+ * @param artist The artist name(s).
+ * @param artist_len The length of the artist name(s).
+ * @param value The count displayed in the last column.
+ *
+ */
+void writer_song(out_writer *w, int32_t year, int32_t month, int32_t day, const char *track, size_t track_len,
+                 const char *artist, size_t artist_len, int64_t value)
+{
+    size_t longest = 4 * MAX_DIGITS + track_len + artist_len + 6;
+    bool plain = plain_name(track, track_len) && plain_name(artist, artist_len);
+
+    w->rows++;
+    if (longest > w->size || !plain)
+    {
+        // A row longer than the whole buffer, or with a name to quote, goes out field by field
+        writer_int(w, year);
+        writer_char(w, '-');
+        writer_int(w, month);
+        writer_char(w, '-');
+        writer_int(w, day);
+        writer_char(w, ',');
+        writer_name(w, track, track_len);
+        writer_char(w, ',');
+        writer_name(w, artist, artist_len);
+        writer_char(w, ',');
+        writer_int(w, value);
+        writer_char(w, '\n');
+        return;
+    }
+    if (w->used + longest > w->size)
+    {
+        writer_flush(w);
+    }
+
+    char *p = w->buffer + w->used;
+    p += format_int(p, year);
+    *p++ = '-';
+    p += format_int(p, month);
+    *p++ = '-';
+    p += format_int(p, day);
+    *p++ = ',';
+    memcpy(p, track, track_len);
+    p += track_len;
+    *p++ = ',';
+    memcpy(p, artist, artist_len);
+    p += artist_len;
+    *p++ = ',';
+    p += format_int(p, value);
+    *p++ = '\n';
+    w->used = (size_t)(p - w->buffer);
+}
+
+/**
+ * Function:  writer_flush
+ * -----------------------
+ * @brief  Hands the buffered output to the kernel with one write().
+ *
+ * @param w The writer.
+ *
+ * @return int 0 on success, -1 if this or an earlier write failed.
+ *
+ */
+int writer_flush(out_writer *w)
+{
+    write_all(w, w->buffer, w->used);
+    w->used = 0;
+    if (w->failed)
+    {
+        errno = w->error;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Function:  writer_close
+ * -----------------------
+ * @brief  Flushes the output, closes the file if the writer opened it and releases the buffer.
+ *
+ * @param w The writer.
+ *
+ * @return int 0 on success, -1 if any write (or closing the file) failed.
+ *
+ */
+int writer_close(out_writer *w)
+{
+    int status = writer_flush(w);
+
+    if (w->owns_fd && close(w->fd) != 0)
+    {
+        status = -1;
+    }
+    free(w->buffer);
+    w->buffer = NULL;
+    w->used = 0;
+    w->size = 0;
+    return status;
+}
@@ -0,0 +1,48 @@
+/** @file writer.h
+ *  @brief Function prototypes for the buffered output writer.
+ *
+ *  A writer collects output in one large buffer and hands it to the kernel
+ *  with a single write() whenever the buffer fills up, instead of going
+ *  through stdio for every row. Numbers are converted to decimal by hand,
+ *  so writing a song row involves no format string at all. A writer also
+ *  counts the song rows and the bytes it has written.
+ */
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WRITER_BUFFER_SIZE (256 * 1024)
+#define WRITER_STDOUT "-"
+
+typedef struct {
+    int fd;
+    bool owns_fd;
+    bool failed;
+    int error;
+    char *buffer;
+    size_t used;
+    size_t size;
+    uint64_t rows;
+    uint64_t bytes;
+} out_writer;
+
+/**
+ * Function protypes associated with the output writer.
+ */
+int writer_open(out_writer *, const char *path);
+void writer_init(out_writer *, int fd);
+void writer_put(out_writer *, const char *s, size_t n);
+void writer_puts(out_writer *, const char *s);
+void writer_char(out_writer *, char c);
+void writer_int(out_writer *, int64_t value);
+void writer_printf(out_writer *, const char *format, ...) __attribute__((format(printf, 2, 3)));
+void writer_name(out_writer *, const char *s, size_t n);
+void writer_song(out_writer *, int32_t year, int32_t month, int32_t day, const char *track, size_t track_len,
+                 const char *artist, size_t artist_len, int64_t value);
+int writer_flush(out_writer *);
+int writer_close(out_writer *);
+
+#endif